@@ -0,0 +1,78 @@
+/* Dereference cost of offset_ptr<T> against raw pointers.
+   Build: g++ -O2 -std=c++11 bench/offset_ptr_bench.cpp -o offset_ptr_bench */
+#define POOL_SIZE       (1 << 24)
+#define BUDDY_MAX_ORDER 24
+#include "../mmu.h"
+#include <chrono>
+
+#define NODES   100000
+#define ROUNDS  200
+
+struct RawNode { long v; RawNode *next; };
+struct OffNode { long v; offset_ptr<OffNode> next; };
+
+static double now_ns(void) {
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* shuffled visiting order, so both lists chase pointers across the pool */
+static void shuffle(size_t *idx, size_t n) {
+    uint32_t x = 2463534242u;
+    for (size_t i = 0; i < n; ++i) idx[i] = i;
+    for (size_t i = n - 1; i > 0; --i) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        size_t j = x % (i + 1);
+        size_t t = idx[i]; idx[i] = idx[j]; idx[j] = t;
+    }
+}
+
+int main(void) {
+    static size_t idx[NODES];
+    shuffle(idx, NODES);
+
+    RawNode *raw = (RawNode*)malloc_first_fit(NODES * sizeof(RawNode));
+    OffNode *off = (OffNode*)malloc_first_fit(NODES * sizeof(OffNode));
+    if (!raw || !off) {
+        fprintf(stderr, "pool too small\n");
+        return 1;
+    }
+    for (size_t i = 0; i < NODES; ++i) {
+        size_t a = idx[i], b = idx[(i + 1) % NODES];
+        raw[a].v = off[a].v = (long)i;
+        raw[a].next = &raw[b];
+        off[a].next = &off[b];
+    }
+
+    long sum_raw = 0, sum_off = 0;
+    double t0 = now_ns();
+    for (int r = 0; r < ROUNDS; ++r) {
+        RawNode *p = &raw[idx[0]];
+        for (size_t i = 0; i < NODES; ++i) { sum_raw += p->v; p = p->next; }
+    }
+    double t1 = now_ns();
+    for (int r = 0; r < ROUNDS; ++r) {
+        offset_ptr<OffNode> p = &off[idx[0]];
+        for (size_t i = 0; i < NODES; ++i) { sum_off += p->v; p = p->next; }
+    }
+    double t2 = now_ns();
+
+    /* sequential walk: offset_ptr as an iterator */
+    offset_ptr<OffNode> first = off, last = off + NODES;
+    long seq = 0;
+    double t3 = now_ns();
+    for (int r = 0; r < ROUNDS; ++r)
+        for (offset_ptr<OffNode> p = first; p != last; ++p) seq += p->v;
+    double t4 = now_ns();
+    long seq_raw = 0;
+    for (int r = 0; r < ROUNDS; ++r)
+        for (RawNode *p = raw; p != raw + NODES; ++p) seq_raw += p->v;
+    double t5 = now_ns();
+
+    double derefs = (double)NODES * ROUNDS;
+    printf("pointer chase  raw %.2f ns   offset_ptr %.2f ns   (%+.1f%%)\n",
+           (t1 - t0) / derefs, (t2 - t1) / derefs, 100.0 * ((t2 - t1) / (t1 - t0) - 1.0));
+    printf("sequential     raw %.2f ns   offset_ptr %.2f ns   (%+.1f%%)\n",
+           (t5 - t4) / derefs, (t4 - t3) / derefs, 100.0 * ((t4 - t3) / (t5 - t4) - 1.0));
+    return sum_raw == sum_off && seq == seq_raw ? 0 : 1;
+}
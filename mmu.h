@@ -6,34 +6,93 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <sched.h>
 
 /* CONFIG */
+/* POOL_SIZE and BUDDY_MAX_ORDER may be overridden together before including */
+#ifndef POOL_SIZE
 #define POOL_SIZE       4096
+#endif
 #define MAGIC_ALLOC     0xDEADBEEF
 #define MAGIC_FREE      0xFEE1DEAD
 #define MIN_BLOCK_SIZE  32
+#define POOL_ALIGN      16   /* payload alignment of fit blocks; pool_ref_t unit */
+#ifndef BUDDY_MAX_ORDER
 #define BUDDY_MAX_ORDER 12   // 1 << 12 == 4096
+#endif
+#define POOL_PAGE_SIZE  4096
+#define POOL_PAGES      (POOL_SIZE / POOL_PAGE_SIZE)
+#define MAX_HANDLES     1024 /* must fit in Header.handle */
+#define SLAB_PAGE_SIZE   4096
+#define SLAB_ARENA_PAGES 64
+#define SLAB_MIN_OBJ     16
+#define SLAB_MAX_OBJ     1024
+#ifndef COLD_STORE_SIZE
+#define COLD_STORE_SIZE  (POOL_SIZE / 2) /* side store for compressed pages */
+#endif
+#define COLD_UNIT        64              /* side store allocation granule */
+#define PAGE_COLD_AGE    2               /* tracker samples without access before a page is cold */
+#define TIER_HOT_ACCESSES 4                /* locks between rebalances that promote a slow handle */
+#define TIER_FAST_RESERVE (POOL_SIZE / 8)  /* free pool bytes tier_rebalance() tries to keep */
+#define VBUF_COMMIT_CHUNK (1 << 16)      /* granularity of growable reservation commits */
+#define EPOCH_MAX_THREADS 64               /* threads that can be registered for retire() */
+#define GEN_MAX           256              /* live allocation generations */
+#define GEN_CHUNK_SIZE    (POOL_SIZE / 16 < 65536 ? POOL_SIZE / 16 : 65536)  /* generation chunk payload */
+#define ZERO_MIN_BLOCK    POOL_PAGE_SIZE   /* free blocks smaller than this are not pre-zeroed */
+#define ZERO_SLICE        (1 << 16)        /* bytes zeroed per pool lock hold */
+#ifndef PT_CHUNK_ORDER
+#define PT_CHUNK_ORDER    (BUDDY_MAX_ORDER < 16 ? BUDDY_MAX_ORDER : 16)  /* buddy chunk page tables are carved from */
+#endif
+#ifndef IOBUF_POOL_SIZE
+#define IOBUF_POOL_SIZE  (1 << 22)       /* io_uring fixed-buffer region */
+#endif
+
+/* the buddy system treats the whole pool as one top-order block */
+typedef char pool_size_matches_buddy_order[(POOL_SIZE == ((size_t)1 << BUDDY_MAX_ORDER)) ? 1 : -1];
+/* every payload offset must be expressible as a 32-bit pool_ref_t */
+typedef char pool_size_fits_refs[((unsigned long long)POOL_SIZE / POOL_ALIGN <= 0xFFFFFFFFull) ? 1 : -1];
 
 /* HEADER & METADATA IN-BLOCK */
 typedef struct header {
     size_t size;       /* user payload size */
     uint32_t magic;    /* MAGIC_ALLOC / MAGIC_FREE */
     uint8_t is_free;   /* 1 if free */
+    uint8_t flags;     /* BLOCK_* */
+    uint16_t handle;   /* owning handle (index + 1), 0 for raw-pointer blocks */
 } Header;
 
+/* Header.flags */
+#define BLOCK_ZEROED 0x1   /* a free block whose payload past its FreeMeta is all zero */
+#define BLOCK_BUDDY  0x2   /* an allocated block from the buddy allocator; its order follows from its size */
+
 /* Free metadata placed immediately after header in free blocks.
-   Separate pointers for address-sorted list and for buddy lists to avoid conflicts.
+   Separate links for address-sorted list and for buddy lists to avoid conflicts.
+   Links are pool offsets of the linked block's Header (POOL_NIL for none), so
+   the structures stay valid wherever the pool is mapped.
 */
+#define POOL_NIL ((size_t)-1)
+
 typedef struct free_meta {
-    /* Address-sorted doubly-linked list pointers */
-    struct free_meta *addr_prev;
-    struct free_meta *addr_next;
+    /* Address-sorted doubly-linked list links */
+    size_t addr_prev;
+    size_t addr_next;
 
-    /* Buddy singly-linked list pointer (for buddy-managed blocks only) */
-    struct free_meta *buddy_next;
+    /* Buddy singly-linked list link (for buddy-managed blocks only) */
+    size_t buddy_next;
 
-    /* Buddy order if this block is buddy-managed; -1 if not buddy */
+    /* Buddy order of a free buddy block; -1 for free fit blocks. Allocated
+       blocks keep user data here and are told apart by BLOCK_BUDDY. */
     int order;
 
     /* reserved */
@@ -41,6 +100,27 @@ typedef struct free_meta {
     void *reserved2;
 } FreeMeta;
 
+/* Pool root: first POOL_ROOT_SIZE bytes of the pool mapping, in front of the
+   pool itself. Every list head lives here as a pool offset, so a file-backed
+   pool can be mapped again (at any address) and used immediately. The rest
+   of the root region holds the intent log of the open transaction. */
+#define POOL_ROOT_MAGIC   0x314C4F4F50554D4Dull  /* "MMUPOOL1" */
+#define POOL_ROOT_VERSION 7
+#define POOL_ROOT_SIZE    (4 * POOL_PAGE_SIZE)
+#define POOL_MAP_SIZE     (POOL_ROOT_SIZE + POOL_SIZE)
+
+typedef struct pool_root {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t layout;          /* sizeof(Header) << 16 | sizeof(FreeMeta) */
+    uint64_t pool_size;
+    size_t free_head;         /* address-sorted free list */
+    size_t next_fit_cursor;
+    size_t buddy_heads[BUDDY_MAX_ORDER + 1];
+    uint64_t log_used;        /* bytes of undo records after the root, 0 when no transaction is open */
+    pthread_mutex_t lock;     /* robust, process-shared; held by the outermost transaction */
+} PoolRoot;
+
 /* Helper conversions */
 static inline Header* header_from_user(void *p) {
     return (Header*)((char*)p - sizeof(Header));
@@ -61,72 +141,284 @@ static inline void* block_end(Header *h) {
 /* Globals */
 static void *pool_base = NULL;
 static int pool_initialized = 0;
+static PoolRoot *pool_root = NULL;   /* mapping start, pool_base - POOL_ROOT_SIZE */
+static int pool_file_backed = 0;   /* MAP_SHARED file, memfd or shm object */
+static int pool_fd = -1;           /* kept open for shared pools, see pool_shared_fd() */
+
+//  offset in bytes from pool_base 
+static inline size_t header_offset(Header *h) {
+    return (size_t)((char*)h - (char*)pool_base);
+}
+static inline Header* header_from_offset(size_t off) {
+    return (Header*)((char*)pool_base + off);
+}
+
+/* offset links <-> FreeMeta pointers */
+static inline FreeMeta* meta_at(size_t off) {
+    return off == POOL_NIL ? NULL : meta_from_header(header_from_offset(off));
+}
+static inline size_t meta_off(FreeMeta *m) {
+    return m ? header_offset(header_from_meta(m)) : POOL_NIL;
+}
+static inline FreeMeta* meta_prev(FreeMeta *m) {
+    return meta_at(m->addr_prev);
+}
+static inline FreeMeta* meta_next(FreeMeta *m) {
+    return meta_at(m->addr_next);
+}
+static inline FreeMeta* free_list_head(void) {
+    return meta_at(pool_root->free_head);
+}
 
-/* Address-sorted free list head */
-static FreeMeta *free_head = NULL;
-/* Next-fit cursor */
-static FreeMeta *next_fit_cursor = NULL;
+/* Heap options (POOL_OPT_*), set with pool_set_options() */
+#define POOL_OPT_MLOCK   0x1u  /* pre-fault and mlock() the pool and the slab arena */
+#define POOL_OPT_DURABLE 0x2u  /* msync() the intent log and each commit of a file-backed pool */
+static unsigned pool_options = 0;
+static size_t pool_locked = 0;   /* updated atomically: vbufs lock pages outside the pool lock */
+static size_t pool_map_locked = 0, slab_map_locked = 0;   /* locked bytes of each region */
 
-/* Buddy free lists (index = order), uses buddy_next */
-static FreeMeta *buddy_free_lists[BUDDY_MAX_ORDER + 1] = { NULL };
+/* mlock() faults every page in (breaking COW for private mappings) and pins
+   it. A failed mlock() may have locked part of the range: that is undone. */
+static int lock_region(void *p, size_t len) {
+    if (mlock(p, len) != 0) {
+        perror("mlock");
+        munlock(p, len);
+        return -1;
+    }
+    __atomic_add_fetch(&pool_locked, len, __ATOMIC_RELAXED);
+    return 0;
+}
 
-/* ---------- Initialization ---------- */
-static void init_pool(void) {
-    if (pool_initialized) return;
+/* undo lock_region(p, len) */
+static void unlock_region(void *p, size_t len) {
+    munlock(p, len);
+    __atomic_sub_fetch(&pool_locked, len, __ATOMIC_RELAXED);
+}
 
-    void *p = mmap(NULL, POOL_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
-    if (p == MAP_FAILED) {
-        perror("mmap");
-        exit(1);
+/* ---------- Intent (undo) log ---------- */
+/* Each public call that changes pool metadata is one transaction. On a
+   file-backed pool, the old bytes of every header, free-list node and root
+   field are appended to the log before the first write to them; committing
+   empties the log. A crash leaves a non-empty log behind, and reopening the
+   file copies the saved bytes back in reverse order, so split_block(),
+   coalesce() and buddy merges are all-or-nothing and recovery costs the log
+   length, not the heap size. Without POOL_OPT_DURABLE the log survives a
+   process crash (the page cache keeps it); with it, every record and commit
+   is msync()ed in order so it also survives a power loss. */
+typedef struct plog_entry {
+    size_t off;   /* from the mapping start */
+    size_t len;   /* saved bytes that follow, padded to 8 */
+} PlogEntry;
+
+#define PLOG_CAPACITY (POOL_ROOT_SIZE - sizeof(PoolRoot))
+
+static __thread int plog_depth = 0;   /* this thread's nesting of pool_txn_begin() */
+
+static inline uint8_t* plog_data(void) {
+    return (uint8_t*)(pool_root + 1);
+}
+static inline size_t plog_span(size_t len) {
+    return sizeof(PlogEntry) + ((len + 7) & ~(size_t)7);
+}
+
+/* order writes to the shared mapping; msync() them too in durable mode */
+static void plog_flush(void *addr, size_t len) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!(pool_options & POOL_OPT_DURABLE)) return;
+    uintptr_t start = (uintptr_t)addr & ~(uintptr_t)(POOL_PAGE_SIZE - 1);
+    msync((void*)start, (uintptr_t)addr + len - start, MS_SYNC);
+}
+
+/* make the transaction's writes durable, then empty the log */
+static void plog_commit(void) {
+    if (!pool_file_backed || pool_root->log_used == 0) return;
+    plog_flush(pool_base, POOL_SIZE);
+    pool_root->log_used = 0;
+    plog_flush(&pool_root->log_used, sizeof(pool_root->log_used));
+}
+
+/* save [addr, addr + len) before it is first written in this transaction */
+static void plog_save(void *addr, size_t len) {
+    if (!pool_file_backed || plog_depth == 0) return;
+    size_t off = (size_t)((char*)addr - (char*)pool_root);
+    if (off + len > POOL_MAP_SIZE) len = POOL_MAP_SIZE - off;
+    for (size_t pos = 0; pos < pool_root->log_used; ) {
+        PlogEntry *e = (PlogEntry*)(plog_data() + pos);
+        if (e->off == off && e->len == len) return;
+        pos += plog_span(e->len);
+    }
+    size_t span = plog_span(len);
+    if (pool_root->log_used + span > PLOG_CAPACITY) {
+        /* cannot happen for the bounded updates of one call; degrade to a checkpoint */
+        fprintf(stderr, "Intent log full, committing early\n");
+        plog_commit();
+    }
+    PlogEntry *e = (PlogEntry*)(plog_data() + pool_root->log_used);
+    e->off = off;
+    e->len = len;
+    memcpy(e + 1, addr, len);
+    plog_flush(e, span);
+    pool_root->log_used += span;
+    plog_flush(&pool_root->log_used, sizeof(pool_root->log_used));
+}
+
+static inline void plog_block(Header *h) {
+    plog_save(h, sizeof(Header) + sizeof(FreeMeta));
+}
+static inline void plog_root(void) {
+    plog_save(&pool_root->free_head, offsetof(PoolRoot, log_used) - offsetof(PoolRoot, free_head));
+}
+
+/* roll back an interrupted transaction; returns records undone */
+static size_t plog_recover(void) {
+    static size_t pos_stack[PLOG_CAPACITY / sizeof(PlogEntry)];
+    size_t n = 0, pos = 0, used = pool_root->log_used;
+    if (used > PLOG_CAPACITY) used = 0;   /* torn root: nothing trustworthy to undo */
+    while (pos + sizeof(PlogEntry) <= used) {
+        PlogEntry *e = (PlogEntry*)(plog_data() + pos);
+        if (e->off < offsetof(PoolRoot, free_head) || e->len > POOL_MAP_SIZE ||
+            e->off + e->len > POOL_MAP_SIZE || pos + plog_span(e->len) > used) break;
+        pos_stack[n++] = pos;
+        pos += plog_span(e->len);
+    }
+    for (size_t i = n; i-- > 0; ) {
+        PlogEntry *e = (PlogEntry*)(plog_data() + pos_stack[i]);
+        memcpy((char*)pool_root + e->off, e + 1, e->len);
+    }
+    msync(pool_root, POOL_MAP_SIZE, MS_SYNC);
+    pool_root->log_used = 0;
+    msync(pool_root, POOL_PAGE_SIZE, MS_SYNC);
+    return n;
+}
+
+static void init_pool(void);
+
+/* Public entry points bracket their work: the outermost begin takes the pool
+   lock, the outermost end commits and releases it. If the previous holder
+   died (another process crashed mid-call), its open transaction is rolled
+   back from the log before the lock is marked consistent again. */
+static void pool_txn_begin(void) {
+    if (plog_depth++ > 0) return;
+    if (!pool_initialized) init_pool();
+    if (pthread_mutex_lock(&pool_root->lock) == EOWNERDEAD) {
+        plog_recover();
+        pthread_mutex_consistent(&pool_root->lock);
     }
-    pool_base = p;
+}
+static void pool_txn_end(void) {
+    if (--plog_depth > 0) return;
+    plog_commit();
+    pthread_mutex_unlock(&pool_root->lock);
+}
+
+/* ---------- Initialization ---------- */
+static void init_pool_lock(void) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&pool_root->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+static void attach_pool_mapping(void *p) {
+    pool_root = (PoolRoot*)p;
+    pool_base = (char*)p + POOL_ROOT_SIZE;
     pool_initialized = 1;
+    if ((pool_options & POOL_OPT_MLOCK) && lock_region(pool_root, POOL_MAP_SIZE) == 0) pool_map_locked = POOL_MAP_SIZE;
+}
+
+/* The magic is written last, with release ordering: a process attaching to
+   a shared pool that is still being formatted waits for it. */
+static void format_pool(void) {
+    pool_root->version = POOL_ROOT_VERSION;
+    pool_root->layout = (uint32_t)(sizeof(Header) << 16 | sizeof(FreeMeta));
+    pool_root->pool_size = POOL_SIZE;
+    init_pool_lock();
 
     /* create a single free block occupying entire pool */
     Header *h = (Header*)pool_base;
-    h->size = POOL_SIZE - sizeof(Header) - sizeof(FreeMeta);
+    h->size = POOL_SIZE - sizeof(Header);
     h->is_free = 1;
     h->magic = MAGIC_FREE;
+    h->handle = 0;
+    h->flags = BLOCK_ZEROED;   /* fresh mappings and truncated files read as zero */
 
     FreeMeta *fm = meta_from_header(h);
-    fm->addr_prev = fm->addr_next = NULL;
-    fm->buddy_next = NULL;
+    fm->addr_prev = fm->addr_next = POOL_NIL;
+    fm->buddy_next = POOL_NIL;
     fm->order = BUDDY_MAX_ORDER; /* whole pool is buddy order 12 */
     fm->reserved1 = fm->reserved2 = NULL;
 
-    free_head = fm;
-    next_fit_cursor = fm;
+    pool_root->free_head = 0;
+    pool_root->next_fit_cursor = 0;
+    pool_root->log_used = 0;
 
     /* init buddy free lists*/
-    for (int i = 0; i <= BUDDY_MAX_ORDER; ++i) buddy_free_lists[i] = NULL;
-    buddy_free_lists[BUDDY_MAX_ORDER] = fm;
+    for (int i = 0; i <= BUDDY_MAX_ORDER; ++i) pool_root->buddy_heads[i] = POOL_NIL;
+    pool_root->buddy_heads[BUDDY_MAX_ORDER] = 0;
+    __atomic_store_n(&pool_root->magic, POOL_ROOT_MAGIC, __ATOMIC_RELEASE);
+}
+
+static void init_pool(void) {
+    if (pool_initialized) return;
+
+    void *p = mmap(NULL, POOL_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    attach_pool_mapping(p);
+    format_pool();
 }
 
 //helpers for address sorted free list
 static void insert_by_address(FreeMeta *fm) {
-    if (!free_head) {
-        fm->addr_prev = fm->addr_next = NULL;
-        free_head = fm;
-        return;
-    }
-    FreeMeta *cur = free_head;
+    size_t off = meta_off(fm);
+    FreeMeta *cur = free_list_head();
     FreeMeta *prev = NULL;
     while (cur && cur < fm) {
         prev = cur;
-        cur = cur->addr_next;
+        cur = meta_next(cur);
     }
-    fm->addr_next = cur;
-    fm->addr_prev = prev;
-    if (prev) prev->addr_next = fm; else free_head = fm;
-    if (cur) cur->addr_prev = fm;
+    plog_block(header_from_meta(fm));
+    if (prev) plog_block(header_from_meta(prev));
+    if (cur) plog_block(header_from_meta(cur));
+    plog_root();
+    fm->addr_next = meta_off(cur);
+    fm->addr_prev = meta_off(prev);
+    if (prev) prev->addr_next = off; else pool_root->free_head = off;
+    if (cur) cur->addr_prev = off;
 }
 
+/* free block pool_zero_step() is working on, POOL_NIL for none */
+static size_t zero_off = POOL_NIL;
+
 static void remove_from_list(FreeMeta *fm) {
     if (!fm) return;
-    if (fm->addr_prev) fm->addr_prev->addr_next = fm->addr_next;
-    else free_head = fm->addr_next;
-    if (fm->addr_next) fm->addr_next->addr_prev = fm->addr_prev;
-    fm->addr_prev = fm->addr_next = NULL;
+    plog_block(header_from_meta(fm));
+    if (fm->addr_prev != POOL_NIL) plog_block(header_from_offset(fm->addr_prev));
+    if (fm->addr_next != POOL_NIL) plog_block(header_from_offset(fm->addr_next));
+    plog_root();
+    /* the whole pool free is the only block on both kinds of list */
+    if (pool_root->buddy_heads[BUDDY_MAX_ORDER] == meta_off(fm)) pool_root->buddy_heads[BUDDY_MAX_ORDER] = POOL_NIL;
+    /* keep the next-fit cursor off blocks that are being allocated or merged away */
+    if (pool_root->next_fit_cursor == meta_off(fm)) pool_root->next_fit_cursor = fm->addr_next;
+    /* an absorbed header is left behind intact: it must not stay the zeroing target */
+    if (zero_off == meta_off(fm)) zero_off = POOL_NIL;
+    if (fm->addr_prev != POOL_NIL) meta_prev(fm)->addr_next = fm->addr_next;
+    else pool_root->free_head = fm->addr_next;
+    if (fm->addr_next != POOL_NIL) meta_next(fm)->addr_prev = fm->addr_prev;
+    fm->addr_prev = fm->addr_next = POOL_NIL;
+}
+
+/* `into` just absorbed `gone`: the merged block stays zeroed only if both
+   were, once the absorbed header and FreeMeta are wiped as well */
+static void merge_zeroed(Header *into, Header *gone) {
+    if ((into->flags & BLOCK_ZEROED) && (gone->flags & BLOCK_ZEROED))
+        memset(gone, 0, sizeof(Header) + sizeof(FreeMeta));
+    else
+        into->flags &= (uint8_t)~BLOCK_ZEROED;
 }
 
 // Coalescing
@@ -135,33 +427,43 @@ static FreeMeta* coalesce(FreeMeta *fm) {
     Header *h = header_from_meta(fm);
 
     /* Merge with previous if physically adjacent */
-    if (fm->addr_prev) {
-        FreeMeta *prev = fm->addr_prev;
+    if (fm->addr_prev != POOL_NIL) {
+        FreeMeta *prev = meta_prev(fm);
         Header *ph = header_from_meta(prev);
         if ((char*)block_end(ph) == (char*)h) {
             /* extend prev to include fm */
-            ph->size += sizeof(Header) + sizeof(FreeMeta) + h->size;
+            plog_block(ph);
+            ph->size += sizeof(Header) + h->size;
             remove_from_list(fm);
+            merge_zeroed(ph, h);
             fm = prev;
             h = ph;
         }
     }
 
     /* Merge with next if physically adjacent */
-    if (fm->addr_next) {
-        FreeMeta *next = fm->addr_next;
+    if (fm->addr_next != POOL_NIL) {
+        FreeMeta *next = meta_next(fm);
         Header *nh = header_from_meta(next);
         if ((char*)block_end(h) == (char*)nh) {
             /* extend h to include next */
-            h->size += sizeof(Header) + sizeof(FreeMeta) + nh->size;
+            plog_block(h);
+            h->size += sizeof(Header) + nh->size;
             remove_from_list(next);
+            merge_zeroed(h, nh);
         }
     }
 
-    /* ensure fm meta field is valid */
-    FreeMeta *res = meta_from_header(h);
-    if (!res->addr_prev) res->addr_prev = fm->addr_prev; 
-    return res;
+    /* the whole pool is free again: hand it back to the buddy allocator too */
+    fm = meta_from_header(h);
+    if (h->size == POOL_SIZE - sizeof(Header) && pool_root->buddy_heads[BUDDY_MAX_ORDER] == POOL_NIL) {
+        plog_block(h);
+        plog_root();
+        fm->order = BUDDY_MAX_ORDER;
+        fm->buddy_next = POOL_NIL;
+        pool_root->buddy_heads[BUDDY_MAX_ORDER] = meta_off(fm);
+    }
+    return fm;
 }
 
 static void split_block(Header *h, size_t req) {
@@ -169,25 +471,37 @@ static void split_block(Header *h, size_t req) {
     size_t min_rem = sizeof(Header) + sizeof(FreeMeta) + MIN_BLOCK_SIZE;
     if (h->size < req + min_rem) return; /* too small to split */
 
-    size_t remain = h->size - req - sizeof(Header) - sizeof(FreeMeta);
+    size_t remain = h->size - req - sizeof(Header);
+    plog_block(h);
     h->size = req;
 
     Header *newh = (Header*)block_end(h);
+    plog_block(newh);
     newh->size = remain;
     newh->is_free = 1;
     newh->magic = MAGIC_FREE;
+    newh->handle = 0;
+    newh->flags = h->flags & BLOCK_ZEROED;   /* the tail of a zeroed block is still zero */
     FreeMeta *fm = meta_from_header(newh);
-    fm->addr_prev = fm->addr_next = NULL;
-    fm->buddy_next = NULL;
+    fm->addr_prev = fm->addr_next = POOL_NIL;
+    fm->buddy_next = POOL_NIL;
     fm->order = -1; /* not buddy-managed unless created by buddy allocator */
     fm->reserved1 = fm->reserved2 = NULL;
 
     insert_by_address(fm);
 }
 
-void* malloc_first_fit(size_t size) {
+/* a block must be able to hold its FreeMeta once it is freed again; rounding
+   to POOL_ALIGN keeps every block footprint, and so every payload, aligned */
+static inline size_t fit_request_size(size_t size) {
+    if (size < sizeof(FreeMeta)) size = sizeof(FreeMeta);
+    return (size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+}
+
+static void* first_fit_impl(size_t size) {
     if (!pool_initialized) init_pool();
-    FreeMeta *cur = free_head;
+    size = fit_request_size(size);
+    FreeMeta *cur = free_list_head();
     while (cur) {
         Header *h = header_from_meta(cur);
         if (h->is_free && h->size >= size) {
@@ -196,20 +510,26 @@ void* malloc_first_fit(size_t size) {
             split_block(h, size);
             h->is_free = 0;
             h->magic = MAGIC_ALLOC;
-            /* mark meta as non-buddy */
-            FreeMeta *fm = meta_from_header(h);
-            fm->order = -1;
             return user_from_header(h);
         }
-        cur = cur->addr_next;
+        cur = meta_next(cur);
     }
     return NULL;
 }
 
-void* malloc_next_fit(size_t size) {
+void* malloc_first_fit(size_t size) {
+    pool_txn_begin();
+    void *p = first_fit_impl(size);
+    pool_txn_end();
+    return p;
+}
+
+static void* next_fit_impl(size_t size) {
     if (!pool_initialized) init_pool();
-    if (!next_fit_cursor) next_fit_cursor = free_head;
-    FreeMeta *start = next_fit_cursor ? next_fit_cursor : free_head;
+    size = fit_request_size(size);
+    plog_root();
+    if (pool_root->next_fit_cursor == POOL_NIL) pool_root->next_fit_cursor = pool_root->free_head;
+    FreeMeta *start = meta_at(pool_root->next_fit_cursor);
     if (!start) return NULL;
     FreeMeta *cur = start;
     do {
@@ -219,26 +539,32 @@ void* malloc_next_fit(size_t size) {
             split_block(h, size);
             h->is_free = 0;
             h->magic = MAGIC_ALLOC;
-            FreeMeta *fm = meta_from_header(h);
-            fm->order = -1;
-            next_fit_cursor = cur->addr_next ? cur->addr_next : free_head;
+            pool_root->next_fit_cursor = cur->addr_next != POOL_NIL ? cur->addr_next : pool_root->free_head;
             return user_from_header(h);
         }
-        cur = cur->addr_next ? cur->addr_next : free_head;
+        cur = meta_next(cur) ? meta_next(cur) : free_list_head();
     } while (cur != start);
     return NULL;
 }
 
-void* malloc_best_fit(size_t size) {
+void* malloc_next_fit(size_t size) {
+    pool_txn_begin();
+    void *p = next_fit_impl(size);
+    pool_txn_end();
+    return p;
+}
+
+static void* best_fit_impl(size_t size) {
     if (!pool_initialized) init_pool();
-    FreeMeta *cur = free_head;
+    size = fit_request_size(size);
+    FreeMeta *cur = free_list_head();
     FreeMeta *best = NULL;
     while (cur) {
         Header *h = header_from_meta(cur);
         if (h->is_free && h->size >= size) {
             if (!best || h->size < header_from_meta(best)->size) best = cur;
         }
-        cur = cur->addr_next;
+        cur = meta_next(cur);
     }
     if (!best) return NULL;
     Header *bh = header_from_meta(best);
@@ -246,21 +572,27 @@ void* malloc_best_fit(size_t size) {
     split_block(bh, size);
     bh->is_free = 0;
     bh->magic = MAGIC_ALLOC;
-    FreeMeta *fm = meta_from_header(bh);
-    fm->order = -1;
     return user_from_header(bh);
 }
 
-void* malloc_worst_fit(size_t size) {
+void* malloc_best_fit(size_t size) {
+    pool_txn_begin();
+    void *p = best_fit_impl(size);
+    pool_txn_end();
+    return p;
+}
+
+static void* worst_fit_impl(size_t size) {
     if (!pool_initialized) init_pool();
-    FreeMeta *cur = free_head;
+    size = fit_request_size(size);
+    FreeMeta *cur = free_list_head();
     FreeMeta *worst = NULL;
     while (cur) {
         Header *h = header_from_meta(cur);
         if (h->is_free && h->size >= size) {
             if (!worst || h->size > header_from_meta(worst)->size) worst = cur;
         }
-        cur = cur->addr_next;
+        cur = meta_next(cur);
     }
     if (!worst) return NULL;
     Header *wh = header_from_meta(worst);
@@ -268,23 +600,23 @@ void* malloc_worst_fit(size_t size) {
     split_block(wh, size);
     wh->is_free = 0;
     wh->magic = MAGIC_ALLOC;
-    FreeMeta *fm = meta_from_header(wh);
-    fm->order = -1;
     return user_from_header(wh);
 }
 
-//  ---------- Buddy allocator helpers ---------- 
-//  offset in bytes from pool_base 
-static inline size_t header_offset(Header *h) {
-    return (size_t)((char*)h - (char*)pool_base);
-}
-static inline Header* header_from_offset(size_t off) {
-    return (Header*)((char*)pool_base + off);
+void* malloc_worst_fit(size_t size) {
+    pool_txn_begin();
+    void *p = worst_fit_impl(size);
+    pool_txn_end();
+    return p;
 }
 
+//  ---------- Buddy allocator helpers ---------- 
+
 /* find minimal order that fits payload + header + meta */
+/* A block of order k spans exactly 2^k bytes, header included, so buddy
+   blocks tile the pool like fit blocks do; free, it must hold its FreeMeta. */
 static inline int order_for_size_buddy(size_t payload) {
-    size_t need = payload + sizeof(Header) + sizeof(FreeMeta);
+    size_t need = sizeof(Header) + (payload > sizeof(FreeMeta) ? payload : sizeof(FreeMeta));
     int order = 0;
     size_t sz = 1u;
     while (sz < need && order < BUDDY_MAX_ORDER) { sz <<= 1; order++; }
@@ -292,50 +624,64 @@ static inline int order_for_size_buddy(size_t payload) {
     return order;
 }
 
+static inline int buddy_order_of(const Header *h) {
+    int order = 0;
+    while (((size_t)1 << order) < sizeof(Header) + h->size) order++;
+    return order;
+}
+
 /* buddy list helpers */
 static void buddy_push(size_t off, int order) {
     FreeMeta *m = meta_from_header(header_from_offset(off));
-    m->buddy_next = buddy_free_lists[order];
-    buddy_free_lists[order] = m;
+    plog_block(header_from_offset(off));
+    plog_root();
+    m->buddy_next = pool_root->buddy_heads[order];
+    pool_root->buddy_heads[order] = off;
 }
 static size_t buddy_pop(int order) {
-    FreeMeta *m = buddy_free_lists[order];
-    if (!m) return (size_t)-1;
-    buddy_free_lists[order] = m->buddy_next;
-    m->buddy_next = NULL;
-    Header *h = header_from_meta(m);
-    return header_offset(h);
+    size_t off = pool_root->buddy_heads[order];
+    if (off == POOL_NIL) return (size_t)-1;
+    FreeMeta *m = meta_at(off);
+    plog_block(header_from_offset(off));
+    plog_root();
+    pool_root->buddy_heads[order] = m->buddy_next;
+    m->buddy_next = POOL_NIL;
+    return off;
 }
 static int buddy_remove_offset(int order, size_t off) {
-    FreeMeta *cur = buddy_free_lists[order];
+    size_t cur = pool_root->buddy_heads[order];
     FreeMeta *prev = NULL;
-    while (cur) {
-        Header *ch = header_from_meta(cur);
-        if (header_offset(ch) == off) {
-            if (prev) prev->buddy_next = cur->buddy_next;
-            else buddy_free_lists[order] = cur->buddy_next;
-            cur->buddy_next = NULL;
+    while (cur != POOL_NIL) {
+        FreeMeta *m = meta_at(cur);
+        if (cur == off) {
+            if (prev) plog_block(header_from_meta(prev));
+            plog_block(header_from_offset(cur));
+            plog_root();
+            if (prev) prev->buddy_next = m->buddy_next;
+            else pool_root->buddy_heads[order] = m->buddy_next;
+            m->buddy_next = POOL_NIL;
             return 1;
         }
-        prev = cur;
-        cur = cur->buddy_next;
+        prev = m;
+        cur = m->buddy_next;
     }
     return 0;
 }
 
 /* ---------- Buddy allocation ---------- */
-void* malloc_buddy_alloc(size_t size) {
+static void* buddy_alloc_impl(size_t size) {
     if (!pool_initialized) init_pool();
     int order = order_for_size_buddy(size);
     if (order < 0 || order > BUDDY_MAX_ORDER) return NULL;
 
     /* finding available block at order j >= order */
     int j = order;
-    while (j <= BUDDY_MAX_ORDER && buddy_free_lists[j] == NULL) j++;
+    while (j <= BUDDY_MAX_ORDER && pool_root->buddy_heads[j] == POOL_NIL) j++;
     if (j > BUDDY_MAX_ORDER) return NULL;
 
     size_t off = buddy_pop(j);
     if (off == (size_t)-1) return NULL;
+    if (j == BUDDY_MAX_ORDER) remove_from_list(meta_at(off));   /* the whole pool: also on the address list */
 
     while (j > order) {
         j--;
@@ -344,36 +690,47 @@ void* malloc_buddy_alloc(size_t size) {
         /* initializing left and right headers */
         Header *left_h = header_from_offset(off);
         Header *right_h = header_from_offset(right_off);
+        plog_block(left_h);
+        plog_block(right_h);
 
-        left_h->size = half - sizeof(Header) - sizeof(FreeMeta);
+        left_h->size = half - sizeof(Header);
         left_h->is_free = 1;
         left_h->magic = MAGIC_FREE;
+        left_h->handle = 0;
+        left_h->flags = 0;
         FreeMeta *mleft = meta_from_header(left_h);
-        mleft->addr_prev = mleft->addr_next = NULL;
-        mleft->buddy_next = NULL;
+        mleft->addr_prev = mleft->addr_next = POOL_NIL;
+        mleft->buddy_next = POOL_NIL;
         mleft->order = j;
 
-        right_h->size = half - sizeof(Header) - sizeof(FreeMeta);
+        right_h->size = half - sizeof(Header);
         right_h->is_free = 1;
         right_h->magic = MAGIC_FREE;
+        right_h->handle = 0;
+        right_h->flags = 0;
         FreeMeta *mright = meta_from_header(right_h);
-        mright->addr_prev = mright->addr_next = NULL;
-        mright->buddy_next = NULL;
+        mright->addr_prev = mright->addr_next = POOL_NIL;
+        mright->buddy_next = POOL_NIL;
         mright->order = j;
         buddy_push(right_off, j);
     }
 
     /* allocating final block at off */
     Header *h = header_from_offset(off);
+    plog_block(h);
     h->is_free = 0;
     h->magic = MAGIC_ALLOC;
-    FreeMeta *fm = meta_from_header(h);
-    fm->order = order;
-    fm->addr_prev = fm->addr_next = NULL; /* not in address-sorted free list while allocated */
-    fm->buddy_next = NULL;
+    h->flags = BLOCK_BUDDY;
     return user_from_header(h);
 }
 
+void* malloc_buddy_alloc(size_t size) {
+    pool_txn_begin();
+    void *p = buddy_alloc_impl(size);
+    pool_txn_end();
+    return p;
+}
+
 /* ---------- Buddy free/merge ---------- */
 static void buddy_free(Header *h) {
     size_t off = header_offset(h);
@@ -386,36 +743,324 @@ static void buddy_free(Header *h) {
     /* trying to merge upwards */
     while (order < BUDDY_MAX_ORDER) {
         size_t buddy_off = off ^ ((size_t)1 << order);
-        /* if buddy is free (present in buddy_free_lists[order]) removing it and merging */
+        /* if buddy is free (present in buddy_heads[order]) removing it and merging */
         if (!buddy_remove_offset(order, buddy_off)) break;
         /* merged block offset is min(off, buddy_off) */
         off = (off < buddy_off) ? off : buddy_off;
         order++;
         /* initializing merged header for next iteration */
         Header *merged = header_from_offset(off);
-        merged->size = ((size_t)1 << order) - sizeof(Header) - sizeof(FreeMeta);
+        plog_block(merged);
+        merged->size = ((size_t)1 << order) - sizeof(Header);
         merged->is_free = 1;
         merged->magic = MAGIC_FREE;
+        merged->handle = 0;
+        merged->flags = 0;
         FreeMeta *m = meta_from_header(merged);
-        m->addr_prev = m->addr_next = NULL;
-        m->buddy_next = NULL;
+        m->addr_prev = m->addr_next = POOL_NIL;
+        m->buddy_next = POOL_NIL;
         m->order = order;
     }
 
     /* pushing the final merged (or original) block into buddy list */
     Header *final_h = header_from_offset(off);
+    plog_block(final_h);
     final_h->is_free = 1;
     final_h->magic = MAGIC_FREE;
+    final_h->flags = 0;
     FreeMeta *fm = meta_from_header(final_h);
     fm->order = order;
-    fm->addr_prev = fm->addr_next = NULL;
-    fm->buddy_next = NULL;
+    fm->addr_prev = fm->addr_next = POOL_NIL;
+    fm->buddy_next = POOL_NIL;
     buddy_push(off, order);
+    if (order == BUDDY_MAX_ORDER) insert_by_address(fm);   /* the whole pool is free again */
 }
 
-/* ---------- Public free (detecting buddy vs general) ---------- */
-void my_free(void *ptr) {
+/* ---------- Small-object slab arena (meshable) ---------- */
+/* Pages of equal-sized slots, backed by a memfd so that two virtual pages can
+   share one physical (file) page. Virtual page v initially maps file page v.
+   Meshing copies the objects of a sparse page into another page with a
+   disjoint slot bitmap and remaps the first page's virtual address onto the
+   second's file page: no object changes its virtual address. The arena is
+   process-local but, like the pool, only changed under the pool lock;
+   objects themselves are written without it. */
+#define SLAB_BITMAP_WORDS (SLAB_PAGE_SIZE / SLAB_MIN_OBJ / 64)
+#define SLAB_NIL          0xFFFFFFFFu
+
+typedef struct slab_phys {
+    uint32_t obj_size;     /* 0 when this file page is not in use */
+    uint32_t used;         /* live objects */
+    uint32_t first_vpage;  /* chain of virtual pages mapping this file page */
+    uint64_t bitmap[SLAB_BITMAP_WORDS];
+} SlabPhys;
+
+typedef struct slab_vpage {
+    uint32_t phys;         /* file page mapped here, SLAB_NIL if the page is free */
+    uint32_t next_alias;   /* next virtual page mapping the same file page */
+} SlabVPage;
+
+static char *slab_base = NULL;
+static int slab_fd = -1;
+static SlabPhys slab_phys[SLAB_ARENA_PAGES];
+static SlabVPage slab_vpages[SLAB_ARENA_PAGES];
+static uint8_t slab_busy[SLAB_ARENA_PAGES];   /* being meshed: a writer faulting on it waits */
+static uint32_t slab_rand_state = 0x9E3779B9u;
+
+static int fault_hook_get(void);
+static void fault_hook_put(void);
+
+static int init_slab_arena(void) {
+    if (slab_base) return 0;
+    int fd = (int)syscall(SYS_memfd_create, "mmu-slab", 0);
+    if (fd < 0) {
+        perror("memfd_create");
+        return -1;
+    }
+    size_t len = (size_t)SLAB_ARENA_PAGES * SLAB_PAGE_SIZE;
+    if (ftruncate(fd, (off_t)len) != 0) {
+        perror("ftruncate");
+        close(fd);
+        return -1;
+    }
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return -1;
+    }
+    slab_base = (char*)p;
+    slab_fd = fd;
+    if ((pool_options & POOL_OPT_MLOCK) && lock_region(slab_base, len) == 0) slab_map_locked = len;
+    for (uint32_t i = 0; i < SLAB_ARENA_PAGES; ++i) {
+        memset(&slab_phys[i], 0, sizeof(SlabPhys));
+        slab_phys[i].first_vpage = SLAB_NIL;
+        slab_vpages[i].phys = SLAB_NIL;
+        slab_vpages[i].next_alias = SLAB_NIL;
+    }
+    return 0;
+}
+
+static inline int slab_owns(void *ptr) {
+    return slab_base && (char*)ptr >= slab_base &&
+           (char*)ptr < slab_base + (size_t)SLAB_ARENA_PAGES * SLAB_PAGE_SIZE;
+}
+static inline char* slab_vpage_addr(uint32_t v) {
+    return slab_base + (size_t)v * SLAB_PAGE_SIZE;
+}
+
+/* randomised slot choice (as in Mesh) keeps bitmaps of different pages from
+   all filling the same low slots, which would make them unmeshable */
+static int slab_take_slot(SlabPhys *ph) {
+    uint32_t nslots = SLAB_PAGE_SIZE / ph->obj_size;
+    slab_rand_state ^= slab_rand_state << 13;
+    slab_rand_state ^= slab_rand_state >> 17;
+    slab_rand_state ^= slab_rand_state << 5;
+    uint32_t start = slab_rand_state % nslots;
+    for (uint32_t n = 0; n < nslots; ++n) {
+        uint32_t s = (start + n) % nslots;
+        uint64_t bit = (uint64_t)1 << (s % 64);
+        if (!(ph->bitmap[s / 64] & bit)) {
+            ph->bitmap[s / 64] |= bit;
+            ph->used++;
+            return (int)s;
+        }
+    }
+    return -1;
+}
+
+static void* slab_alloc_impl(size_t size) {
+    if (size == 0 || size > SLAB_MAX_OBJ) return NULL;
+    if (init_slab_arena() != 0) return NULL;
+    uint32_t obj = SLAB_MIN_OBJ;
+    while (obj < size) obj <<= 1;
+
+    /* a partially filled page of this class, else a free virtual page */
+    uint32_t p = SLAB_NIL;
+    for (uint32_t i = 0; i < SLAB_ARENA_PAGES; ++i) {
+        if (slab_phys[i].obj_size == obj && slab_phys[i].used < SLAB_PAGE_SIZE / obj) { p = i; break; }
+    }
+    if (p == SLAB_NIL) {
+        for (uint32_t i = 0; i < SLAB_ARENA_PAGES; ++i) {
+            if (slab_vpages[i].phys != SLAB_NIL) continue;
+            /* a free virtual page always maps its own (unused) file page */
+            p = i;
+            SlabPhys *ph = &slab_phys[p];
+            memset(ph->bitmap, 0, sizeof(ph->bitmap));
+            ph->obj_size = obj;
+            ph->used = 0;
+            ph->first_vpage = p;
+            slab_vpages[p].phys = p;
+            slab_vpages[p].next_alias = SLAB_NIL;
+            break;
+        }
+    }
+    if (p == SLAB_NIL) return NULL;
+
+    SlabPhys *ph = &slab_phys[p];
+    int slot = slab_take_slot(ph);
+    if (slot < 0) return NULL;
+    return slab_vpage_addr(ph->first_vpage) + (size_t)slot * obj;
+}
+
+void* malloc_slab(size_t size) {
+    pool_txn_begin();
+    void *p = slab_alloc_impl(size);
+    pool_txn_end();
+    return p;
+}
+
+/* last object gone: punch the file page and give every aliasing virtual
+   page its own (already punched) file page back */
+static void slab_release_phys(uint32_t p) {
+    madvise(slab_vpage_addr(p), SLAB_PAGE_SIZE, MADV_REMOVE);
+    uint32_t v = slab_phys[p].first_vpage;
+    while (v != SLAB_NIL) {
+        uint32_t next = slab_vpages[v].next_alias;
+        if (v != p) {
+            mmap(slab_vpage_addr(v), SLAB_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, slab_fd, (off_t)v * SLAB_PAGE_SIZE);
+        }
+        slab_vpages[v].phys = SLAB_NIL;
+        slab_vpages[v].next_alias = SLAB_NIL;
+        v = next;
+    }
+    slab_phys[p].obj_size = 0;
+    slab_phys[p].used = 0;
+    slab_phys[p].first_vpage = SLAB_NIL;
+}
+
+static void free_slab(void *ptr) {
+    size_t off = (size_t)((char*)ptr - slab_base);
+    uint32_t p = slab_vpages[off / SLAB_PAGE_SIZE].phys;
+    SlabPhys *ph = (p == SLAB_NIL) ? NULL : &slab_phys[p];
+    size_t in_page = off % SLAB_PAGE_SIZE;
+    if (!ph || in_page % ph->obj_size) {
+        fprintf(stderr, "Invalid or double free\n");
+        return;
+    }
+    size_t s = in_page / ph->obj_size;
+    uint64_t bit = (uint64_t)1 << (s % 64);
+    if (!(ph->bitmap[s / 64] & bit)) {
+        fprintf(stderr, "Invalid or double free\n");
+        return;
+    }
+    ph->bitmap[s / 64] &= ~bit;
+    if (--ph->used == 0) slab_release_phys(p);
+}
+
+/* (re)map virtual page v onto file page f */
+static int slab_map_vpage(uint32_t v, uint32_t f, int prot) {
+    void *p = mmap(slab_vpage_addr(v), SLAB_PAGE_SIZE, prot, MAP_SHARED | MAP_FIXED, slab_fd, (off_t)f * SLAB_PAGE_SIZE);
+    return p == MAP_FAILED ? -1 : 0;
+}
+
+/* give src's virtual pages their write access back and let waiting writers in */
+static void slab_unprotect(uint32_t first) {
+    for (uint32_t v = first; v != SLAB_NIL; v = slab_vpages[v].next_alias) {
+        mprotect(slab_vpage_addr(v), SLAB_PAGE_SIZE, PROT_READ | PROT_WRITE);
+        __atomic_store_n(&slab_busy[v], 0, __ATOMIC_RELEASE);
+    }
+}
+
+/* Copy src's objects into dst and point all of src's virtual pages at dst's
+   file page. Objects are written through raw pointers without the pool
+   lock, so src's pages are read-only (and busy, which makes a writer wait in
+   the fault handler) from before the copy until every one of them maps dst:
+   the write then lands in dst's copy instead of being lost. On failure src
+   keeps its own file page and nothing changes. */
+static int slab_mesh_pair(uint32_t dst, uint32_t src) {
+    SlabPhys *d = &slab_phys[dst];
+    SlabPhys *sp = &slab_phys[src];
+    char *dst_page = slab_vpage_addr(d->first_vpage);
+    char *src_page = slab_vpage_addr(sp->first_vpage);
+    uint32_t nslots = SLAB_PAGE_SIZE / sp->obj_size;
+    for (uint32_t v = sp->first_vpage; v != SLAB_NIL; v = slab_vpages[v].next_alias) {
+        __atomic_store_n(&slab_busy[v], 1, __ATOMIC_RELEASE);
+        mprotect(slab_vpage_addr(v), SLAB_PAGE_SIZE, PROT_READ);
+    }
+    for (uint32_t s = 0; s < nslots; ++s) {
+        if (sp->bitmap[s / 64] & ((uint64_t)1 << (s % 64)))
+            memcpy(dst_page + (size_t)s * sp->obj_size, src_page + (size_t)s * sp->obj_size, sp->obj_size);
+    }
+
+    /* remapped pages stay read-only until all of them are moved, so a
+       failure can still put the earlier ones back onto src's intact page */
+    uint32_t v = sp->first_vpage, last = v;
+    for (; v != SLAB_NIL; v = slab_vpages[v].next_alias) {
+        if (slab_map_vpage(v, dst, PROT_READ) != 0) break;
+        last = v;
+    }
+    if (v != SLAB_NIL) {
+        perror("mmap");
+        for (uint32_t u = sp->first_vpage; u != v; u = slab_vpages[u].next_alias)
+            if (slab_map_vpage(u, src, PROT_READ) != 0) perror("mmap");
+        slab_unprotect(sp->first_vpage);
+        return -1;
+    }
+    for (v = sp->first_vpage; v != SLAB_NIL; v = slab_vpages[v].next_alias) slab_vpages[v].phys = dst;
+    slab_unprotect(sp->first_vpage);
+    slab_vpages[last].next_alias = d->first_vpage;
+    d->first_vpage = sp->first_vpage;
+
+    /* no virtual page maps src's file page any more: punch it
+       (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE) */
+    if (syscall(SYS_fallocate, slab_fd, 0x02 | 0x01, (off_t)src * SLAB_PAGE_SIZE, (off_t)SLAB_PAGE_SIZE) != 0)
+        perror("fallocate");
+
+    for (int w = 0; w < SLAB_BITMAP_WORDS; ++w) d->bitmap[w] |= sp->bitmap[w];
+    d->used += sp->used;
+    memset(sp, 0, sizeof(SlabPhys));
+    sp->first_vpage = SLAB_NIL;
+    return 0;
+}
+
+/* Mesh every pair of at-most-half-full pages of the same size class whose
+   slot bitmaps do not overlap. Returns the number of physical pages released. */
+static size_t mesh_slab_pages_impl(void) {
+    if (!slab_base || (pool_options & POOL_OPT_MLOCK)) return 0;  /* locked pages are never released */
+    if (fault_hook_get() != 0) return 0;                          /* writers to a page being meshed wait */
+    size_t released = 0;
+    for (uint32_t i = 0; i < SLAB_ARENA_PAGES; ++i) {
+        SlabPhys *a = &slab_phys[i];
+        if (!a->obj_size) continue;
+        for (uint32_t j = i + 1; j < SLAB_ARENA_PAGES; ++j) {
+            SlabPhys *b = &slab_phys[j];
+            uint32_t half = SLAB_PAGE_SIZE / a->obj_size / 2;
+            if (a->used > half) break;
+            if (b->obj_size != a->obj_size || b->used > half) continue;
+            int overlap = 0;
+            for (int w = 0; w < SLAB_BITMAP_WORDS; ++w) overlap |= (a->bitmap[w] & b->bitmap[w]) != 0;
+            if (overlap || slab_mesh_pair(i, j) != 0) continue;
+            released++;
+        }
+    }
+    fault_hook_put();
+    return released;
+}
+
+size_t mesh_slab_pages(void) {
+    pool_txn_begin();
+    size_t released = mesh_slab_pages_impl();
+    pool_txn_end();
+    return released;
+}
+
+/* physical pages currently backing slab objects */
+size_t slab_resident_pages(void) {
+    size_t n = 0;
+    pool_txn_begin();
+    for (uint32_t i = 0; i < SLAB_ARENA_PAGES; ++i) n += slab_phys[i].obj_size != 0;
+    pool_txn_end();
+    return n;
+}
+
+/* ---------- Public free (detecting slab, buddy or general) ---------- */
+static void free_impl(void *ptr) {
     if (!ptr) return;
+    if (slab_owns(ptr)) {
+        free_slab(ptr);
+        return;
+    }
     Header *h = header_from_user(ptr);
     if (!h) return;
     if (h->magic != MAGIC_ALLOC || h->is_free) {
@@ -424,26 +1069,3516 @@ void my_free(void *ptr) {
     }
 
     /* mark free */
+    plog_block(h);
+    int buddy = h->flags & BLOCK_BUDDY;
     h->is_free = 1;
     h->magic = MAGIC_FREE;
+    h->flags = 0;
 
     FreeMeta *fm = meta_from_header(h);
 
-    /* if this block was allocated by buddy allocator (order >=0), doing buddy free */
-    if (fm->order >= 0 && fm->order <= BUDDY_MAX_ORDER) {
+    /* blocks of the buddy allocator go back to it; the payload held user data */
+    if (buddy) {
+        fm->order = buddy_order_of(h);
         buddy_free(h);
         return;
     }
 
     /* otherwise non-buddy, inserting into address list and coalesce */
-    fm->addr_prev = fm->addr_next = NULL;
-    fm->buddy_next = NULL;
+    fm->addr_prev = fm->addr_next = POOL_NIL;
+    fm->buddy_next = POOL_NIL;
     fm->order = -1;
+    fm->reserved1 = fm->reserved2 = NULL;
     insert_by_address(fm);
     fm = coalesce(fm);
     (void)fm;
 }
 
+void my_free(void *ptr) {
+    pool_txn_begin();
+    free_impl(ptr);
+    pool_txn_end();
+}
+
+/* ---------- Heap options ---------- */
+static pthread_mutex_t vbuf_lock = PTHREAD_MUTEX_INITIALIZER;
+static int vbufs_lock_all(void);
+static void vbufs_unlock_all(void);
+static int page_tracker_protecting(void);
+
+static void regions_unlock(void) {
+    if (pool_map_locked) unlock_region(pool_root, pool_map_locked);
+    if (slab_map_locked) unlock_region(slab_base, slab_map_locked);
+    pool_map_locked = slab_map_locked = 0;
+    vbufs_unlock_all();
+}
+
+/* lock every existing region, or none of them */
+static int regions_lock(void) {
+    int rc = 0;
+    if (pool_initialized && !pool_map_locked) {
+        if (lock_region(pool_root, POOL_MAP_SIZE) == 0) pool_map_locked = POOL_MAP_SIZE;
+        else rc = -1;
+    }
+    if (rc == 0 && slab_base && !slab_map_locked) {
+        size_t len = (size_t)SLAB_ARENA_PAGES * SLAB_PAGE_SIZE;
+        if (lock_region(slab_base, len) == 0) slab_map_locked = len;
+        else rc = -1;
+    }
+    if (rc == 0 && vbufs_lock_all() != 0) rc = -1;
+    if (rc != 0) regions_unlock();
+    return rc;
+}
+
+/* Options apply to regions mapped afterwards; toggling POOL_OPT_MLOCK also
+   (un)locks the regions that already exist, growable reservations included.
+   Setting it is refused while the mprotect page tracker (and so the cold
+   store) runs: mlock() cannot fault in its PROT_NONE pages. Returns 0, or -1
+   with the options unchanged if locking failed (e.g. RLIMIT_MEMLOCK). */
+int pool_set_options(unsigned options) {
+    int rc = 0, in_txn = pool_initialized;
+    pthread_mutex_lock(&vbuf_lock);
+    if (in_txn) pool_txn_begin();
+    if ((options & POOL_OPT_MLOCK) && !(pool_options & POOL_OPT_MLOCK)) {
+        rc = page_tracker_protecting() ? -1 : regions_lock();
+    } else if (!(options & POOL_OPT_MLOCK) && (pool_options & POOL_OPT_MLOCK)) {
+        regions_unlock();
+    }
+    if (rc == 0) pool_options = options;
+    if (in_txn) pool_txn_end();
+    pthread_mutex_unlock(&vbuf_lock);
+    return rc;
+}
+
+/* bytes currently mlock()ed on behalf of the heap */
+size_t pool_locked_bytes(void) {
+    return __atomic_load_n(&pool_locked, __ATOMIC_RELAXED);
+}
+
+/* ---------- 32-bit pool references ---------- */
+/* A pool_ref_t is a payload's offset from pool_base divided by POOL_ALIGN,
+   so 32 bits address a 64 GB pool and pointer-heavy structures can halve
+   their link size. 0 is null (offset 0 is always a header, never a payload).
+   Like offsets, refs stay valid wherever the pool is mapped. */
+typedef uint32_t pool_ref_t;
+
+static inline void* pool_ref_ptr(pool_ref_t r) {
+    return r ? (char*)pool_base + (size_t)r * POOL_ALIGN : NULL;
+}
+static inline pool_ref_t pool_ref_of(const void *p) {
+    return p ? (pool_ref_t)((size_t)((const char*)p - (const char*)pool_base) / POOL_ALIGN) : 0;
+}
+
+/* first-fit allocation returning a ref; 0 when the pool is full */
+pool_ref_t pool_ref_alloc(size_t size) {
+    return pool_ref_of(malloc_first_fit(size));
+}
+
+void pool_ref_free(pool_ref_t r) {
+    my_free(pool_ref_ptr(r));
+}
+
+/* ---------- Handle-based relocatable allocations ---------- */
+/* A handle is an index (+1) into handle_table. The table owns the only
+   pointer to the block, so compaction is free to move any block whose
+   handle is not locked. 0 is never a valid handle. */
+typedef uint32_t mem_handle_t;
+
+enum { TIER_NONE = 0, TIER_FAST = 1, TIER_SLOW = 2 };
+
+typedef struct handle_entry {
+    Header *block;       /* current block in the pool (fast tier), NULL otherwise */
+    size_t slow_off;     /* record offset in the slow tier while demoted */
+    uint32_t pins;       /* lock count; pinned blocks are never moved */
+    uint32_t next_free;  /* free slot chain (index + 1), 0 terminates */
+    uint32_t accesses;   /* handle_lock() calls, decayed by tier_rebalance() */
+    uint8_t tier;        /* TIER_NONE while the slot is unused */
+} HandleEntry;
+
+static HandleEntry handle_table[MAX_HANDLES];
+static uint32_t handle_free_slots = 0;  /* head of free slot chain (index + 1) */
+static uint32_t handle_high_water = 0;  /* slots [0, high_water) have been handed out before */
+
+static HandleEntry* handle_entry(mem_handle_t hd) {
+    if (hd == 0 || hd > handle_high_water) return NULL;
+    HandleEntry *e = &handle_table[hd - 1];
+    return e->tier != TIER_NONE ? e : NULL;
+}
+
+static mem_handle_t handle_slot_get(void) {
+    if (handle_free_slots) {
+        mem_handle_t hd = handle_free_slots;
+        handle_free_slots = handle_table[hd - 1].next_free;
+        return hd;
+    }
+    if (handle_high_water >= MAX_HANDLES) return 0;
+    return ++handle_high_water;
+}
+
+static void handle_slot_put(mem_handle_t hd) {
+    HandleEntry *e = &handle_table[hd - 1];
+    e->block = NULL;
+    e->tier = TIER_NONE;
+    e->pins = 0;
+    e->next_free = handle_free_slots;
+    handle_free_slots = hd;
+}
+
+size_t compact_pool(void);
+static int tier_promote(HandleEntry *e);
+static void tier_slow_release(HandleEntry *e);
+static void* tier_slow_payload(HandleEntry *e);
+static size_t tier_slow_size(HandleEntry *e);
+static int tier_make_room(size_t size);
+
+/* allocate a relocatable block; compacts the pool once if no free block fits,
+   then demotes cold handles to the slow tier (if one is attached) */
+static mem_handle_t handle_alloc_impl(size_t size) {
+    if (!pool_initialized) init_pool();
+    mem_handle_t hd = handle_slot_get();
+    if (!hd) return 0;
+
+    void *p = malloc_first_fit(size);
+    if (!p) {
+        compact_pool();
+        p = malloc_first_fit(size);
+    }
+    if (!p && tier_make_room(size)) {
+        compact_pool();
+        p = malloc_first_fit(size);
+    }
+    if (!p) {
+        handle_slot_put(hd);
+        return 0;
+    }
+    Header *h = header_from_user(p);
+    plog_block(h);
+    h->handle = (uint16_t)hd;
+    HandleEntry *e = &handle_table[hd - 1];
+    e->block = h;
+    e->tier = TIER_FAST;
+    e->pins = 0;
+    e->next_free = 0;
+    e->accesses = 1;
+    return hd;
+}
+
+mem_handle_t handle_alloc(size_t size) {
+    pool_txn_begin();
+    mem_handle_t hd = handle_alloc_impl(size);
+    pool_txn_end();
+    return hd;
+}
+
+/* pin the block and return its current address; valid until the matching unlock.
+   A demoted block is promoted back to the pool first if it fits. */
+static void* handle_lock_impl(mem_handle_t hd) {
+    HandleEntry *e = handle_entry(hd);
+    if (!e) return NULL;
+    e->accesses++;
+    if (e->tier == TIER_SLOW && e->pins == 0) tier_promote(e);
+    e->pins++;
+    return e->tier == TIER_FAST ? user_from_header(e->block) : tier_slow_payload(e);
+}
+
+void* handle_lock(mem_handle_t hd) {
+    pool_txn_begin();
+    void *p = handle_lock_impl(hd);
+    pool_txn_end();
+    return p;
+}
+
+static void handle_unlock_impl(mem_handle_t hd) {
+    HandleEntry *e = handle_entry(hd);
+    if (!e || e->pins == 0) {
+        fprintf(stderr, "Unlock of invalid or unlocked handle\n");
+        return;
+    }
+    e->pins--;
+}
+
+void handle_unlock(mem_handle_t hd) {
+    pool_txn_begin();
+    handle_unlock_impl(hd);
+    pool_txn_end();
+}
+
+static size_t handle_size_impl(mem_handle_t hd) {
+    HandleEntry *e = handle_entry(hd);
+    if (!e) return 0;
+    return e->tier == TIER_FAST ? e->block->size : tier_slow_size(e);
+}
+
+size_t handle_size(mem_handle_t hd) {
+    pool_txn_begin();
+    size_t size = handle_size_impl(hd);
+    pool_txn_end();
+    return size;
+}
+
+static void handle_free_impl(mem_handle_t hd) {
+    HandleEntry *e = handle_entry(hd);
+    if (!e) {
+        fprintf(stderr, "Invalid or double handle free\n");
+        return;
+    }
+    if (e->pins) {
+        fprintf(stderr, "Freeing a locked handle\n");
+        return;
+    }
+    if (e->tier == TIER_SLOW) {
+        tier_slow_release(e);
+        handle_slot_put(hd);
+        return;
+    }
+    Header *h = e->block;
+    plog_block(h);
+    h->handle = 0;
+    my_free(user_from_header(h));
+    handle_slot_put(hd);
+}
+
+void handle_free(mem_handle_t hd) {
+    pool_txn_begin();
+    handle_free_impl(hd);
+    pool_txn_end();
+}
+
+/* ---------- Compaction ---------- */
+static inline int block_is_movable(Header *h) {
+    if ((char*)h >= (char*)pool_base + POOL_SIZE) return 0;
+    if (h->magic != MAGIC_ALLOC || h->is_free || h->handle == 0) return 0;
+    HandleEntry *e = &handle_table[h->handle - 1];
+    return e->block == h && e->pins == 0;
+}
+
+/* Move allocated block h down into the free block fm that physically precedes it.
+   The two blocks swap places, so the free block keeps its size and its position
+   in the address-sorted list; it is then merged with whatever free block follows. */
+static FreeMeta* slide_block(FreeMeta *fm, Header *h) {
+    Header *fh = header_from_meta(fm);
+    size_t free_size = fh->size;
+    size_t prev = fm->addr_prev;
+    size_t next = fm->addr_next;
+    int cursor_here = (pool_root->next_fit_cursor == meta_off(fm));
+    if (zero_off == meta_off(fm)) zero_off = POOL_NIL;
+    Header *nh = (Header*)((char*)fh + sizeof(Header) + h->size);
+
+    /* payload bytes are not logged: only handle blocks move, and handles do
+       not outlive the process, so an interrupted slide merely leaks one */
+    plog_block(fh);
+    plog_block(h);
+    plog_block(nh);
+    if (prev != POOL_NIL) plog_block(header_from_offset(prev));
+    if (next != POOL_NIL) plog_block(header_from_offset(next));
+    plog_root();
+    memmove(fh, h, sizeof(Header) + h->size);
+    handle_table[fh->handle - 1].block = fh;
+
+    nh->size = free_size;
+    nh->is_free = 1;
+    nh->magic = MAGIC_FREE;
+    nh->handle = 0;
+    nh->flags = 0;   /* now holds the moved block's old bytes */
+    FreeMeta *nfm = meta_from_header(nh);
+    nfm->buddy_next = POOL_NIL;
+    nfm->order = -1;
+    nfm->reserved1 = nfm->reserved2 = NULL;
+    nfm->addr_prev = prev;
+    nfm->addr_next = next;
+    size_t noff = meta_off(nfm);
+    if (prev != POOL_NIL) meta_at(prev)->addr_next = noff; else pool_root->free_head = noff;
+    if (next != POOL_NIL) meta_at(next)->addr_prev = noff;
+    if (cursor_here) pool_root->next_fit_cursor = noff;
+
+    return coalesce(nfm);
+}
+
+/* Slide every unpinned handle block toward the pool start. Raw-pointer and
+   pinned blocks stay put; free space between them is merged as far as they
+   allow, and into a single block when nothing is pinned. Returns blocks moved. */
+static size_t compact_pool_impl(void) {
+    if (!pool_initialized) init_pool();
+    size_t moved = 0;
+    FreeMeta *fm = free_list_head();
+    while (fm) {
+        Header *h = (Header*)block_end(header_from_meta(fm));
+        if (!block_is_movable(h)) {
+            fm = meta_next(fm);
+            continue;
+        }
+        fm = slide_block(fm, h);
+        plog_commit();   /* the heap is consistent between slides */
+        moved++;
+    }
+    return moved;
+}
+
+size_t compact_pool(void) {
+    pool_txn_begin();
+    size_t moved = compact_pool_impl();
+    pool_txn_end();
+    return moved;
+}
+
+/* ---------- Incremental compaction ---------- */
+/* pool offset where the next compact_step() resumes; only an offset is kept
+   between steps, so any allocation or free in between is harmless */
+static size_t compact_cursor = 0;
+
+static inline uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+/* Compact for at most budget_us microseconds (always at least one move).
+   Returns 1 while the current pass has more work, 0 once it reached the pool end. */
+static int compact_step_impl(uint32_t budget_us) {
+    if (!pool_initialized) init_pool();
+    uint64_t deadline = monotonic_us() + budget_us;
+
+    FreeMeta *fm = free_list_head();
+    while (fm && meta_off(fm) < compact_cursor) fm = meta_next(fm);
+
+    while (fm) {
+        Header *h = (Header*)block_end(header_from_meta(fm));
+        if (!block_is_movable(h)) {
+            fm = meta_next(fm);
+            continue;
+        }
+        fm = slide_block(fm, h);
+        plog_commit();
+        if (monotonic_us() >= deadline) {
+            compact_cursor = meta_off(fm);
+            return 1;
+        }
+    }
+    compact_cursor = 0;
+    return 0;
+}
+
+int compact_step(uint32_t budget_us) {
+    pool_txn_begin();
+    int more = compact_step_impl(budget_us);
+    pool_txn_end();
+    return more;
+}
+
+/* ---------- Two-tier pool (fast RAM / slow file) ---------- */
+/* A file-backed slow tier can be attached with tier_attach(). Handle blocks
+   migrate between the pool (fast, anonymous RAM) and the slow tier by access
+   frequency, counted in handle_lock(). The slow tier is a log: demoted blocks
+   are appended as records, dead records are reclaimed by sliding live ones
+   down (the handle table again owns the only reference). Once a record is
+   appended the RAM copy is freed, so a working set larger than the pool
+   degrades into page-cache/disk speed instead of failing. */
+#define SLOW_RECORD_MAGIC 0x510E7135u
+
+typedef struct slow_record {
+    size_t size;        /* payload size */
+    uint32_t handle;    /* owning handle, 0 once the record is dead */
+    uint32_t magic;
+} SlowRecord;
+
+static char *slow_base = NULL;
+static size_t slow_capacity = 0;
+static size_t slow_top = 0;      /* end of the record log */
+static size_t slow_dead = 0;     /* bytes held by dead records */
+
+static inline size_t slow_record_span(size_t payload) {
+    return sizeof(SlowRecord) + ((payload + 15) & ~(size_t)15);
+}
+static inline SlowRecord* slow_record_at(size_t off) {
+    return (SlowRecord*)(slow_base + off);
+}
+
+/* map (creating if needed) a file of the given size as the slow tier */
+int tier_attach(const char *path, size_t bytes) {
+    if (slow_base) return -1;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)bytes) != 0) {
+        perror("ftruncate");
+        close(fd);
+        return -1;
+    }
+    void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    slow_base = (char*)p;
+    slow_capacity = bytes;
+    slow_top = 0;
+    slow_dead = 0;
+    return 0;
+}
+
+static void* tier_slow_payload(HandleEntry *e) {
+    return slow_base + e->slow_off + sizeof(SlowRecord);
+}
+static size_t tier_slow_size(HandleEntry *e) {
+    return slow_record_at(e->slow_off)->size;
+}
+static void tier_slow_release(HandleEntry *e) {
+    SlowRecord *r = slow_record_at(e->slow_off);
+    r->handle = 0;
+    slow_dead += slow_record_span(r->size);
+}
+
+/* slide live, unpinned records toward the log start */
+static void tier_slow_compact(void) {
+    size_t dst = 0, off = 0;
+    slow_dead = 0;
+    while (off < slow_top) {
+        SlowRecord *r = slow_record_at(off);
+        size_t span = slow_record_span(r->size);
+        if (r->handle) {
+            HandleEntry *e = &handle_table[r->handle - 1];
+            if (e->pins && dst != off) {
+                /* cannot move: leave one dead filler record in front of it */
+                SlowRecord *gap = slow_record_at(dst);
+                gap->size = off - dst - sizeof(SlowRecord);
+                gap->handle = 0;
+                gap->magic = SLOW_RECORD_MAGIC;
+                slow_dead += off - dst;
+                dst = off;
+            } else if (dst != off) {
+                memmove(slow_base + dst, r, span);
+                e->slow_off = dst;
+            }
+            dst += span;
+        }
+        off += span;
+    }
+    slow_top = dst;
+}
+
+static int tier_demote(HandleEntry *e, mem_handle_t hd) {
+    if (!slow_base || e->tier != TIER_FAST || e->pins) return 0;
+    size_t size = e->block->size;
+    size_t span = slow_record_span(size);
+    if (slow_top + span > slow_capacity && slow_dead) tier_slow_compact();
+    if (slow_top + span > slow_capacity) return 0;
+
+    SlowRecord *r = slow_record_at(slow_top);
+    r->size = size;
+    r->handle = hd;
+    r->magic = SLOW_RECORD_MAGIC;
+    memcpy(r + 1, user_from_header(e->block), size);
+
+    Header *h = e->block;
+    plog_block(h);
+    h->handle = 0;
+    my_free(user_from_header(h));
+    e->block = NULL;
+    e->slow_off = slow_top;
+    e->tier = TIER_SLOW;
+    slow_top += span;
+    return 1;
+}
+
+static int tier_promote(HandleEntry *e) {
+    size_t size = tier_slow_size(e);
+    void *p = malloc_first_fit(size);
+    if (!p) return 0;
+    memcpy(p, tier_slow_payload(e), size);
+    mem_handle_t hd = slow_record_at(e->slow_off)->handle;
+    tier_slow_release(e);
+    Header *h = header_from_user(p);
+    plog_block(h);
+    h->handle = (uint16_t)hd;
+    e->block = h;
+    e->tier = TIER_FAST;
+    return 1;
+}
+
+/* demote unpinned fast handles, least accessed first, until about `size` bytes were freed */
+static int tier_make_room(size_t size) {
+    if (!slow_base) return 0;
+    size_t need = sizeof(Header) + size;
+    size_t freed = 0;
+    for (uint32_t limit = 0; freed < need; limit = limit * 2 + 1) {
+        for (uint32_t i = 0; i < handle_high_water && freed < need; ++i) {
+            HandleEntry *e = &handle_table[i];
+            if (e->tier != TIER_FAST || e->pins || e->accesses > limit) continue;
+            size_t sz = e->block->size;
+            if (tier_demote(e, i + 1)) freed += sizeof(Header) + sz;
+        }
+        if (limit >= UINT32_MAX / 2) break;
+    }
+    return freed > 0;
+}
+
+static size_t pool_free_bytes(void) {
+    size_t total = 0;
+    for (FreeMeta *cur = free_list_head(); cur; cur = meta_next(cur)) total += header_from_meta(cur)->size;
+    return total;
+}
+
+/* Promote slow handles accessed at least TIER_HOT_ACCESSES times, demote
+   untouched fast handles while the pool has less than TIER_FAST_RESERVE
+   bytes free, then halve all access counts. Returns handles migrated. */
+static size_t tier_rebalance_impl(void) {
+    if (!slow_base) return 0;
+    size_t migrated = 0;
+    for (uint32_t i = 0; i < handle_high_water; ++i) {
+        HandleEntry *e = &handle_table[i];
+        if (e->tier == TIER_SLOW && !e->pins && e->accesses >= TIER_HOT_ACCESSES) migrated += tier_promote(e);
+    }
+    for (uint32_t i = 0; i < handle_high_water && pool_free_bytes() < TIER_FAST_RESERVE; ++i) {
+        HandleEntry *e = &handle_table[i];
+        if (e->tier == TIER_FAST && e->accesses == 0) migrated += tier_demote(e, i + 1);
+    }
+    for (uint32_t i = 0; i < handle_high_water; ++i) handle_table[i].accesses >>= 1;
+    return migrated;
+}
+
+size_t tier_rebalance(void) {
+    pool_txn_begin();
+    size_t migrated = tier_rebalance_impl();
+    pool_txn_end();
+    return migrated;
+}
+
+static int handle_tier_impl(mem_handle_t hd) {
+    HandleEntry *e = handle_entry(hd);
+    if (!e) return TIER_NONE;
+    return e->tier;
+}
+
+int handle_tier(mem_handle_t hd) {
+    pool_txn_begin();
+    int tier = handle_tier_impl(hd);
+    pool_txn_end();
+    return tier;
+}
+
+/* ---------- Page compression (LZ77) ---------- */
+/* Token stream: 0x00-0x7F = literal run of (c + 1) bytes that follow,
+   0x80-0xFF = match of ((c & 0x7F) + 4) bytes at a 16-bit little-endian
+   backwards distance. Matches may overlap their own output (runs). */
+#define LZ_HASH_BITS  12
+#define LZ_MIN_MATCH  4
+#define LZ_MAX_MATCH  (0x7F + LZ_MIN_MATCH)
+#define LZ_MAX_LIT    0x80
+
+static size_t lz_flush_literals(const uint8_t *src, size_t n, uint8_t *dst, size_t op, size_t cap) {
+    while (n) {
+        size_t run = n < LZ_MAX_LIT ? n : LZ_MAX_LIT;
+        if (op + 1 + run > cap) return (size_t)-1;
+        dst[op++] = (uint8_t)(run - 1);
+        memcpy(dst + op, src, run);
+        op += run;
+        src += run;
+        n -= run;
+    }
+    return op;
+}
+
+/* returns compressed length, or 0 if the output would exceed cap */
+static size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+    uint16_t table[1 << LZ_HASH_BITS];   /* last position + 1, 0 = empty */
+    memset(table, 0, sizeof(table));
+    size_t ip = 0, op = 0, lit = 0;
+    while (ip + LZ_MIN_MATCH <= n) {
+        uint32_t seq;
+        memcpy(&seq, src + ip, sizeof(seq));
+        uint32_t slot = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t cand = table[slot];
+        table[slot] = (uint16_t)(ip + 1);
+        if (!cand || ip - (cand - 1) > 0xFFFF || memcmp(src + cand - 1, src + ip, LZ_MIN_MATCH) != 0) {
+            ip++;
+            continue;
+        }
+        size_t ref = cand - 1;
+        size_t len = LZ_MIN_MATCH;
+        while (ip + len < n && len < LZ_MAX_MATCH && src[ref + len] == src[ip + len]) len++;
+
+        op = lz_flush_literals(src + lit, ip - lit, dst, op, cap);
+        if (op == (size_t)-1 || op + 3 > cap) return 0;
+        size_t dist = ip - ref;
+        dst[op++] = (uint8_t)(0x80 | (len - LZ_MIN_MATCH));
+        dst[op++] = (uint8_t)(dist & 0xFF);
+        dst[op++] = (uint8_t)(dist >> 8);
+        ip += len;
+        lit = ip;
+    }
+    op = lz_flush_literals(src + lit, n - lit, dst, op, cap);
+    return op == (size_t)-1 ? 0 : op;
+}
+
+/* returns 0 if exactly n bytes were produced */
+static int lz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t n) {
+    size_t ip = 0, op = 0;
+    while (ip < len) {
+        uint8_t c = src[ip++];
+        if (c < 0x80) {
+            size_t run = (size_t)c + 1;
+            if (ip + run > len || op + run > n) return -1;
+            memcpy(dst + op, src + ip, run);
+            ip += run;
+            op += run;
+        } else {
+            if (ip + 2 > len) return -1;
+            size_t mlen = (size_t)(c & 0x7F) + LZ_MIN_MATCH;
+            size_t dist = (size_t)src[ip] | ((size_t)src[ip + 1] << 8);
+            ip += 2;
+            if (dist == 0 || dist > op || op + mlen > n) return -1;
+            for (size_t k = 0; k < mlen; ++k, ++op) dst[op] = dst[op - dist];
+        }
+    }
+    return op == n ? 0 : -1;
+}
+
+/* ---------- Page access tracking ---------- */
+/* Classifies pool pages by age: the number of page_tracker_sample() calls
+   since the page was last touched. Pages aged PAGE_COLD_AGE or more are cold.
+     TRACK_MPROTECT:   pages are armed PROT_NONE at each sample; the first
+                       access faults into track_fault_handler(), which
+                       re-enables the page and records the touch. Sees reads
+                       and writes, including the allocator's own metadata.
+     TRACK_SOFT_DIRTY: soft-dirty bits from /proc/self/pagemap, reset through
+                       /proc/self/clear_refs at each sample. No faults, but it
+                       only sees writes and the reset applies to the whole process.
+   In mprotect mode pool memory must not be passed to system calls such as
+   read() (they fail with EFAULT instead of faulting).
+   Sampling, sweeps and start/stop run under the pool lock, while the fault
+   handler may run on any thread at any time. Page states therefore change
+   only by compare-and-swap: whoever moves a page to PAGE_BUSY owns it and
+   alone changes its protection, and a thread faulting on a busy page waits
+   for the owner to finish before it retries the access. */
+enum { TRACK_OFF = 0, TRACK_MPROTECT = 1, TRACK_SOFT_DIRTY = 2 };
+enum { PAGE_HOT = 0, PAGE_COLD = 1 };
+enum { PAGE_ACTIVE = 0, PAGE_ARMED = 1, PAGE_COMPRESSED = 2, PAGE_BUSY = 3 };  /* mprotect-mode page states */
+
+#define PAGEMAP_SOFT_DIRTY ((uint64_t)1 << 55)
+
+static int track_mode = TRACK_OFF;
+static int fault_hook_users = 0;   /* tracker and running dedup scans, under the pool lock */
+static uint8_t page_state[POOL_PAGES];
+static uint8_t page_age[POOL_PAGES];
+static uint64_t track_pagemap[POOL_PAGES];
+static struct sigaction track_prev_action;
+
+static void cold_page_decompress(size_t i);
+
+static inline char* pool_page_addr(size_t i) {
+    return (char*)pool_base + i * POOL_PAGE_SIZE;
+}
+
+static inline uint8_t page_state_get(size_t i) {
+    return __atomic_load_n(&page_state[i], __ATOMIC_ACQUIRE);
+}
+static inline void page_state_set(size_t i, uint8_t state) {
+    __atomic_store_n(&page_state[i], state, __ATOMIC_RELEASE);
+}
+/* take ownership of page i if it is in state `from` */
+static inline int page_claim(size_t i, uint8_t from) {
+    return __atomic_compare_exchange_n(&page_state[i], &from, (uint8_t)PAGE_BUSY, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/* Make page i accessible, decompressing it if needed. Waits while another
+   thread owns the page; async-signal-safe, so the fault handler uses it. */
+static void page_make_active(size_t i) {
+    for (;;) {
+        uint8_t s = page_state_get(i);
+        if (s == PAGE_ACTIVE) return;
+        if (s == PAGE_BUSY) {
+            sched_yield();
+            continue;
+        }
+        if (!page_claim(i, s)) continue;
+        if (s == PAGE_COMPRESSED) cold_page_decompress(i);
+        else mprotect(pool_page_addr(i), POOL_PAGE_SIZE, PROT_READ | PROT_WRITE);
+        page_state_set(i, PAGE_ACTIVE);
+        return;
+    }
+}
+
+static void track_fault_handler(int sig, siginfo_t *si, void *ctx) {
+    char *addr = (char*)si->si_addr;
+    if (addr >= (char*)pool_base && addr < (char*)pool_base + POOL_SIZE) {
+        /* an active page may have been re-enabled by another thread since
+           the fault: returning retries the access either way */
+        page_make_active((size_t)(addr - (char*)pool_base) / POOL_PAGE_SIZE);
+        return;
+    }
+    if (slab_owns(addr)) {
+        /* only meshing protects slab pages: wait for it, then retry */
+        size_t v = (size_t)(addr - slab_base) / SLAB_PAGE_SIZE;
+        while (__atomic_load_n(&slab_busy[v], __ATOMIC_ACQUIRE)) sched_yield();
+        return;
+    }
+    /* not ours: hand over to whoever was installed before */
+    if (track_prev_action.sa_flags & SA_SIGINFO) {
+        track_prev_action.sa_sigaction(sig, si, ctx);
+    } else if (track_prev_action.sa_handler != SIG_IGN && track_prev_action.sa_handler != SIG_DFL) {
+        track_prev_action.sa_handler(sig);
+    } else {
+        signal(sig, SIG_DFL);   /* re-executing the access now kills the process */
+    }
+}
+
+/* install track_fault_handler() for SIGSEGV while anyone needs it */
+static int fault_hook_get(void) {
+    if (fault_hook_users++ > 0) return 0;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = track_fault_handler;
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGSEGV, &sa, &track_prev_action) != 0) {
+        perror("sigaction");
+        fault_hook_users = 0;
+        return -1;
+    }
+    return 0;
+}
+
+static void fault_hook_put(void) {
+    if (--fault_hook_users == 0) sigaction(SIGSEGV, &track_prev_action, NULL);
+}
+
+static int soft_dirty_reset(void) {
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd < 0) return -1;
+    ssize_t r = write(fd, "4", 1);
+    close(fd);
+    return r == 1 ? 0 : -1;
+}
+
+/* Kernels without CONFIG_MEM_SOFT_DIRTY accept the clear_refs reset but never
+   set the bit, which would make every page look cold: write to a probe page
+   after a reset and check that the write shows up. */
+static int soft_dirty_supported(void) {
+    static volatile char probe[2 * POOL_PAGE_SIZE];
+    volatile char *p = (volatile char*)(((uintptr_t)probe + POOL_PAGE_SIZE - 1) & ~(uintptr_t)(POOL_PAGE_SIZE - 1));
+    uint64_t e = 0;
+    p[0] = 1;
+    if (soft_dirty_reset() != 0) return 0;
+    p[0] = 2;
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd < 0) return 0;
+    ssize_t r = pread(fd, &e, sizeof(e), (off_t)((uintptr_t)p / POOL_PAGE_SIZE * sizeof(uint64_t)));
+    close(fd);
+    return r == (ssize_t)sizeof(e) && (e & PAGEMAP_SOFT_DIRTY);
+}
+
+/* PAGE_ACTIVE -> PAGE_ARMED; 0 if the page was not active */
+static int page_arm(size_t i) {
+    if (!page_claim(i, PAGE_ACTIVE)) return 0;
+    mprotect(pool_page_addr(i), POOL_PAGE_SIZE, PROT_NONE);
+    page_state_set(i, PAGE_ARMED);
+    return 1;
+}
+
+static int page_tracker_start_impl(int mode) {
+    if (track_mode == mode) return 0;
+    if (track_mode != TRACK_OFF || (mode != TRACK_MPROTECT && mode != TRACK_SOFT_DIRTY)) return -1;
+    memset(page_age, 0, sizeof(page_age));
+
+    if (mode == TRACK_SOFT_DIRTY) {
+        if (!soft_dirty_supported()) {
+            fprintf(stderr, "page_tracker_start: soft-dirty bits not available\n");
+            return -1;
+        }
+        if (soft_dirty_reset() != 0) {
+            perror("clear_refs");
+            return -1;
+        }
+        track_mode = mode;
+        return 0;
+    }
+
+    if (fault_hook_get() != 0) return -1;
+    track_mode = mode;
+    for (size_t i = 0; i < POOL_PAGES; ++i) page_arm(i);
+    return 0;
+}
+
+int page_tracker_start(int mode) {
+    pool_txn_begin();
+    int rc = page_tracker_start_impl(mode);
+    pool_txn_end();
+    return rc;
+}
+
+static void page_tracker_sample_impl(void) {
+    if (track_mode == TRACK_MPROTECT) {
+        for (size_t i = 0; i < POOL_PAGES; ++i) {
+            if (page_arm(i)) page_age[i] = 0;
+            else if (page_age[i] < UINT8_MAX) page_age[i]++;
+        }
+    } else if (track_mode == TRACK_SOFT_DIRTY) {
+        int fd = open("/proc/self/pagemap", O_RDONLY);
+        if (fd < 0) return;
+        off_t off = (off_t)((uintptr_t)pool_base / POOL_PAGE_SIZE * sizeof(uint64_t));
+        ssize_t r = pread(fd, track_pagemap, sizeof(track_pagemap), off);
+        close(fd);
+        if (r != (ssize_t)sizeof(track_pagemap)) return;
+        for (size_t i = 0; i < POOL_PAGES; ++i) {
+            if (track_pagemap[i] & PAGEMAP_SOFT_DIRTY) page_age[i] = 0;
+            else if (page_age[i] < UINT8_MAX) page_age[i]++;
+        }
+        soft_dirty_reset();
+    }
+}
+
+/* Age every page that was not touched since the previous sample and start
+   a new sampling interval. */
+void page_tracker_sample(void) {
+    pool_txn_begin();
+    page_tracker_sample_impl();
+    pool_txn_end();
+}
+
+static void cold_store_disable_impl(void);
+
+void page_tracker_stop(void) {
+    if (track_mode == TRACK_OFF) return;
+    pool_txn_begin();
+    if (track_mode == TRACK_MPROTECT) {
+        cold_store_disable_impl();
+        for (size_t i = 0; i < POOL_PAGES; ++i) page_make_active(i);
+        fault_hook_put();
+    }
+    track_mode = TRACK_OFF;
+    pool_txn_end();
+}
+
+static int page_tracker_protecting(void) {
+    return track_mode == TRACK_MPROTECT;
+}
+
+/* PAGE_HOT or PAGE_COLD; every page is hot while tracking is off */
+int pool_page_class(size_t page) {
+    if (page >= POOL_PAGES || track_mode == TRACK_OFF) return PAGE_HOT;
+    return page_age[page] >= PAGE_COLD_AGE ? PAGE_COLD : PAGE_HOT;
+}
+
+int pool_ptr_class(const void *p) {
+    if (!pool_base || (const char*)p < (const char*)pool_base) return PAGE_HOT;
+    return pool_page_class((size_t)((const char*)p - (const char*)pool_base) / POOL_PAGE_SIZE);
+}
+
+static int range_has_cold_page(const void *start, size_t len) {
+    size_t first = (size_t)((const char*)start - (const char*)pool_base) / POOL_PAGE_SIZE;
+    size_t last = (size_t)((const char*)start + len - 1 - (const char*)pool_base) / POOL_PAGE_SIZE;
+    for (size_t i = first; i <= last; ++i)
+        if (pool_page_class(i) == PAGE_COLD) return 1;
+    return 0;
+}
+
+/* first fit that steers away from free blocks on cold pages, so cold pages
+   stay cold for purging/compression; falls back to plain first fit */
+static void* warm_fit_impl(size_t size) {
+    if (!pool_initialized) init_pool();
+    size = fit_request_size(size);
+    if (track_mode != TRACK_OFF) {
+        for (FreeMeta *cur = free_list_head(); cur; cur = meta_next(cur)) {
+            Header *h = header_from_meta(cur);
+            if (!h->is_free || h->size < size) continue;
+            if (range_has_cold_page(h, sizeof(Header) + size)) continue;
+            remove_from_list(cur);
+            split_block(h, size);
+            h->is_free = 0;
+            h->magic = MAGIC_ALLOC;
+            return user_from_header(h);
+        }
+    }
+    return malloc_first_fit(size);
+}
+
+void* malloc_warm_fit(size_t size) {
+    pool_txn_begin();
+    void *p = warm_fit_impl(size);
+    pool_txn_end();
+    return p;
+}
+
+/* ---------- Compressed cold-page store ---------- */
+/* Built on mprotect page tracking: cold_store_sweep() takes a tracker sample
+   and compresses every page classified cold into a side store, dropping the
+   physical page with MADV_DONTNEED. The next touch faults and the handler
+   decompresses the page in place. A page is owned (PAGE_BUSY) and readable
+   only while it is compressed, so a write from another thread waits in the
+   fault handler instead of landing between the copy and the drop. The unit
+   bitmap and counters are shared with the handler and updated atomically. */
+#define COLD_UNITS      (COLD_STORE_SIZE / COLD_UNIT)
+#define COLD_MAX_LEN    (POOL_PAGE_SIZE * 3 / 4)   /* worse ratios are not worth storing */
+
+static int cold_enabled = 0;
+static uint8_t *cold_store = NULL;
+static uint64_t cold_unit_map[(COLD_UNITS + 63) / 64];
+static uint32_t cold_page_unit[POOL_PAGES];   /* first side store unit */
+static uint16_t cold_page_len[POOL_PAGES];    /* compressed length */
+static size_t cold_compressed_pages = 0;
+
+static inline int cold_unit_used(size_t u) {
+    return (int)((__atomic_load_n(&cold_unit_map[u / 64], __ATOMIC_ACQUIRE) >> (u % 64)) & 1);
+}
+static void cold_units_set(size_t first, size_t n, int used) {
+    for (size_t u = first; u < first + n; ++u) {
+        uint64_t bit = (uint64_t)1 << (u % 64);
+        if (used) __atomic_fetch_or(&cold_unit_map[u / 64], bit, __ATOMIC_ACQ_REL);
+        else __atomic_fetch_and(&cold_unit_map[u / 64], ~bit, __ATOMIC_ACQ_REL);
+    }
+}
+/* First fit over the unit bitmap; returns COLD_UNITS when nothing fits.
+   Only sweeps allocate (under the pool lock); the handler only frees, which
+   can make a run look used for a moment but never hands a unit out twice. */
+static size_t cold_units_alloc(size_t n) {
+    size_t run = 0;
+    for (size_t u = 0; u < COLD_UNITS; ++u) {
+        run = cold_unit_used(u) ? 0 : run + 1;
+        if (run == n) {
+            cold_units_set(u + 1 - n, n, 1);
+            return u + 1 - n;
+        }
+    }
+    return COLD_UNITS;
+}
+
+static void cold_store_die(const char *msg, size_t len) {
+    ssize_t r = write(2, msg, len);
+    (void)r;
+    abort();
+}
+
+/* Restore owned page i, which is PROT_NONE, and leave it writable. Runs
+   inside the fault handler. The page is filled in a scratch mapping that
+   mremap() then moves over the pool page in one step: writing it in place
+   would have to open the page first, and other threads would read zeros or
+   lose writes to the decompression until it finished. */
+static void cold_page_decompress(size_t i) {
+    static const char bad[] = "cold store: corrupt compressed page\n";
+    static const char nomem[] = "cold store: cannot restore page\n";
+    size_t u = cold_page_unit[i];
+    size_t len = cold_page_len[i];
+    void *tmp = mmap(NULL, POOL_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (tmp == MAP_FAILED) cold_store_die(nomem, sizeof(nomem) - 1);
+    if (lz_decompress(cold_store + u * COLD_UNIT, len, (uint8_t*)tmp, POOL_PAGE_SIZE) != 0)
+        cold_store_die(bad, sizeof(bad) - 1);
+    /* MREMAP_MAYMOVE | MREMAP_FIXED */
+    if ((void*)syscall(SYS_mremap, tmp, POOL_PAGE_SIZE, POOL_PAGE_SIZE, 0x1 | 0x2, pool_page_addr(i)) == MAP_FAILED)
+        cold_store_die(nomem, sizeof(nomem) - 1);
+    cold_units_set(u, (len + COLD_UNIT - 1) / COLD_UNIT, 0);
+    __atomic_fetch_sub(&cold_compressed_pages, 1, __ATOMIC_RELAXED);
+}
+
+static int cold_store_enable_impl(void) {
+    if (cold_enabled) return 0;
+    if (pool_options & POOL_OPT_MLOCK) return -1;   /* locked pages must stay resident */
+    if (pool_file_backed) return -1;   /* restored pages would no longer be the file's */
+    if (page_tracker_start_impl(TRACK_MPROTECT) != 0) return -1;
+    if (!cold_store) {
+        void *p = mmap(NULL, COLD_STORE_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+        if (p == MAP_FAILED) {
+            perror("mmap");
+            return -1;
+        }
+        cold_store = (uint8_t*)p;
+    }
+    cold_enabled = 1;
+    return 0;
+}
+
+int cold_store_enable(void) {
+    pool_txn_begin();
+    int rc = cold_store_enable_impl();
+    pool_txn_end();
+    return rc;
+}
+
+/* compress armed page i into the side store; 1 if it was stored */
+static int cold_page_compress(size_t i, uint8_t *buf) {
+    if (!page_claim(i, PAGE_ARMED)) return 0;   /* touched since the sample */
+    char *page = pool_page_addr(i);
+    mprotect(page, POOL_PAGE_SIZE, PROT_READ);
+    size_t len = lz_compress((const uint8_t*)page, POOL_PAGE_SIZE, buf, COLD_MAX_LEN);
+    size_t u = len ? cold_units_alloc((len + COLD_UNIT - 1) / COLD_UNIT) : COLD_UNITS;
+    if (u < COLD_UNITS) {
+        memcpy(cold_store + u * COLD_UNIT, buf, len);
+        cold_page_unit[i] = (uint32_t)u;
+        cold_page_len[i] = (uint16_t)len;
+    }
+    mprotect(page, POOL_PAGE_SIZE, PROT_NONE);
+    if (u < COLD_UNITS) {
+        /* only once nobody can read the page: it reads as zeros after this */
+        madvise(page, POOL_PAGE_SIZE, MADV_DONTNEED);
+        __atomic_fetch_add(&cold_compressed_pages, 1, __ATOMIC_RELAXED);
+    }
+    page_state_set(i, u < COLD_UNITS ? PAGE_COMPRESSED : PAGE_ARMED);
+    return u < COLD_UNITS;
+}
+
+/* Sample page accesses, then compress every cold page that is not compressed
+   yet. Returns the number of pages compressed by this sweep. */
+size_t cold_store_sweep(void) {
+    if (!cold_enabled) return 0;
+    size_t compressed = 0;
+    uint8_t buf[COLD_MAX_LEN];
+    pool_txn_begin();
+    if (pool_options & POOL_OPT_MLOCK) {   /* locked pages must stay resident */
+        pool_txn_end();
+        return 0;
+    }
+    page_tracker_sample_impl();
+    for (size_t i = 0; cold_enabled && i < POOL_PAGES; ++i) {
+        if (pool_page_class(i) == PAGE_COLD) compressed += (size_t)cold_page_compress(i, buf);
+    }
+    pool_txn_end();
+    return compressed;
+}
+
+static void cold_store_disable_impl(void) {
+    if (!cold_enabled) return;
+    for (size_t i = 0; i < POOL_PAGES; ++i) {
+        if (page_state_get(i) == PAGE_COMPRESSED) page_make_active(i);
+    }
+    cold_enabled = 0;
+}
+
+/* decompress everything; page tracking itself stays on */
+void cold_store_disable(void) {
+    pool_txn_begin();
+    cold_store_disable_impl();
+    pool_txn_end();
+}
+
+void cold_store_stats(size_t *compressed_pages, size_t *store_bytes_used) {
+    size_t units = 0;
+    for (size_t u = 0; u < COLD_UNITS; ++u) units += cold_unit_used(u);
+    if (compressed_pages) *compressed_pages = __atomic_load_n(&cold_compressed_pages, __ATOMIC_RELAXED);
+    if (store_bytes_used) *store_bytes_used = units * COLD_UNIT;
+}
+
+/* ---------- Page deduplication ---------- */
+/* pool_dedup_scan() hashes every (active) pool page and looks for identical
+   contents. All-zero pages are always handed back to the kernel with a fresh
+   anonymous mapping, which reads as the shared zero page until written.
+   Other duplicates are either
+     DEDUP_KSM:   marked MADV_MERGEABLE so that KSM can merge them, or
+     DEDUP_MEMFD: copied once into a template page of a private memfd and
+                  every duplicate remapped MAP_PRIVATE onto it, so they share
+                  one physical page copy-on-write.
+   The scan runs under the pool lock and owns every page it looks at
+   (PAGE_BUSY, read-only) from before hashing until after remapping, so a
+   write from another thread waits in the fault handler rather than landing
+   between the compare and the remap and being lost. */
+enum { DEDUP_KSM = 0, DEDUP_MEMFD = 1 };
+
+#define DEDUP_NONE 0xFFFFFFFFu
+
+typedef struct dedup_entry {
+    uint64_t hash;
+    uint32_t page;
+} DedupEntry;
+
+static int dedup_fd = -1;
+static uint32_t dedup_templates = 0;            /* template slots ever created */
+static uint32_t dedup_template_of[POOL_PAGES];  /* slot a page is mapped to, or DEDUP_NONE */
+static uint32_t dedup_refs[POOL_PAGES];         /* pages mapped to each slot */
+static DedupEntry dedup_scratch[POOL_PAGES];
+static uint8_t dedup_prev_state[POOL_PAGES];    /* state of each page before the scan claimed it */
+static int dedup_initialized = 0;
+
+static uint64_t page_hash(const char *page) {
+    uint64_t h = 1469598103934665603ull;    /* FNV-1a over 64-bit words */
+    const uint64_t *w = (const uint64_t*)page;
+    for (size_t i = 0; i < POOL_PAGE_SIZE / sizeof(uint64_t); ++i) {
+        h ^= w[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static int page_is_zero(const char *page) {
+    const uint64_t *w = (const uint64_t*)page;
+    for (size_t i = 0; i < POOL_PAGE_SIZE / sizeof(uint64_t); ++i)
+        if (w[i]) return 0;
+    return 1;
+}
+
+static int dedup_entry_cmp(const void *a, const void *b) {
+    const DedupEntry *x = (const DedupEntry*)a;
+    const DedupEntry *y = (const DedupEntry*)b;
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return (x->page > y->page) - (x->page < y->page);
+}
+
+static void dedup_drop_template(uint32_t page) {
+    uint32_t t = dedup_template_of[page];
+    if (t == DEDUP_NONE) return;
+    dedup_template_of[page] = DEDUP_NONE;
+    if (--dedup_refs[t] == 0) {
+        /* FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE */
+        syscall(SYS_fallocate, dedup_fd, 0x02 | 0x01, (off_t)t * POOL_PAGE_SIZE, (off_t)POOL_PAGE_SIZE);
+    }
+}
+
+static uint32_t dedup_new_template(const char *content) {
+    uint32_t t = 0;
+    while (t < dedup_templates && dedup_refs[t]) t++;
+    if (t == dedup_templates) {
+        if (ftruncate(dedup_fd, (off_t)(t + 1) * POOL_PAGE_SIZE) != 0) return DEDUP_NONE;
+        dedup_templates++;
+    }
+    if (pwrite(dedup_fd, content, POOL_PAGE_SIZE, (off_t)t * POOL_PAGE_SIZE) != POOL_PAGE_SIZE) return DEDUP_NONE;
+    return t;
+}
+
+/* pages mapped to a template may have been written (copied) since, so a
+   template is only reused for a group while it still holds that content */
+static int dedup_template_matches(uint32_t t, const char *content) {
+    static char buf[POOL_PAGE_SIZE];
+    return pread(dedup_fd, buf, POOL_PAGE_SIZE, (off_t)t * POOL_PAGE_SIZE) == POOL_PAGE_SIZE &&
+           memcmp(buf, content, POOL_PAGE_SIZE) == 0;
+}
+
+static int dedup_map_template(uint32_t page, uint32_t t) {
+    void *p = mmap(pool_page_addr(page), POOL_PAGE_SIZE, PROT_READ,
+                   MAP_PRIVATE | MAP_FIXED, dedup_fd, (off_t)t * POOL_PAGE_SIZE);
+    if (p == MAP_FAILED) return -1;
+    dedup_template_of[page] = t;
+    dedup_refs[t]++;
+    return 0;
+}
+
+/* claim page i for the scan and make it read-only; 0 if it is compressed */
+static int dedup_claim(size_t i) {
+    for (;;) {
+        uint8_t s = page_state_get(i);
+        if (s == PAGE_COMPRESSED) return 0;
+        if (s == PAGE_BUSY) {   /* a fault handler is re-enabling it */
+            sched_yield();
+            continue;
+        }
+        if (page_claim(i, s)) {
+            dedup_prev_state[i] = s;
+            mprotect(pool_page_addr(i), POOL_PAGE_SIZE, PROT_READ);
+            return 1;
+        }
+    }
+}
+
+/* give a claimed page back with the access it had before the scan */
+static void dedup_release(size_t i) {
+    uint8_t s = dedup_prev_state[i];
+    mprotect(pool_page_addr(i), POOL_PAGE_SIZE, s == PAGE_ARMED ? PROT_NONE : PROT_READ | PROT_WRITE);
+    page_state_set(i, s);
+}
+
+static size_t dedup_scan_impl(int mode) {
+    if (pool_options & POOL_OPT_MLOCK) return 0;  /* remapping would drop the locks */
+    if (pool_file_backed) return 0;               /* ... or detach pages from the file */
+    if (!dedup_initialized) {
+        for (size_t i = 0; i < POOL_PAGES; ++i) dedup_template_of[i] = DEDUP_NONE;
+        dedup_initialized = 1;
+    }
+    if (mode == DEDUP_MEMFD && dedup_fd < 0) {
+        dedup_fd = (int)syscall(SYS_memfd_create, "mmu-dedup", 0);
+        if (dedup_fd < 0) {
+            perror("memfd_create");
+            return 0;
+        }
+    }
+
+    /* armed pages are read without counting it as an access; compressed ones are skipped */
+    if (fault_hook_get() != 0) return 0;
+    size_t shared = 0, n = 0;
+    for (uint32_t i = 0; i < POOL_PAGES; ++i) {
+        if (!dedup_claim(i)) {
+            dedup_prev_state[i] = PAGE_COMPRESSED;
+            continue;
+        }
+        char *page = pool_page_addr(i);
+        if (page_is_zero(page)) {
+            dedup_drop_template(i);
+            mmap(page, POOL_PAGE_SIZE, PROT_READ, MAP_ANON | MAP_PRIVATE | MAP_FIXED, -1, 0);
+            shared++;
+            continue;
+        }
+        dedup_scratch[n].hash = page_hash(page);
+        dedup_scratch[n].page = i;
+        n++;
+    }
+    qsort(dedup_scratch, n, sizeof(DedupEntry), dedup_entry_cmp);
+
+    for (size_t a = 0; a < n; ) {
+        size_t b = a + 1;
+        while (b < n && dedup_scratch[b].hash == dedup_scratch[a].hash) b++;
+        /* within a hash group, compare everything against the first page */
+        const char *first = pool_page_addr(dedup_scratch[a].page);
+        size_t group = 1;
+        for (size_t k = a + 1; k < b; ++k) {
+            if (memcmp(first, pool_page_addr(dedup_scratch[k].page), POOL_PAGE_SIZE) == 0)
+                dedup_scratch[a + group++] = dedup_scratch[k];
+        }
+        if (group > 1) {
+            if (mode == DEDUP_KSM) {
+                for (size_t k = a; k < a + group; ++k)
+                    madvise(pool_page_addr(dedup_scratch[k].page), POOL_PAGE_SIZE, MADV_MERGEABLE);
+                shared += group;
+            } else {
+                /* reuse a template one of the pages is still mapped to */
+                uint32_t t = DEDUP_NONE, stale = DEDUP_NONE;
+                for (size_t k = a; k < a + group && t == DEDUP_NONE; ++k) {
+                    uint32_t cand = dedup_template_of[dedup_scratch[k].page];
+                    if (cand == DEDUP_NONE || cand == stale) continue;
+                    if (dedup_template_matches(cand, first)) t = cand;
+                    else stale = cand;
+                }
+                if (t == DEDUP_NONE) t = dedup_new_template(first);
+                if (t != DEDUP_NONE) {
+                    dedup_refs[t]++;    /* hold the template while pages are remapped */
+                    for (size_t k = a; k < a + group; ++k) {
+                        uint32_t pg = dedup_scratch[k].page;
+                        if (dedup_template_of[pg] == t) { shared++; continue; }
+                        dedup_drop_template(pg);
+                        if (dedup_map_template(pg, t) == 0) shared++;
+                    }
+                    dedup_refs[t]--;
+                }
+            }
+        } else {
+            /* a page that no longer matches its template has been written (COW) */
+            uint32_t pg = dedup_scratch[a].page;
+            if (dedup_template_of[pg] != DEDUP_NONE) dedup_drop_template(pg);
+        }
+        a = b;
+    }
+
+    for (size_t i = 0; i < POOL_PAGES; ++i)
+        if (dedup_prev_state[i] != PAGE_COMPRESSED) dedup_release(i);
+    fault_hook_put();
+    return shared;
+}
+
+/* Returns the number of pages that are shared (or offered to KSM) after the scan. */
+size_t pool_dedup_scan(int mode) {
+    pool_txn_begin();
+    size_t shared = dedup_scan_impl(mode);
+    pool_txn_end();
+    return shared;
+}
+
+
+/* ---------- io_uring registered buffer pool ---------- */
+/* A dedicated region of page-aligned I/O buffers. The whole region is
+   registered with io_uring as fixed buffer 0 (IORING_REGISTER_BUFFERS), so
+   the kernel pins it once instead of on every read/write. Buffers are whole
+   pages tracked in a bitmap; use IORING_OP_READ_FIXED / WRITE_FIXED with
+   buf_index = iobuf_index(ptr). The region is process-local; its bitmap is
+   only changed under the pool lock. */
+#ifndef SYS_io_uring_register
+#define SYS_io_uring_register 427
+#endif
+#define IOBUF_REGISTER_BUFFERS   0   /* IORING_REGISTER_BUFFERS */
+#define IOBUF_UNREGISTER_BUFFERS 1   /* IORING_UNREGISTER_BUFFERS */
+#define IOBUF_PAGES (IOBUF_POOL_SIZE / POOL_PAGE_SIZE)
+
+static char *iobuf_base = NULL;
+static uint64_t iobuf_map[(IOBUF_PAGES + 63) / 64];
+static uint32_t iobuf_pages_of[IOBUF_PAGES];   /* length in pages, kept at the first page */
+static int iobuf_ring_fd = -1;
+
+static int iobuf_pool_init_impl(void) {
+    if (iobuf_base) return 0;
+    void *p = mmap(NULL, IOBUF_POOL_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    iobuf_base = (char*)p;
+    return 0;
+}
+
+int iobuf_pool_init(void) {
+    pool_txn_begin();
+    int rc = iobuf_pool_init_impl();
+    pool_txn_end();
+    return rc;
+}
+
+static inline int iobuf_page_used(size_t i) {
+    return (int)((iobuf_map[i / 64] >> (i % 64)) & 1);
+}
+static void iobuf_pages_set(size_t first, size_t n, int used) {
+    for (size_t i = first; i < first + n; ++i) {
+        if (used) iobuf_map[i / 64] |= (uint64_t)1 << (i % 64);
+        else iobuf_map[i / 64] &= ~((uint64_t)1 << (i % 64));
+    }
+}
+
+static void* iobuf_alloc_impl(size_t size, size_t align) {
+    if (size == 0 || (align & (align - 1))) return NULL;
+    if (iobuf_pool_init_impl() != 0) return NULL;
+    size_t n = (size + POOL_PAGE_SIZE - 1) / POOL_PAGE_SIZE;
+    size_t step = align > POOL_PAGE_SIZE ? align / POOL_PAGE_SIZE : 1;
+    /* the region itself is page aligned only, so align candidate addresses */
+    size_t first = 0;
+    uintptr_t base = (uintptr_t)iobuf_base;
+    if (align > POOL_PAGE_SIZE && base % align) first = (align - base % align) / POOL_PAGE_SIZE;
+
+    for (size_t start = first; start + n <= IOBUF_PAGES; start += step) {
+        if (iobuf_map[start / 64] == UINT64_MAX && start % 64 == 0 && step == 1) {
+            start += 63;   /* fully used word */
+            continue;
+        }
+        size_t k = 0;
+        while (k < n && !iobuf_page_used(start + k)) k++;
+        if (k == n) {
+            iobuf_pages_set(start, n, 1);
+            iobuf_pages_of[start] = (uint32_t)n;
+            return iobuf_base + start * POOL_PAGE_SIZE;
+        }
+    }
+    return NULL;
+}
+
+/* size is rounded up to whole pages; align must be a power of two (at least a page is implied) */
+void* iobuf_alloc(size_t size, size_t align) {
+    pool_txn_begin();
+    void *p = iobuf_alloc_impl(size, align);
+    pool_txn_end();
+    return p;
+}
+
+static inline int iobuf_owns(const void *p) {
+    return iobuf_base && (const char*)p >= iobuf_base && (const char*)p < iobuf_base + IOBUF_POOL_SIZE;
+}
+
+/* release many buffers at once (e.g. after reaping a batch of completions) */
+void iobuf_free_batch(void **bufs, size_t count) {
+    pool_txn_begin();
+    for (size_t b = 0; b < count; ++b) {
+        if (!bufs[b]) continue;
+        size_t off = 0;   /* only a pointer into the region may be subtracted from its base */
+        if (!iobuf_owns(bufs[b]) || (off = (size_t)((char*)bufs[b] - iobuf_base)) % POOL_PAGE_SIZE ||
+            !iobuf_pages_of[off / POOL_PAGE_SIZE]) {
+            fprintf(stderr, "Invalid or double free\n");
+            continue;
+        }
+        size_t first = off / POOL_PAGE_SIZE;
+        iobuf_pages_set(first, iobuf_pages_of[first], 0);
+        iobuf_pages_of[first] = 0;
+    }
+    pool_txn_end();
+}
+
+void iobuf_free(void *buf) {
+    iobuf_free_batch(&buf, 1);
+}
+
+static int iobuf_register_impl(int ring_fd) {
+    if (iobuf_pool_init_impl() != 0) return -1;
+    struct iovec iov;
+    iov.iov_base = iobuf_base;
+    iov.iov_len = IOBUF_POOL_SIZE;
+    if (syscall(SYS_io_uring_register, ring_fd, IOBUF_REGISTER_BUFFERS, &iov, 1) != 0) {
+        perror("io_uring_register");
+        return -1;
+    }
+    iobuf_ring_fd = ring_fd;
+    return 0;
+}
+
+/* register the region as fixed buffer 0 of the ring; returns 0 or -1 */
+int iobuf_register(int ring_fd) {
+    pool_txn_begin();
+    int rc = iobuf_register_impl(ring_fd);
+    pool_txn_end();
+    return rc;
+}
+
+int iobuf_unregister(void) {
+    pool_txn_begin();
+    int rc = 0;
+    if (iobuf_ring_fd >= 0) rc = (int)syscall(SYS_io_uring_register, iobuf_ring_fd, IOBUF_UNREGISTER_BUFFERS, NULL, 0);
+    iobuf_ring_fd = -1;
+    pool_txn_end();
+    return rc;
+}
+
+/* fixed-buffer index for sqe->buf_index, -1 if p is not from this pool */
+static inline int iobuf_index(const void *p) {
+    return iobuf_owns(p) ? 0 : -1;
+}
+
+/* ---------- Growable virtual reservations ---------- */
+/* A VBuf reserves a large range of address space up front (PROT_NONE,
+   MAP_NORESERVE: no memory or commit charge) and makes pages accessible in
+   VBUF_COMMIT_CHUNK steps as it grows. The buffer never moves, so growth
+   never copies and pointers into it stay valid up to the reservation limit.
+   Reserved buffers are linked into a registry so that toggling
+   POOL_OPT_MLOCK reaches them; a VBuf must stay at its address (not be
+   copied) until it is released. Locked pages are always the last `locked`
+   bytes of the committed prefix: a commit in locked mode locks its pages or
+   fails, and toggling the option (un)locks the whole prefix. */
+typedef struct vbuf {
+    char *base;
+    size_t reserved;    /* address space, page multiple */
+    size_t committed;   /* accessible prefix, page multiple */
+    size_t used;        /* bytes handed out by vbuf_grow()/vbuf_append() */
+    size_t locked;      /* mlock()ed bytes at the end of the committed prefix */
+    struct vbuf *next;  /* registry link */
+} VBuf;
+
+static VBuf *vbuf_list = NULL;   /* under vbuf_lock */
+
+static int vbufs_lock_all(void) {
+    int rc = 0;
+    for (VBuf *vb = vbuf_list; vb; vb = vb->next) {
+        if (vb->locked == vb->committed) continue;
+        if (lock_region(vb->base, vb->committed - vb->locked) != 0) {
+            rc = -1;
+            continue;
+        }
+        vb->locked = vb->committed;
+    }
+    return rc;
+}
+
+static void vbufs_unlock_all(void) {
+    for (VBuf *vb = vbuf_list; vb; vb = vb->next) {
+        if (vb->locked) unlock_region(vb->base + vb->committed - vb->locked, vb->locked);
+        vb->locked = 0;
+    }
+}
+
+int vbuf_reserve(VBuf *vb, size_t max_bytes) {
+    size_t len = (max_bytes + POOL_PAGE_SIZE - 1) & ~(size_t)(POOL_PAGE_SIZE - 1);
+    void *p = mmap(NULL, len, PROT_NONE, MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    vb->base = (char*)p;
+    vb->reserved = len;
+    vb->committed = 0;
+    vb->used = 0;
+    vb->locked = 0;
+    pthread_mutex_lock(&vbuf_lock);
+    vb->next = vbuf_list;
+    vbuf_list = vb;
+    pthread_mutex_unlock(&vbuf_lock);
+    return 0;
+}
+
+/* make at least the first `bytes` accessible; -1 if beyond the reservation
+   or, in locked mode, if the new pages cannot be locked */
+int vbuf_commit(VBuf *vb, size_t bytes) {
+    if (bytes <= vb->committed) return 0;
+    if (bytes > vb->reserved) return -1;
+    size_t target = (bytes + VBUF_COMMIT_CHUNK - 1) & ~(size_t)(VBUF_COMMIT_CHUNK - 1);
+    if (target > vb->reserved) target = vb->reserved;
+    char *from = vb->base + vb->committed;
+    size_t len = target - vb->committed;
+    if (mprotect(from, len, PROT_READ | PROT_WRITE) != 0) {
+        perror("mprotect");
+        return -1;
+    }
+    pthread_mutex_lock(&vbuf_lock);
+    if (pool_options & POOL_OPT_MLOCK) {
+        if (lock_region(from, len) != 0) {
+            pthread_mutex_unlock(&vbuf_lock);
+            mprotect(from, len, PROT_NONE);
+            return -1;
+        }
+        vb->locked += len;
+    }
+    vb->committed = target;
+    pthread_mutex_unlock(&vbuf_lock);
+    return 0;
+}
+
+/* extend the buffer by n bytes and return the start of the new space */
+void* vbuf_grow(VBuf *vb, size_t n) {
+    if (n > vb->reserved - vb->used || vbuf_commit(vb, vb->used + n) != 0) return NULL;
+    void *p = vb->base + vb->used;
+    vb->used += n;
+    return p;
+}
+
+void* vbuf_append(VBuf *vb, const void *data, size_t n) {
+    void *p = vbuf_grow(vb, n);
+    if (p) memcpy(p, data, n);
+    return p;
+}
+
+/* truncate to `bytes`, returning whole pages past it to the kernel */
+void vbuf_shrink(VBuf *vb, size_t bytes) {
+    if (bytes >= vb->used) return;
+    vb->used = bytes;
+    size_t keep = (bytes + POOL_PAGE_SIZE - 1) & ~(size_t)(POOL_PAGE_SIZE - 1);
+    if (keep >= vb->committed) return;
+    size_t len = vb->committed - keep;
+    pthread_mutex_lock(&vbuf_lock);
+    size_t unlock = len < vb->locked ? len : vb->locked;
+    if (unlock) unlock_region(vb->base + vb->committed - unlock, unlock);
+    vb->locked -= unlock;
+    vb->committed = keep;
+    pthread_mutex_unlock(&vbuf_lock);
+    madvise(vb->base + keep, len, MADV_DONTNEED);
+    mprotect(vb->base + keep, len, PROT_NONE);
+}
+
+void vbuf_release(VBuf *vb) {
+    if (!vb->base) return;
+    pthread_mutex_lock(&vbuf_lock);
+    for (VBuf **pp = &vbuf_list; *pp; pp = &(*pp)->next) {
+        if (*pp == vb) {
+            *pp = vb->next;
+            break;
+        }
+    }
+    if (vb->locked) unlock_region(vb->base + vb->committed - vb->locked, vb->locked);
+    pthread_mutex_unlock(&vbuf_lock);
+    munmap(vb->base, vb->reserved);
+    memset(vb, 0, sizeof(*vb));
+}
+
+/* ---------- File-backed persistent pool ---------- */
+/* The pool mapping is [PoolRoot page][pool]. Block headers, free-list and
+   buddy-list links and all list heads are pool offsets, so the file can be
+   mapped at any address and used as-is: reopening validates the root and
+   rebuilds nothing. Handles, the slow tier and other side structures are
+   process-local and do not survive a reopen; keep raw allocations (and
+   offsets between them) in a persistent pool. */
+static int pool_root_valid(const PoolRoot *r) {
+    return r->magic == POOL_ROOT_MAGIC && r->version == POOL_ROOT_VERSION &&
+           r->layout == (uint32_t)(sizeof(Header) << 16 | sizeof(FreeMeta)) &&
+           r->pool_size == POOL_SIZE;
+}
+
+#define POOL_ATTACH_WAIT_MS 5000   /* how long an attacher waits for the creator to format */
+
+/* Map an open pool object (file, memfd or shm) MAP_SHARED as the pool:
+   format it if `fresh`, otherwise validate the root and roll back any
+   interrupted transaction. A shared object (no `reset_lock`) may still be
+   being sized and formatted by the process that created it: an empty
+   object or an unset magic is waited for, up to POOL_ATTACH_WAIT_MS.
+   Does not close fd. Returns 0 or -1. */
+static int map_pool_fd(int fd, int fresh, int reset_lock) {
+    struct stat st;
+    struct timespec tick = { 0, 1000 * 1000 };
+    int waited = 0;
+    for (;;) {
+        if (fstat(fd, &st) != 0) {
+            perror("fstat");
+            return -1;
+        }
+        if (fresh || reset_lock || st.st_size != 0 || waited++ >= POOL_ATTACH_WAIT_MS) break;
+        nanosleep(&tick, NULL);
+    }
+    if (fresh && ftruncate(fd, (off_t)POOL_MAP_SIZE) != 0) {
+        perror("ftruncate");
+        return -1;
+    }
+    if (!fresh && (size_t)st.st_size != POOL_MAP_SIZE) {
+        fprintf(stderr, "Pool file has the wrong size\n");
+        return -1;
+    }
+    void *p = mmap(NULL, POOL_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    while (!fresh && !reset_lock && !__atomic_load_n(&((PoolRoot*)p)->magic, __ATOMIC_ACQUIRE) &&
+           waited++ < POOL_ATTACH_WAIT_MS) nanosleep(&tick, NULL);
+    if (!fresh && !pool_root_valid((PoolRoot*)p)) {
+        fprintf(stderr, "Not a pool file, or built with a different layout\n");
+        munmap(p, POOL_MAP_SIZE);
+        return -1;
+    }
+    attach_pool_mapping(p);
+    pool_file_backed = 1;
+    if (fresh) {
+        format_pool();
+        return 0;
+    }
+    if (reset_lock) {
+        /* a lock word from an earlier boot means nothing; nobody else has the file yet */
+        init_pool_lock();
+        plog_recover();
+    }
+    return 0;
+}
+
+/* Map `path` as the pool, formatting it if the file is new or empty. Must be
+   called before the first allocation, by the only process using the file
+   (see init_pool_shared() for concurrent use). Returns 0 on success, -1 on error. */
+int init_pool_file(const char *path) {
+    if (pool_initialized) return -1;
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror("fstat");
+        close(fd);
+        return -1;
+    }
+    int rc = map_pool_fd(fd, st.st_size == 0, 1);
+    close(fd);
+    return rc;
+}
+
+/* flush a file-backed pool to disk */
+int pool_sync(void) {
+    if (!pool_initialized || !pool_file_backed) return 0;
+    return msync(pool_root, POOL_MAP_SIZE, MS_SYNC);
+}
+
+/* ---------- Multi-process shared heap ---------- */
+/* A pool on a memfd or POSIX shm object, mapped MAP_SHARED by several
+   processes. All links are pool offsets, so each process may map it at a
+   different address; pointers are translated with pool_base. Every public
+   call runs under the robust process-shared lock in the pool root, and the
+   intent log lets a survivor roll back the half-done call of a process that
+   died holding the lock. Any attached process may my_free() any block.
+   Handles, the slab arena and the other side structures stay per process. */
+
+/* Create (or attach to) a shared pool. With name == NULL the pool lives on an
+   anonymous memfd: children forked afterwards share it, and unrelated
+   processes can attach through pool_shared_fd() passed over a Unix socket.
+   With a name, the first caller creates and formats the shm object and later
+   callers (in any process) attach to it. Returns 0 or -1. */
+int init_pool_shared(const char *name) {
+    if (pool_initialized) return -1;
+    int fresh = 1;
+    int fd;
+    if (!name) {
+        fd = (int)syscall(SYS_memfd_create, "mmu-pool", 0);
+    } else {
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0 && errno == EEXIST) {
+            fd = shm_open(name, O_RDWR, 0600);
+            fresh = 0;
+        }
+    }
+    if (fd < 0) {
+        perror(name ? "shm_open" : "memfd_create");
+        return -1;
+    }
+    if (map_pool_fd(fd, fresh, 0) != 0) {
+        close(fd);
+        return -1;
+    }
+    pool_fd = fd;
+    return 0;
+}
+
+/* attach to a shared pool through a descriptor received from another process */
+int pool_attach_fd(int fd) {
+    if (pool_initialized) return -1;
+    if (map_pool_fd(fd, 0, 0) != 0) return -1;
+    pool_fd = fd;
+    return 0;
+}
+
+/* descriptor of the shared pool object, -1 if the pool is not shared */
+int pool_shared_fd(void) {
+    return pool_fd;
+}
+
+void pool_zero_stop(void);
+static void epoch_drain(void);
+static void gen_reset(void);
+
+/* Unmap the pool (syncing it first if file-backed). Outstanding pointers and
+   handles become invalid; the next allocation maps a fresh anonymous pool. */
+void pool_close(void) {
+    if (!pool_initialized) return;
+    pool_zero_stop();
+    page_tracker_stop();
+    epoch_drain();
+    pool_sync();
+    if (pool_map_locked) unlock_region(pool_root, pool_map_locked);
+    pool_map_locked = 0;
+    munmap(pool_root, POOL_MAP_SIZE);
+    if (pool_fd >= 0) close(pool_fd);
+    pool_fd = -1;
+    memset(handle_table, 0, sizeof(handle_table));
+    handle_free_slots = handle_high_water = 0;
+    compact_cursor = 0;
+    dedup_initialized = 0;
+    gen_reset();
+    pool_root = NULL;
+    pool_base = NULL;
+    pool_initialized = 0;
+    pool_file_backed = 0;
+}
+
+/* ---------- Heap snapshot image ---------- */
+/* pool_snapshot_save() writes the root and every block header to an image
+   file, plus the payloads of allocated blocks; free payloads are left as
+   holes, so the image is sparse and its disk footprint tracks live data.
+   pool_snapshot_load() maps the image MAP_PRIVATE as a new pool: nothing is
+   read up front, pages come in on first touch, and writes stay private (the
+   image can warm-start any number of processes). Only offsets are stored in
+   the heap, so the image works at whatever address it is mapped. */
+#define SNAPSHOT_CHUNK (16 * POOL_PAGE_SIZE)
+
+/* copy through a buffer so pages armed by the tracker or held by the cold
+   store fault in normally instead of failing the write with EFAULT */
+static int snapshot_write(int fd, size_t off, size_t len) {
+    static char buf[SNAPSHOT_CHUNK];
+    while (len) {
+        size_t n = len < SNAPSHOT_CHUNK ? len : SNAPSHOT_CHUNK;
+        memcpy(buf, (char*)pool_root + off, n);
+        if (pwrite(fd, buf, n, (off_t)off) != (ssize_t)n) {
+            perror("pwrite");
+            return -1;
+        }
+        off += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int snapshot_create(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)POOL_MAP_SIZE) != 0) {
+        perror("ftruncate");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* write the root and the live ranges of every block; the caller keeps the heap still */
+static int snapshot_write_image(int fd) {
+    int rc = snapshot_write(fd, 0, sizeof(PoolRoot));
+
+    /* live ranges closer than a page are merged into one write: the hole would
+       not save a file-system block anyway */
+    size_t run_start = POOL_ROOT_SIZE, run_end = POOL_ROOT_SIZE;
+    for (size_t off = 0; rc == 0 && off < POOL_SIZE; ) {
+        Header *h = header_from_offset(off);
+        size_t start = POOL_ROOT_SIZE + off;
+        size_t live = h->is_free ? sizeof(Header) + sizeof(FreeMeta) : sizeof(Header) + h->size;
+        if (start > run_end + POOL_PAGE_SIZE) {
+            rc = snapshot_write(fd, run_start, run_end - run_start);
+            run_start = start;
+        }
+        run_end = start + live;
+        off += sizeof(Header) + h->size;
+    }
+    if (rc == 0) rc = snapshot_write(fd, run_start, run_end - run_start);
+    return rc;
+}
+
+/* Write a consistent image of the pool to `path`. Runs under the pool lock.
+   Handles and other process-local state are not part of the image.
+   Returns 0 on success, -1 on error. */
+int pool_snapshot_save(const char *path) {
+    int fd = snapshot_create(path);
+    if (fd < 0) return -1;
+    pool_txn_begin();
+    int rc = snapshot_write_image(fd);
+    pool_txn_end();
+    close(fd);
+    return rc;
+}
+
+/* Map an image written by pool_snapshot_save() as the pool, copy-on-write.
+   Must be called before the first allocation. Returns 0 or -1. */
+int pool_snapshot_load(const char *path) {
+    if (pool_initialized) return -1;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != POOL_MAP_SIZE) {
+        fprintf(stderr, "Snapshot image has the wrong size\n");
+        close(fd);
+        return -1;
+    }
+    void *p = mmap(NULL, POOL_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    if (!pool_root_valid((PoolRoot*)p)) {
+        fprintf(stderr, "Not a snapshot image, or built with a different layout\n");
+        munmap(p, POOL_MAP_SIZE);
+        return -1;
+    }
+    attach_pool_mapping(p);
+    init_pool_lock();
+    pool_root->log_used = 0;
+    return 0;
+}
+
+/* ---------- Copy-on-write checkpoints ---------- */
+/* pool_checkpoint() forks while holding the pool lock for just that instant.
+   The child sees the heap frozen at the fork (the kernel shares the pages
+   copy-on-write) and serializes it with the snapshot writer, while the
+   parent keeps allocating and writing; only pages the parent dirties in the
+   meantime get copied. The image is written to `path`.tmp and renamed over
+   `path` once complete, so a crash never leaves a torn checkpoint behind.
+   A pool mapped MAP_SHARED (file, memfd, shm) is not copied on fork, so it
+   cannot be checkpointed this way; use pool_snapshot_save() for those. */
+
+/* start a background checkpoint; returns the writer's pid, or -1 */
+pid_t pool_checkpoint(const char *path) {
+    if (!pool_initialized) init_pool();
+    if (pool_file_backed) {
+        fprintf(stderr, "Checkpoints need a private pool\n");
+        return -1;
+    }
+    size_t len = strlen(path);
+    char *tmp = (char*)malloc(len + 5);
+    if (!tmp) return -1;
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".tmp", 5);
+
+    pool_txn_begin();
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* the child never touches the (inherited, held) lock */
+        int fd = snapshot_create(tmp);
+        int rc = fd < 0 ? -1 : snapshot_write_image(fd);
+        if (rc == 0 && fsync(fd) != 0) rc = -1;
+        if (rc == 0 && rename(tmp, path) != 0) rc = -1;
+        _exit(rc == 0 ? 0 : 1);
+    }
+    pool_txn_end();
+    if (pid < 0) perror("fork");
+    free(tmp);
+    return pid;
+}
+
+/* Reap a checkpoint writer. Returns 0 once it succeeded, -1 if it failed,
+   1 if it is still running and `nohang` is set. */
+int pool_checkpoint_wait(pid_t pid, int nohang) {
+    int status;
+    pid_t r = waitpid(pid, &status, nohang ? WNOHANG : 0);
+    if (r == 0) return 1;
+    if (r < 0) {
+        perror("waitpid");
+        return -1;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+/* ---------- Epoch-based deferred reclamation ---------- */
+/* Quiescent-state reclamation for lock-free structures. Registered threads
+   call retire(p) instead of my_free(p) once p is unlinked, and
+   epoch_quiescent() whenever they hold no references into shared structures
+   (e.g. between operations). The global epoch advances once every
+   registered thread has announced the current one, and a block retired in
+   epoch e is freed when the epoch reaches e + 2: by then every thread has
+   passed a quiescent point since the unlink. Each thread keeps three limbo
+   lists (one per epoch mod 3) chained through the dead blocks' payloads, so
+   retiring allocates nothing; a list is freed as one batch under a single
+   pool lock acquisition. */
+typedef struct epoch_limbo {
+    void *head;          /* chained through the first word of each payload */
+    size_t count;
+    uint64_t epoch;      /* epoch the blocks were retired in */
+} EpochLimbo;
+
+typedef struct epoch_thread {
+    uint64_t local;      /* last epoch this thread announced */
+    int in_use;
+    EpochLimbo limbo[3];
+} __attribute__((aligned(64))) EpochThread;
+
+static uint64_t epoch_global = 1;
+static EpochThread epoch_threads[EPOCH_MAX_THREADS];
+static __thread EpochThread *epoch_self = NULL;
+static EpochLimbo epoch_orphans;   /* left by unregistered threads, under the pool lock */
+
+static void epoch_free_batch(void *head) {
+    pool_txn_begin();
+    while (head) {
+        void *next = *(void**)head;
+        free_impl(head);
+        plog_commit();   /* each free leaves the heap consistent */
+        head = next;
+    }
+    pool_txn_end();
+}
+
+/* free every limbo list of `self` that is two epochs old */
+static void epoch_reclaim(EpochThread *self, uint64_t now) {
+    for (int i = 0; i < 3; ++i) {
+        EpochLimbo *l = &self->limbo[i];
+        if (l->count && l->epoch + 2 <= now) {
+            epoch_free_batch(l->head);
+            l->head = NULL;
+            l->count = 0;
+        }
+    }
+}
+
+/* register the calling thread; it then holds back reclamation until it unregisters */
+int epoch_register(void) {
+    if (epoch_self) return 0;
+    for (int i = 0; i < EPOCH_MAX_THREADS; ++i) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&epoch_threads[i].in_use, &expected, 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            epoch_self = &epoch_threads[i];
+            __atomic_store_n(&epoch_self->local, __atomic_load_n(&epoch_global, __ATOMIC_ACQUIRE), __ATOMIC_SEQ_CST);
+            return 0;
+        }
+    }
+    fprintf(stderr, "Too many epoch threads\n");
+    return -1;
+}
+
+/* Announce that the calling thread holds no references to retired blocks.
+   Advances the global epoch if every registered thread has seen it, then
+   frees this thread's limbo lists that became safe. */
+void epoch_quiescent(void) {
+    EpochThread *self = epoch_self;
+    if (!self) return;
+    uint64_t now = __atomic_load_n(&epoch_global, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&self->local, now, __ATOMIC_SEQ_CST);
+
+    int all_seen = 1;
+    for (int i = 0; i < EPOCH_MAX_THREADS && all_seen; ++i) {
+        EpochThread *t = &epoch_threads[i];
+        if (__atomic_load_n(&t->in_use, __ATOMIC_ACQUIRE) && __atomic_load_n(&t->local, __ATOMIC_ACQUIRE) != now)
+            all_seen = 0;
+    }
+    if (all_seen) __atomic_compare_exchange_n(&epoch_global, &now, now + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    now = __atomic_load_n(&epoch_global, __ATOMIC_ACQUIRE);
+
+    epoch_reclaim(self, now);
+    if (__atomic_load_n(&epoch_orphans.count, __ATOMIC_RELAXED)) {
+        pool_txn_begin();
+        if (epoch_orphans.count && epoch_orphans.epoch + 2 <= now) {
+            epoch_free_batch(epoch_orphans.head);   /* nests in the held transaction */
+            epoch_orphans.head = NULL;
+            epoch_orphans.count = 0;
+        }
+        pool_txn_end();
+    }
+}
+
+/* free p once every registered thread has passed a quiescent point */
+void retire(void *p) {
+    EpochThread *self = epoch_self;
+    if (!p) return;
+    if (!self) {
+        fprintf(stderr, "retire() from an unregistered thread\n");
+        return;
+    }
+    uint64_t now = __atomic_load_n(&epoch_global, __ATOMIC_ACQUIRE);
+    EpochLimbo *l = &self->limbo[now % 3];
+    if (l->count && l->epoch != now) {
+        /* the list still holds epoch now - 3 (or older): safe by now */
+        epoch_free_batch(l->head);
+        l->head = NULL;
+        l->count = 0;
+    }
+    *(void**)p = l->head;
+    l->head = p;
+    l->count++;
+    l->epoch = now;
+}
+
+/* blocks the calling thread has retired that are not freed yet */
+size_t epoch_pending(void) {
+    EpochThread *self = epoch_self;
+    if (!self) return 0;
+    return self->limbo[0].count + self->limbo[1].count + self->limbo[2].count;
+}
+
+/* Free every limbo list and the orphan list now, for pool_close(): once the
+   pool goes away no thread can still hold a reference into it, and the
+   blocks must not outlive it (they would be freed into the next pool, or
+   leak in a file pool). Registrations are kept. Threads must not retire
+   concurrently with pool_close(). */
+static void epoch_drain(void) {
+    pool_txn_begin();
+    for (int t = 0; t < EPOCH_MAX_THREADS; ++t) {
+        for (int i = 0; i < 3; ++i) {
+            EpochLimbo *l = &epoch_threads[t].limbo[i];
+            epoch_free_batch(l->head);
+            l->head = NULL;
+            l->count = 0;
+        }
+    }
+    epoch_free_batch(epoch_orphans.head);
+    epoch_orphans.head = NULL;
+    epoch_orphans.count = 0;
+    pool_txn_end();
+}
+
+/* Stop taking part in reclamation. Blocks still in limbo are handed to a
+   shared orphan list, freed by whichever thread sees the epoch move on. */
+void epoch_unregister(void) {
+    EpochThread *self = epoch_self;
+    if (!self) return;
+    uint64_t now = __atomic_load_n(&epoch_global, __ATOMIC_ACQUIRE);
+    epoch_reclaim(self, now);
+    pool_txn_begin();
+    for (int i = 0; i < 3; ++i) {
+        EpochLimbo *l = &self->limbo[i];
+        while (l->head) {
+            void *next = *(void**)l->head;
+            *(void**)l->head = epoch_orphans.head;
+            epoch_orphans.head = l->head;
+            epoch_orphans.count++;
+            l->head = next;
+        }
+        l->count = 0;
+    }
+    if (epoch_orphans.count) epoch_orphans.epoch = now;
+    pool_txn_end();
+    epoch_self = NULL;
+    __atomic_store_n(&self->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/* ---------- Generation-tagged allocation ---------- */
+/* A generation is an arena: gen_alloc() bump-allocates from chunks (ordinary
+   pool blocks of about GEN_CHUNK_SIZE) chained per generation, and
+   gen_free_all() returns the whole chain to the pool, so dropping a
+   generation costs one free per chunk instead of one per object. Each
+   object carries a 16-byte tag whose layout mirrors Header, so gen_of()
+   reads its generation in O(1) and a stray my_free() on it is rejected as
+   an invalid free. Objects are not freed individually. Like handles, the
+   generation table is process-local. */
+#define GEN_TAG_MAGIC 0x6E7E7A61u
+
+typedef uint32_t gen_t;   /* index + 1, 0 is never a valid generation */
+
+typedef struct gen_tag {
+    size_t size;         /* object size, as Header.size */
+    uint32_t magic;      /* GEN_TAG_MAGIC, where Header has its magic */
+    uint32_t gen;
+} GenTag;
+
+typedef struct gen_chunk {
+    size_t next;         /* pool offset of the next chunk's header, POOL_NIL ends */
+    size_t used;         /* bytes handed out after this struct */
+    size_t cap;
+    size_t pad;
+} GenChunk;
+
+typedef struct gen_state {
+    size_t chunks;       /* chain head (pool offset), POOL_NIL when empty */
+    size_t current;      /* chunk being bump-allocated, POOL_NIL for none */
+    size_t live;         /* objects allocated */
+    int in_use;
+} GenState;
+
+static GenState gen_table[GEN_MAX];
+
+static inline GenChunk* gen_chunk_at(size_t off) {
+    return (GenChunk*)user_from_header(header_from_offset(off));
+}
+
+/* new empty generation; 0 if GEN_MAX are live */
+gen_t gen_create(void) {
+    gen_t gen = 0;
+    pool_txn_begin();
+    for (int i = 0; i < GEN_MAX && !gen; ++i) {
+        GenState *g = &gen_table[i];
+        if (g->in_use) continue;
+        g->chunks = g->current = POOL_NIL;
+        g->live = 0;
+        g->in_use = 1;
+        gen = (gen_t)(i + 1);
+    }
+    pool_txn_end();
+    if (!gen) fprintf(stderr, "Too many generations\n");
+    return gen;
+}
+
+static void* gen_alloc_impl(gen_t gen, size_t size) {
+    if (gen == 0 || gen > GEN_MAX || !gen_table[gen - 1].in_use) return NULL;
+    if (size > POOL_SIZE) return NULL;   /* never fits; rounding it up could also wrap */
+    GenState *g = &gen_table[gen - 1];
+    size_t need = sizeof(GenTag) + ((size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1));
+
+    GenChunk *c = g->current != POOL_NIL ? gen_chunk_at(g->current) : NULL;
+    if (!c || c->used + need > c->cap) {
+        /* objects bigger than a chunk get a chunk of their own and leave the current one be */
+        int dedicated = sizeof(GenChunk) + need > GEN_CHUNK_SIZE;
+        size_t cap = dedicated ? need : GEN_CHUNK_SIZE - sizeof(GenChunk);
+        void *p = first_fit_impl(sizeof(GenChunk) + cap);
+        if (!p) return NULL;
+        c = (GenChunk*)p;
+        c->cap = cap;
+        c->used = 0;
+        c->next = g->chunks;
+        g->chunks = header_offset(header_from_user(p));
+        if (!dedicated) g->current = g->chunks;
+    }
+    GenTag *t = (GenTag*)((char*)(c + 1) + c->used);
+    c->used += need;
+    t->size = size;
+    t->magic = GEN_TAG_MAGIC;
+    t->gen = gen;
+    g->live++;
+    return t + 1;
+}
+
+void* gen_alloc(gen_t gen, size_t size) {
+    pool_txn_begin();
+    void *p = gen_alloc_impl(gen, size);
+    pool_txn_end();
+    return p;
+}
+
+/* generation of an object from gen_alloc(), 0 for anything else */
+gen_t gen_of(const void *p) {
+    const GenTag *t = (const GenTag*)p - 1;
+    return p && t->magic == GEN_TAG_MAGIC ? t->gen : 0;
+}
+
+/* For pool_close(): every open generation becomes invalid, so a gen_t kept
+   across the close allocates nothing instead of chaining chunks of the next
+   pool to offsets from the old one. In a file pool the chunks of open
+   generations stay allocated, like any block the caller did not free. */
+static void gen_reset(void) {
+    memset(gen_table, 0, sizeof(gen_table));
+}
+
+/* Free every object of the generation in one pass over its chunks and
+   retire the generation id. Returns the number of objects dropped. */
+size_t gen_free_all(gen_t gen) {
+    if (gen == 0 || gen > GEN_MAX) return 0;
+    GenState *g = &gen_table[gen - 1];
+    pool_txn_begin();
+    if (!g->in_use) {
+        pool_txn_end();
+        return 0;
+    }
+    size_t off = g->chunks;
+    while (off != POOL_NIL) {
+        size_t next = gen_chunk_at(off)->next;
+        free_impl(gen_chunk_at(off));
+        plog_commit();   /* each chunk free leaves the heap consistent */
+        off = next;
+    }
+    size_t dropped = g->live;
+    g->chunks = g->current = POOL_NIL;
+    g->live = 0;
+    g->in_use = 0;
+    pool_txn_end();
+    return dropped;
+}
+
+/* ---------- Pre-zeroed free blocks ---------- */
+/* Free blocks flagged BLOCK_ZEROED hold zeros past their FreeMeta, so
+   my_calloc() only has to clear the first sizeof(FreeMeta) bytes. Splits
+   keep the flag on the remainder, merges keep it when both sides had it,
+   frees and compaction clear it. pool_zero_step() zeroes large unflagged
+   free blocks from the end down, one ZERO_SLICE per lock hold so allocating
+   threads are never stalled for long; pool_zero_start() runs it on a
+   background thread while the heap is idle. Progress on a block is kept
+   across steps and dropped if the block is allocated, resized, merged
+   away or freed again meanwhile (FreeMeta.reserved1 stamps the block being
+   worked on, and taking a block off the free list clears zero_off). */
+static size_t zero_size = 0;         /* its size when started */
+static size_t zero_mark = 0;         /* payload bytes [sizeof(FreeMeta), zero_mark) still dirty */
+static uintptr_t zero_stamp = 0;
+static pthread_t zero_thread;
+static int zero_running = 0;
+
+static int zero_target_valid(void) {
+    if (zero_off == POOL_NIL) return 0;
+    Header *h = header_from_offset(zero_off);
+    return h->is_free && h->magic == MAGIC_FREE && h->size == zero_size && !(h->flags & BLOCK_ZEROED) &&
+           (uintptr_t)meta_from_header(h)->reserved1 == zero_stamp;
+}
+
+static int zero_pick_target(void) {
+    for (FreeMeta *m = free_list_head(); m; m = meta_next(m)) {
+        Header *h = header_from_meta(m);
+        if ((h->flags & BLOCK_ZEROED) || h->size < ZERO_MIN_BLOCK) continue;
+        plog_block(h);
+        m->reserved1 = (void*)++zero_stamp;
+        zero_off = header_offset(h);
+        zero_size = h->size;
+        zero_mark = h->size;
+        return 1;
+    }
+    zero_off = POOL_NIL;
+    return 0;
+}
+
+/* Zero up to `budget` bytes of free blocks. Returns bytes zeroed; 0 once
+   every large free block is clean. */
+size_t pool_zero_step(size_t budget) {
+    size_t done = 0;
+    while (done < budget) {
+        size_t n = budget - done < ZERO_SLICE ? budget - done : ZERO_SLICE;
+        pool_txn_begin();
+        if (!zero_target_valid() && !zero_pick_target()) {
+            pool_txn_end();
+            break;
+        }
+        Header *h = header_from_offset(zero_off);
+        if (n > zero_mark - sizeof(FreeMeta)) n = zero_mark - sizeof(FreeMeta);
+        memset((char*)user_from_header(h) + zero_mark - n, 0, n);
+        zero_mark -= n;
+        done += n;
+        if (zero_mark == sizeof(FreeMeta)) {
+            plog_block(h);
+            h->flags |= BLOCK_ZEROED;
+            zero_off = POOL_NIL;
+        }
+        pool_txn_end();
+    }
+    return done;
+}
+
+/* free bytes that are currently pre-zeroed */
+size_t pool_zeroed_bytes(void) {
+    size_t total = 0;
+    pool_txn_begin();
+    for (FreeMeta *m = free_list_head(); m; m = meta_next(m)) {
+        Header *h = header_from_meta(m);
+        if (h->flags & BLOCK_ZEROED) total += h->size - sizeof(FreeMeta);
+    }
+    pool_txn_end();
+    return total;
+}
+
+static void* zero_worker(void *arg) {
+    (void)arg;
+    while (__atomic_load_n(&zero_running, __ATOMIC_ACQUIRE)) {
+        if (pool_zero_step(ZERO_SLICE) == 0) {
+            struct timespec idle = { 0, 10 * 1000 * 1000 };
+            nanosleep(&idle, NULL);
+        } else {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/* start the background zeroing thread; returns 0 or -1 */
+int pool_zero_start(void) {
+    if (zero_running) return 0;
+    if (!pool_initialized) init_pool();
+    zero_running = 1;
+    if (pthread_create(&zero_thread, NULL, zero_worker, NULL) != 0) {
+        zero_running = 0;
+        perror("pthread_create");
+        return -1;
+    }
+    return 0;
+}
+
+void pool_zero_stop(void) {
+    if (zero_running) {
+        __atomic_store_n(&zero_running, 0, __ATOMIC_RELEASE);
+        pthread_join(zero_thread, NULL);
+    }
+    zero_off = POOL_NIL;
+}
+
+static void* calloc_impl(size_t n, size_t size) {
+    if (size && n > (size_t)-1 / size) return NULL;
+    size_t bytes = n * size;
+    void *p = first_fit_impl(bytes);
+    if (!p) return NULL;
+    Header *h = header_from_user(p);
+    if (h->flags & BLOCK_ZEROED)
+        memset(p, 0, bytes < sizeof(FreeMeta) ? bytes : sizeof(FreeMeta));
+    else
+        memset(p, 0, bytes);
+    h->flags = 0;
+    return p;
+}
+
+/* zero-filled first-fit allocation; pre-zeroed blocks only clear their FreeMeta bytes */
+void* my_calloc(size_t n, size_t size) {
+    pool_txn_begin();
+    void *p = calloc_impl(n, size);
+    pool_txn_end();
+    return p;
+}
+
+/* ---------- Page table (x86-64 style, 4 levels) ---------- */
+/* A simulated 48-bit virtual address space: four levels of 512 eight-byte
+   entries (PML4, PDPT, PD, PT), with 4 KB leaves at the last level and
+   2 MB / 1 GB leaves (PT_HUGE) at the PD / PDPT levels. Table pages are
+   carved from chunks the buddy allocator hands out, and a non-leaf entry
+   holds its child table as a pool_ref_t in the address field, so a table
+   walk is four dependent loads with no side lookups and the tables are
+   position independent like the rest of the pool. Leaf entries hold the
+   (simulated) physical address. Tables are zeroed on allocation and
+   returned to a per-table-set free list when they become empty. */
+typedef uint64_t pte_t;
+
+#define PT_PRESENT   (1ull << 0)
+#define PT_WRITE     (1ull << 1)
+#define PT_USER      (1ull << 2)
+#define PT_ACCESSED  (1ull << 5)
+#define PT_DIRTY     (1ull << 6)
+#define PT_HUGE      (1ull << 7)    /* 2 MB / 1 GB leaf */
+#define PT_NX        (1ull << 63)
+#define PT_PROT_MASK (PT_WRITE | PT_USER | PT_NX)
+#define PT_ADDR_MASK 0x000FFFFFFFFFF000ull
+
+#define PT_ENTRIES   512
+#define PT_TABLE_SIZE (PT_ENTRIES * sizeof(pte_t))
+#define PT_SHIFT_4K  12
+#define PT_SHIFT_2M  21
+#define PT_SHIFT_1G  30
+
+typedef struct page_table {
+    pool_ref_t root;          /* PML4 */
+    pool_ref_t free_tables;   /* chained through entry 0 */
+    pool_ref_t chunks;        /* buddy chunks, chained through their first word */
+    size_t tables_used;
+} PageTable;
+
+static inline pte_t* pt_table(pool_ref_t r) {
+    return (pte_t*)((char*)pool_base + (size_t)r * POOL_ALIGN);
+}
+static inline pte_t* pt_child(pte_t e) {
+    return pt_table((pool_ref_t)(e >> 12));
+}
+static inline unsigned pt_index(uint64_t va, int level) {   /* level 3 = PML4 ... 0 = PT */
+    return (unsigned)(va >> (PT_SHIFT_4K + 9 * level)) & (PT_ENTRIES - 1);
+}
+
+static pool_ref_t pt_table_alloc(PageTable *pt) {
+    if (!pt->free_tables) {
+        size_t payload = ((size_t)1 << PT_CHUNK_ORDER) - sizeof(Header);
+        size_t n = (payload - POOL_ALIGN) / PT_TABLE_SIZE;
+        if (n == 0) {
+            fprintf(stderr, "Pool too small for page tables\n");
+            return 0;
+        }
+        char *chunk = (char*)malloc_buddy_alloc(payload);
+        if (!chunk) return 0;
+        *(pool_ref_t*)chunk = pt->chunks;
+        pt->chunks = pool_ref_of(chunk);
+        for (size_t i = n; i-- > 0; ) {
+            pte_t *t = (pte_t*)(chunk + POOL_ALIGN + i * PT_TABLE_SIZE);
+            t[0] = pt->free_tables;
+            pt->free_tables = pool_ref_of(t);
+        }
+    }
+    pool_ref_t r = pt->free_tables;
+    pte_t *t = pt_table(r);
+    pt->free_tables = (pool_ref_t)t[0];
+    memset(t, 0, PT_TABLE_SIZE);
+    pt->tables_used++;
+    return r;
+}
+
+static void pt_table_free(PageTable *pt, pool_ref_t r) {
+    pt_table(r)[0] = pt->free_tables;
+    pt->free_tables = r;
+    pt->tables_used--;
+}
+
+static int pt_table_empty(const pte_t *t) {
+    for (int i = 0; i < PT_ENTRIES; ++i)
+        if (t[i] & PT_PRESENT) return 0;
+    return 1;
+}
+
+/* set up an empty address space; returns 0 or -1 */
+int pt_init(PageTable *pt) {
+    memset(pt, 0, sizeof(*pt));
+    if (!pool_initialized) init_pool();
+    pt->root = pt_table_alloc(pt);
+    return pt->root ? 0 : -1;
+}
+
+/* release every table and chunk */
+void pt_destroy(PageTable *pt) {
+    pool_ref_t c = pt->chunks;
+    while (c) {
+        pool_ref_t next = *(pool_ref_t*)pool_ref_ptr(c);
+        my_free(pool_ref_ptr(c));
+        c = next;
+    }
+    memset(pt, 0, sizeof(*pt));
+}
+
+/* Map one page of 4 KB, 2 MB or 1 GB (page_shift 12, 21 or 30) at va -> pa.
+   Both must be aligned to the page size. prot is PT_WRITE | PT_USER | PT_NX.
+   Returns 0, or -1 if the range is already (partly) mapped or out of memory. */
+int pt_map(PageTable *pt, uint64_t va, uint64_t pa, int page_shift, uint64_t prot) {
+    int leaf_level = (page_shift - PT_SHIFT_4K) / 9;
+    if ((page_shift != PT_SHIFT_4K && page_shift != PT_SHIFT_2M && page_shift != PT_SHIFT_1G) ||
+        ((va | pa) & (((uint64_t)1 << page_shift) - 1)) || (pa & ~PT_ADDR_MASK) ||
+        (uint64_t)((int64_t)(va << 16) >> 16) != va) {
+        fprintf(stderr, "Bad page size, alignment or non-canonical address\n");
+        return -1;
+    }
+    pte_t *t = pt_table(pt->root);
+    for (int level = 3; level > leaf_level; --level) {
+        pte_t *e = &t[pt_index(va, level)];
+        if (!(*e & PT_PRESENT)) {
+            pool_ref_t r = pt_table_alloc(pt);
+            if (!r) return -1;
+            *e = ((pte_t)r << 12) | PT_PRESENT | PT_WRITE | PT_USER;
+        } else if (*e & PT_HUGE) {
+            return -1;   /* inside a larger page */
+        }
+        t = pt_child(*e);
+    }
+    pte_t *e = &t[pt_index(va, leaf_level)];
+    if (*e & PT_PRESENT) return -1;   /* mapped, or holds a lower-level table */
+    *e = pa | (prot & PT_PROT_MASK) | PT_PRESENT | (leaf_level ? PT_HUGE : 0);
+    return 0;
+}
+
+/* walk to the leaf entry for va; fills path[] with the entries on the way */
+static pte_t* pt_leaf(PageTable *pt, uint64_t va, pte_t **path, int *leaf_level) {
+    pte_t *t = pt_table(pt->root);
+    for (int level = 3; level >= 0; --level) {
+        pte_t *e = &t[pt_index(va, level)];
+        if (path) path[level] = e;
+        if (!(*e & PT_PRESENT)) return NULL;
+        if (level == 0 || (*e & PT_HUGE)) {
+            if (leaf_level) *leaf_level = level;
+            return e;
+        }
+        t = pt_child(*e);
+    }
+    return NULL;
+}
+
+/* Unmap the page containing va, freeing tables that become empty.
+   Returns the unmapped page's shift, or 0 if nothing was mapped. */
+int pt_unmap(PageTable *pt, uint64_t va) {
+    pte_t *path[4];
+    int level;
+    pte_t *e = pt_leaf(pt, va, path, &level);
+    if (!e) return 0;
+    *e = 0;
+    for (int l = level; l < 3; ++l) {
+        pte_t *t = path[l] - pt_index(va, l);
+        if (!pt_table_empty(t)) break;
+        pt_table_free(pt, (pool_ref_t)(*path[l + 1] >> 12));
+        *path[l + 1] = 0;
+    }
+    return PT_SHIFT_4K + 9 * level;
+}
+
+/* replace the protection bits of the page containing va; 0 or -1 if unmapped */
+int pt_protect(PageTable *pt, uint64_t va, uint64_t prot) {
+    pte_t *e = pt_leaf(pt, va, NULL, NULL);
+    if (!e) return -1;
+    *e = (*e & ~PT_PROT_MASK) | (prot & PT_PROT_MASK);
+    return 0;
+}
+
+/* Translate va. Returns the page shift (12, 21 or 30) and sets *pa and
+   *leaf, or returns 0 if va is unmapped. Inline: this is the simulator's
+   hot path, at most four dependent loads. */
+static inline int pt_translate(const PageTable *pt, uint64_t va, uint64_t *pa, pte_t *leaf) {
+    pte_t e = pt_table(pt->root)[pt_index(va, 3)];
+    if (!(e & PT_PRESENT)) return 0;
+    e = pt_child(e)[pt_index(va, 2)];
+    if (!(e & PT_PRESENT)) return 0;
+    int shift = PT_SHIFT_1G;
+    if (!(e & PT_HUGE)) {
+        e = pt_child(e)[pt_index(va, 1)];
+        if (!(e & PT_PRESENT)) return 0;
+        shift = PT_SHIFT_2M;
+        if (!(e & PT_HUGE)) {
+            e = pt_child(e)[pt_index(va, 0)];
+            if (!(e & PT_PRESENT)) return 0;
+            shift = PT_SHIFT_4K;
+        }
+    }
+    uint64_t off_mask = ((uint64_t)1 << shift) - 1;
+    *pa = (e & PT_ADDR_MASK & ~off_mask) | (va & off_mask);
+    if (leaf) *leaf = e;
+    return shift;
+}
+
+/* ---------- TLB model ---------- */
+/* A set-associative TLB in front of pt_translate(), with one array per page
+   size (4 KB, 2 MB, 1 GB) probed together as on x86 cores. Entries are
+   tagged with the virtual page number and a 12-bit ASID (PCID). Tags of a
+   set are contiguous, padded to the SIMD width, and compared in one go:
+   four per instruction with AVX2, two with SSE4.1, else a scalar loop
+   (chosen at compile time, e.g. -mavx2). A page whose size class has no
+   array (entries == 0) is splintered into the 4 KB array, like hardware
+   that lacks large-page entries. Misses walk the page table and fill. */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TLB_SIMD_LANES 4
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#define TLB_SIMD_LANES 2
+#else
+#define TLB_SIMD_LANES 1
+#endif
+
+#define TLB_SIZES      3            /* 4 KB, 2 MB, 1 GB arrays */
+#define TLB_ASID_MASK  0xFFFull
+#define TLB_TAG_VALID  (1ull << 12)
+
+enum { TLB_LRU = 0, TLB_FIFO = 1, TLB_RANDOM = 2 };
+
+typedef struct tlb_config {
+    uint32_t entries;   /* 0 disables the array */
+    uint32_t ways;      /* entries / ways sets, a power of two */
+} TlbConfig;
+
+typedef struct tlb_array {
+    uint32_t sets, ways, stride;   /* stride: ways rounded up to TLB_SIMD_LANES */
+    uint64_t *tags;                /* sets * stride, 0 = invalid */
+    uint64_t *frames;              /* physical page base */
+    uint64_t *stamps;              /* LRU: last use, FIFO: fill time */
+    uint64_t hits;
+} TlbArray;
+
+typedef struct tlb {
+    TlbArray arr[TLB_SIZES];
+    int policy;
+    uint64_t clock;
+    uint64_t rng;
+    uint64_t lookups, hits, walks, faults;
+    void *mem;
+    size_t mem_len;
+} Tlb;
+
+static const int tlb_shift[TLB_SIZES] = { PT_SHIFT_4K, PT_SHIFT_2M, PT_SHIFT_1G };
+
+static inline uint64_t tlb_tag(uint64_t va, int shift, uint16_t asid) {
+    return (((va & 0x0000FFFFFFFFFFFFull) >> shift) << 16) | TLB_TAG_VALID | (asid & TLB_ASID_MASK);
+}
+
+/* way of `tag` within one set, -1 if absent */
+static inline int tlb_match(const uint64_t *tags, uint32_t stride, uint64_t tag) {
+#if TLB_SIMD_LANES == 4
+    __m256i key = _mm256_set1_epi64x((long long)tag);
+    for (uint32_t i = 0; i < stride; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(tags + i));
+        int m = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, key)));
+        if (m) return (int)i + __builtin_ctz((unsigned)m);
+    }
+#elif TLB_SIMD_LANES == 2
+    __m128i key = _mm_set1_epi64x((long long)tag);
+    for (uint32_t i = 0; i < stride; i += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(tags + i));
+        int m = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v, key)));
+        if (m) return (int)i + __builtin_ctz((unsigned)m);
+    }
+#else
+    for (uint32_t i = 0; i < stride; ++i)
+        if (tags[i] == tag) return (int)i;
+#endif
+    return -1;
+}
+
+/* Set up the arrays from cfg[4K, 2M, 1G] with a TLB_* replacement policy.
+   Returns 0, or -1 on a bad geometry or if the arrays cannot be mapped. */
+int tlb_init(Tlb *t, const TlbConfig cfg[TLB_SIZES], int policy) {
+    memset(t, 0, sizeof(*t));
+    size_t total = 0;
+    for (int i = 0; i < TLB_SIZES; ++i) {
+        if (cfg[i].entries == 0) continue;
+        uint32_t sets = cfg[i].ways ? cfg[i].entries / cfg[i].ways : 0;
+        if (!sets || sets * cfg[i].ways != cfg[i].entries || (sets & (sets - 1))) {
+            fprintf(stderr, "TLB entries / ways must be a power of two\n");
+            return -1;
+        }
+        TlbArray *a = &t->arr[i];
+        a->sets = sets;
+        a->ways = cfg[i].ways;
+        a->stride = (cfg[i].ways + TLB_SIMD_LANES - 1) / TLB_SIMD_LANES * TLB_SIMD_LANES;
+        total += (size_t)sets * a->stride * 3 * sizeof(uint64_t);
+    }
+    if (total == 0) {
+        fprintf(stderr, "TLB has no entries\n");
+        return -1;
+    }
+    void *p = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    uint64_t *cur = (uint64_t*)p;
+    for (int i = 0; i < TLB_SIZES; ++i) {
+        TlbArray *a = &t->arr[i];
+        size_t n = (size_t)a->sets * a->stride;
+        a->tags = cur;
+        a->frames = cur + n;
+        a->stamps = cur + 2 * n;
+        cur += 3 * n;
+    }
+    t->policy = policy;
+    t->rng = 0x9E3779B97F4A7C15ull;
+    t->mem = p;
+    t->mem_len = total;
+    return 0;
+}
+
+void tlb_destroy(Tlb *t) {
+    if (t->mem) munmap(t->mem, t->mem_len);
+    memset(t, 0, sizeof(*t));
+}
+
+static void tlb_fill(Tlb *t, TlbArray *a, uint64_t tag, uint64_t frame, uint64_t vpn) {
+    uint32_t set = (uint32_t)(vpn & (a->sets - 1));
+    uint64_t *tags = a->tags + (size_t)set * a->stride;
+    uint64_t *stamps = a->stamps + (size_t)set * a->stride;
+    uint32_t victim = a->ways;
+    for (uint32_t w = 0; w < a->ways && victim == a->ways; ++w)
+        if (!tags[w]) victim = w;   /* invalid entries first */
+    if (victim == a->ways && t->policy == TLB_RANDOM) {
+        t->rng ^= t->rng << 13;
+        t->rng ^= t->rng >> 7;
+        t->rng ^= t->rng << 17;
+        victim = (uint32_t)(t->rng % a->ways);
+    } else if (victim == a->ways) {
+        victim = 0;
+        for (uint32_t w = 1; w < a->ways; ++w)
+            if (stamps[w] < stamps[victim]) victim = w;
+    }
+    tags[victim] = tag;
+    a->frames[(size_t)set * a->stride + victim] = frame;
+    stamps[victim] = ++t->clock;
+}
+
+/* Translate va for address space `asid` through the TLB, walking `pt` on a
+   miss. Returns the page shift and sets *pa, or 0 for a page fault. */
+static inline int tlb_translate(Tlb *t, const PageTable *pt, uint64_t va, uint16_t asid, uint64_t *pa) {
+    t->lookups++;
+    for (int i = 0; i < TLB_SIZES; ++i) {
+        TlbArray *a = &t->arr[i];
+        if (!a->sets) continue;
+        uint64_t tag = tlb_tag(va, tlb_shift[i], asid);
+        uint64_t vpn = (va & 0x0000FFFFFFFFFFFFull) >> tlb_shift[i];
+        size_t base = (size_t)(vpn & (a->sets - 1)) * a->stride;
+        int w = tlb_match(a->tags + base, a->stride, tag);
+        if (w >= 0) {
+            if (t->policy == TLB_LRU) a->stamps[base + w] = ++t->clock;
+            a->hits++;
+            t->hits++;
+            *pa = a->frames[base + w] | (va & (((uint64_t)1 << tlb_shift[i]) - 1));
+            return tlb_shift[i];
+        }
+    }
+    t->walks++;
+    int shift = pt_translate(pt, va, pa, NULL);
+    if (!shift) {
+        t->faults++;
+        return 0;
+    }
+    int cls = (shift - PT_SHIFT_4K) / 9;
+    if (!t->arr[cls].sets) {
+        cls = 0;   /* splinter into 4 KB entries */
+        if (!t->arr[0].sets) return shift;
+    }
+    int fs = tlb_shift[cls];
+    uint64_t vpn = (va & 0x0000FFFFFFFFFFFFull) >> fs;
+    tlb_fill(t, &t->arr[cls], tlb_tag(va, fs, asid), *pa & ~(((uint64_t)1 << fs) - 1), vpn);
+    return shift;
+}
+
+/* drop every entry, or only those of one ASID */
+void tlb_flush(Tlb *t) {
+    for (int i = 0; i < TLB_SIZES; ++i)
+        memset(t->arr[i].tags, 0, (size_t)t->arr[i].sets * t->arr[i].stride * sizeof(uint64_t));
+}
+
+void tlb_flush_asid(Tlb *t, uint16_t asid) {
+    for (int i = 0; i < TLB_SIZES; ++i) {
+        TlbArray *a = &t->arr[i];
+        for (size_t k = 0; k < (size_t)a->sets * a->stride; ++k)
+            if (a->tags[k] && (a->tags[k] & TLB_ASID_MASK) == (asid & TLB_ASID_MASK)) a->tags[k] = 0;
+    }
+}
+
+/* drop the entry covering va in `asid` (invlpg), whatever its page size */
+void tlb_invalidate(Tlb *t, uint64_t va, uint16_t asid) {
+    for (int i = 0; i < TLB_SIZES; ++i) {
+        TlbArray *a = &t->arr[i];
+        if (!a->sets) continue;
+        uint64_t vpn = (va & 0x0000FFFFFFFFFFFFull) >> tlb_shift[i];
+        size_t base = (size_t)(vpn & (a->sets - 1)) * a->stride;
+        int w = tlb_match(a->tags + base, a->stride, tlb_tag(va, tlb_shift[i], asid));
+        if (w >= 0) a->tags[base + w] = 0;
+    }
+}
+
+/* ---------- Page replacement engine ---------- */
+/* A physical-frame manager with interchangeable replacement policies, for
+   comparing fault counts on one reference trace. A page -> slot hash
+   (linear probing, backward-shift deletion) finds resident pages; every
+   policy is O(1) or O(log frames) per reference:
+     FIFO   a hand over the frames, which fill in order
+     LRU    intrusive doubly-linked list, most recent at the head
+     CLOCK  reference bitmap scanned a 64-bit word at a time
+     LFU    min-heap on (use count, last use)
+     ARC    T1/T2/B1/B2 intrusive lists over 2 * frames directory nodes
+     OPT    max-heap on next use, from indices precomputed by repl_set_future()
+   All state lives in one anonymous mapping made by repl_init(). */
+enum { REPL_FIFO = 0, REPL_LRU, REPL_CLOCK, REPL_LFU, REPL_ARC, REPL_OPT, REPL_POLICIES };
+
+#define REPL_NONE  0xFFFFFFFFu
+#define REPL_NEVER UINT64_MAX   /* next use of a page that is not referenced again */
+#define REPL_NO_PAGE UINT64_MAX /* no victim; page numbers must be below this */
+
+enum { ARC_T1 = 0, ARC_T2, ARC_B1, ARC_B2 };
+
+typedef struct repl_engine {
+    int policy;
+    uint32_t frames;
+    uint32_t used;             /* frames holding a page */
+    uint64_t accesses, faults, evictions;
+    uint32_t frame;            /* frame of the page just referenced */
+    uint64_t victim;           /* page evicted by that reference, or REPL_NO_PAGE */
+
+    uint64_t *hkeys;           /* page + 1, 0 = empty */
+    uint32_t *hvals;           /* slot: frame, or ARC directory node */
+    uint64_t hmask;
+    int hbits;
+
+    uint64_t *page;            /* per slot */
+    uint32_t *prev, *next;     /* lists; sentinels follow the slots */
+    uint32_t hand;             /* FIFO, CLOCK */
+    uint64_t *refbits;         /* CLOCK */
+    uint32_t *heap, *heap_pos; /* LFU, OPT */
+    uint64_t *k1, *k2;         /* heap keys, compared lexicographically */
+    uint32_t heap_n;
+    uint64_t tick;
+
+    uint8_t *arc_list;         /* ARC_* of each node */
+    uint32_t *arc_frame;
+    uint32_t *free_nodes, free_nodes_n;
+    uint32_t *free_frames, free_frames_n;
+    uint32_t arc_len[4];
+    uint32_t arc_p;            /* target size of T1 */
+
+    uint64_t *next_use;        /* OPT: per trace position */
+    size_t future_n, pos;
+
+    void *mem, *future_mem;
+    size_t mem_len, future_len;
+} ReplEngine;
+
+static const char *const repl_names[REPL_POLICIES] = { "FIFO", "LRU", "CLOCK", "LFU", "ARC", "OPT" };
+
+const char* repl_name(int policy) {
+    return policy >= 0 && policy < REPL_POLICIES ? repl_names[policy] : "?";
+}
+
+static inline uint64_t repl_hash(const ReplEngine *e, uint64_t page) {
+    return (page * 0x9E3779B97F4A7C15ull) >> (64 - e->hbits);
+}
+
+static inline uint32_t repl_lookup(const ReplEngine *e, uint64_t page) {
+    for (uint64_t i = repl_hash(e, page); e->hkeys[i]; i = (i + 1) & e->hmask)
+        if (e->hkeys[i] == page + 1) return e->hvals[i];
+    return REPL_NONE;
+}
+
+/* start loading the hash slot of a page that will be referenced soon */
+static inline void repl_prefetch(const ReplEngine *e, uint64_t page) {
+    __builtin_prefetch(&e->hkeys[repl_hash(e, page)]);
+    __builtin_prefetch(&e->hvals[repl_hash(e, page)]);
+}
+
+static void repl_hash_put(ReplEngine *e, uint64_t page, uint32_t slot) {
+    uint64_t i = repl_hash(e, page);
+    while (e->hkeys[i] && e->hkeys[i] != page + 1) i = (i + 1) & e->hmask;
+    e->hkeys[i] = page + 1;
+    e->hvals[i] = slot;
+}
+
+static void repl_hash_del(ReplEngine *e, uint64_t page) {
+    uint64_t i = repl_hash(e, page);
+    while (e->hkeys[i] != page + 1) {
+        if (!e->hkeys[i]) return;
+        i = (i + 1) & e->hmask;
+    }
+    /* backward shift: pull later entries of the cluster into the hole */
+    for (uint64_t j = i;;) {
+        j = (j + 1) & e->hmask;
+        if (!e->hkeys[j]) break;
+        uint64_t k = repl_hash(e, e->hkeys[j] - 1);
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) continue;
+        e->hkeys[i] = e->hkeys[j];
+        e->hvals[i] = e->hvals[j];
+        i = j;
+    }
+    e->hkeys[i] = 0;
+}
+
+/* circular lists with sentinel nodes */
+static inline void repl_unlink(ReplEngine *e, uint32_t n) {
+    e->next[e->prev[n]] = e->next[n];
+    e->prev[e->next[n]] = e->prev[n];
+}
+static inline void repl_push_head(ReplEngine *e, uint32_t head, uint32_t n) {
+    e->prev[n] = head;
+    e->next[n] = e->next[head];
+    e->prev[e->next[head]] = n;
+    e->next[head] = n;
+}
+
+/* min-heap of frames on (k1, k2) */
+static inline int repl_less(const ReplEngine *e, uint32_t a, uint32_t b) {
+    return e->k1[a] < e->k1[b] || (e->k1[a] == e->k1[b] && e->k2[a] < e->k2[b]);
+}
+static inline void repl_heap_set(ReplEngine *e, uint32_t i, uint32_t f) {
+    e->heap[i] = f;
+    e->heap_pos[f] = i;
+}
+static void repl_sift_up(ReplEngine *e, uint32_t i) {
+    uint32_t f = e->heap[i];
+    while (i > 0 && repl_less(e, f, e->heap[(i - 1) / 2])) {
+        repl_heap_set(e, i, e->heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    repl_heap_set(e, i, f);
+}
+static void repl_sift_down(ReplEngine *e, uint32_t i) {
+    uint32_t f = e->heap[i];
+    for (;;) {
+        uint32_t c = 2 * i + 1;
+        if (c >= e->heap_n) break;
+        if (c + 1 < e->heap_n && repl_less(e, e->heap[c + 1], e->heap[c])) c++;
+        if (!repl_less(e, e->heap[c], f)) break;
+        repl_heap_set(e, i, e->heap[c]);
+        i = c;
+    }
+    repl_heap_set(e, i, f);
+}
+
+static void* repl_carve(char **cur, size_t bytes) {
+    void *p = *cur;
+    *cur += (bytes + 63) & ~(size_t)63;
+    return p;
+}
+
+/* Set up `frames` empty frames managed by a REPL_* policy. Returns 0 or -1. */
+int repl_init(ReplEngine *e, uint32_t frames, int policy) {
+    memset(e, 0, sizeof(*e));
+    if (frames == 0 || frames > REPL_NONE / 4 || policy < 0 || policy >= REPL_POLICIES) {
+        fprintf(stderr, "Bad frame count or replacement policy\n");
+        return -1;
+    }
+    size_t slots = policy == REPL_ARC ? 2 * (size_t)frames : frames;
+    e->hbits = 2;
+    while (((size_t)1 << e->hbits) < 2 * slots) e->hbits++;
+    size_t hsize = (size_t)1 << e->hbits;
+    size_t words = (frames + 63) / 64;
+    size_t len = hsize * 12 + slots * 8 + (slots + 4) * 8 + words * 8 + (size_t)frames * 24 +
+                 slots * 9 + (size_t)frames * 4 + 64 * 16;
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    char *cur = (char*)p;
+    e->hkeys = (uint64_t*)repl_carve(&cur, hsize * 8);
+    e->hvals = (uint32_t*)repl_carve(&cur, hsize * 4);
+    e->page = (uint64_t*)repl_carve(&cur, slots * 8);
+    e->prev = (uint32_t*)repl_carve(&cur, (slots + 4) * 4);
+    e->next = (uint32_t*)repl_carve(&cur, (slots + 4) * 4);
+    e->refbits = (uint64_t*)repl_carve(&cur, words * 8);
+    e->heap = (uint32_t*)repl_carve(&cur, (size_t)frames * 4);
+    e->heap_pos = (uint32_t*)repl_carve(&cur, (size_t)frames * 4);
+    e->k1 = (uint64_t*)repl_carve(&cur, (size_t)frames * 8);
+    e->k2 = (uint64_t*)repl_carve(&cur, (size_t)frames * 8);
+    e->arc_list = (uint8_t*)repl_carve(&cur, slots);
+    e->arc_frame = (uint32_t*)repl_carve(&cur, slots * 4);
+    e->free_nodes = (uint32_t*)repl_carve(&cur, slots * 4);
+    e->free_frames = (uint32_t*)repl_carve(&cur, (size_t)frames * 4);
+    e->mem = p;
+    e->mem_len = len;
+    e->hmask = hsize - 1;
+    e->policy = policy;
+    e->frames = frames;
+
+    /* sentinels: LRU uses slots, ARC uses slots .. slots + 3 */
+    for (uint32_t s = 0; s < 4; ++s) {
+        uint32_t n = (uint32_t)slots + s;
+        e->prev[n] = e->next[n] = n;
+    }
+    for (uint32_t i = 0; i < slots; ++i) e->free_nodes[e->free_nodes_n++] = (uint32_t)slots - 1 - i;
+    for (uint32_t i = 0; i < frames; ++i) e->free_frames[e->free_frames_n++] = frames - 1 - i;
+    return 0;
+}
+
+/* Precompute next-use indices for OPT; repl_access() must then be fed
+   exactly this trace, in order. Returns 0 or -1. */
+int repl_set_future(ReplEngine *e, const uint64_t *trace, size_t n) {
+    int bits = 2;
+    while (((size_t)1 << bits) < 2 * n) bits++;
+    size_t hsize = (size_t)1 << bits;
+    size_t len = n * 8 + hsize * 16;
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    uint64_t *next_use = (uint64_t*)p;
+    uint64_t *keys = next_use + n;      /* page + 1 */
+    uint64_t *last = keys + hsize;      /* its next position */
+    for (size_t i = n; i-- > 0; ) {
+        uint64_t h = (trace[i] * 0x9E3779B97F4A7C15ull) >> (64 - bits);
+        while (keys[h] && keys[h] != trace[i] + 1) h = (h + 1) & (hsize - 1);
+        next_use[i] = keys[h] ? last[h] : REPL_NEVER;
+        keys[h] = trace[i] + 1;
+        last[h] = i;
+    }
+    /* the scratch table is not needed any more */
+    size_t keep = (n * 8 + POOL_PAGE_SIZE - 1) & ~(size_t)(POOL_PAGE_SIZE - 1);
+    if (keep < len) munmap((char*)p + keep, len - keep);
+    if (e->future_mem) munmap(e->future_mem, e->future_len);
+    e->future_mem = p;
+    e->future_len = keep < len ? keep : len;
+    e->next_use = next_use;
+    e->future_n = n;
+    e->pos = 0;
+    return 0;
+}
+
+void repl_destroy(ReplEngine *e) {
+    if (e->mem) munmap(e->mem, e->mem_len);
+    if (e->future_mem) munmap(e->future_mem, e->future_len);
+    memset(e, 0, sizeof(*e));
+}
+
+/* CLOCK: first frame at or after the hand with a clear reference bit,
+   clearing the bits the hand sweeps past (second chance) */
+static uint32_t repl_clock_victim(ReplEngine *e) {
+    uint32_t last_word = (e->frames - 1) / 64;
+    uint64_t last_mask = (e->frames % 64) ? ((uint64_t)1 << (e->frames % 64)) - 1 : ~(uint64_t)0;
+    for (;;) {
+        uint32_t w = e->hand / 64;
+        uint64_t mask = ~(uint64_t)0 << (e->hand % 64);
+        if (w == last_word) mask &= last_mask;
+        uint64_t clear = ~e->refbits[w] & mask;
+        if (clear) {
+            uint32_t f = w * 64 + (uint32_t)__builtin_ctzll(clear);
+            e->refbits[w] &= ~(mask & (((uint64_t)1 << (f % 64)) - 1));
+            e->hand = f + 1 == e->frames ? 0 : f + 1;
+            return f;
+        }
+        e->refbits[w] &= ~mask;
+        e->hand = w == last_word ? 0 : (w + 1) * 64;
+    }
+}
+
+/* ARC: make room by demoting T1's or T2's LRU page to its ghost list */
+static void arc_replace(ReplEngine *e, int hit_in_b2) {
+    uint32_t slots = 2 * e->frames;
+    int from, to;
+    if (e->arc_len[ARC_T1] > 0 &&
+        ((hit_in_b2 && e->arc_len[ARC_T1] == e->arc_p) || e->arc_len[ARC_T1] > e->arc_p)) {
+        from = ARC_T1;
+        to = ARC_B1;
+    } else {
+        from = ARC_T2;
+        to = ARC_B2;
+    }
+    uint32_t n = e->prev[slots + from];
+    repl_unlink(e, n);
+    e->arc_len[from]--;
+    repl_push_head(e, slots + to, n);
+    e->arc_len[to]++;
+    e->arc_list[n] = (uint8_t)to;
+    e->victim = e->page[n];
+    e->free_frames[e->free_frames_n++] = e->arc_frame[n];
+    e->used--;
+    e->evictions++;
+}
+
+/* ARC: forget a directory node entirely */
+static void arc_drop(ReplEngine *e, int list) {
+    uint32_t n = e->prev[2 * e->frames + list];
+    repl_unlink(e, n);
+    e->arc_len[list]--;
+    repl_hash_del(e, e->page[n]);
+    if (list == ARC_T1) {
+        e->victim = e->page[n];
+        e->free_frames[e->free_frames_n++] = e->arc_frame[n];
+        e->used--;
+        e->evictions++;
+    }
+    e->free_nodes[e->free_nodes_n++] = n;
+}
+
+static int arc_access(ReplEngine *e, uint64_t page) {
+    uint32_t slots = 2 * e->frames, c = e->frames;
+    uint32_t n = repl_lookup(e, page);
+    if (n != REPL_NONE && e->arc_list[n] <= ARC_T2) {
+        repl_unlink(e, n);
+        e->arc_len[e->arc_list[n]]--;
+        repl_push_head(e, slots + ARC_T2, n);
+        e->arc_len[ARC_T2]++;
+        e->arc_list[n] = ARC_T2;
+        e->frame = e->arc_frame[n];
+        return 1;
+    }
+    e->faults++;
+    uint32_t *len = e->arc_len;
+    if (n != REPL_NONE) {
+        int in_b1 = e->arc_list[n] == ARC_B1;
+        if (in_b1) {
+            uint32_t d = len[ARC_B2] / len[ARC_B1];
+            e->arc_p = e->arc_p + (d > 1 ? d : 1) < c ? e->arc_p + (d > 1 ? d : 1) : c;
+        } else {
+            uint32_t d = len[ARC_B1] / len[ARC_B2];
+            d = d > 1 ? d : 1;
+            e->arc_p = e->arc_p > d ? e->arc_p - d : 0;
+        }
+        arc_replace(e, !in_b1);
+        repl_unlink(e, n);
+        len[e->arc_list[n]]--;
+        repl_push_head(e, slots + ARC_T2, n);
+        len[ARC_T2]++;
+        e->arc_list[n] = ARC_T2;
+    } else {
+        if (len[ARC_T1] + len[ARC_B1] == c) {
+            if (len[ARC_T1] < c) {
+                arc_drop(e, ARC_B1);
+                arc_replace(e, 0);
+            } else {
+                arc_drop(e, ARC_T1);
+            }
+        } else if (len[ARC_T1] + len[ARC_T2] + len[ARC_B1] + len[ARC_B2] >= c) {
+            if (len[ARC_T1] + len[ARC_T2] + len[ARC_B1] + len[ARC_B2] == 2 * c) arc_drop(e, ARC_B2);
+            arc_replace(e, 0);
+        }
+        n = e->free_nodes[--e->free_nodes_n];
+        e->page[n] = page;
+        repl_hash_put(e, page, n);
+        repl_push_head(e, slots + ARC_T1, n);
+        len[ARC_T1]++;
+        e->arc_list[n] = ARC_T1;
+    }
+    e->arc_frame[n] = e->free_frames[--e->free_frames_n];
+    e->frame = e->arc_frame[n];
+    e->used++;
+    return 0;
+}
+
+/* Reference `page`. Returns 1 on a hit, 0 on a fault (the page is loaded,
+   evicting a victim if all frames are in use), -1 if OPT ran past its trace.
+   e->frame and e->victim tell a caller which mappings to update; a loaded
+   page always takes over its victim's frame. */
+int repl_access(ReplEngine *e, uint64_t page) {
+    e->accesses++;
+    e->tick++;
+    e->victim = REPL_NO_PAGE;
+    if (e->policy == REPL_ARC) return arc_access(e, page);
+    uint64_t next = 0;
+    if (e->policy == REPL_OPT) {
+        if (e->pos >= e->future_n) {
+            fprintf(stderr, "OPT needs the trace from repl_set_future()\n");
+            return -1;
+        }
+        next = e->next_use[e->pos++];
+    }
+
+    uint32_t f = repl_lookup(e, page);
+    if (f != REPL_NONE) {
+        e->frame = f;
+        switch (e->policy) {
+        case REPL_LRU:
+            repl_unlink(e, f);
+            repl_push_head(e, e->frames, f);
+            break;
+        case REPL_CLOCK:
+            e->refbits[f / 64] |= (uint64_t)1 << (f % 64);
+            break;
+        case REPL_LFU:
+            e->k1[f]++;
+            e->k2[f] = e->tick;
+            repl_sift_down(e, e->heap_pos[f]);
+            break;
+        case REPL_OPT:
+            e->k1[f] = ~next;   /* later next use: smaller key */
+            repl_sift_up(e, e->heap_pos[f]);
+            break;
+        }
+        return 1;
+    }
+
+    e->faults++;
+    int fresh = e->used < e->frames;
+    if (fresh) {
+        f = e->used++;
+    } else {
+        switch (e->policy) {
+        case REPL_FIFO:
+            f = e->hand;
+            e->hand = f + 1 == e->frames ? 0 : f + 1;
+            break;
+        case REPL_LRU:
+            f = e->prev[e->frames];
+            repl_unlink(e, f);
+            break;
+        case REPL_CLOCK:
+            f = repl_clock_victim(e);
+            break;
+        default:   /* LFU, OPT: heap minimum */
+            f = e->heap[0];
+            break;
+        }
+        repl_hash_del(e, e->page[f]);
+        e->victim = e->page[f];
+        e->evictions++;
+    }
+    e->frame = f;
+    e->page[f] = page;
+    repl_hash_put(e, page, f);
+    switch (e->policy) {
+    case REPL_LRU:
+        repl_push_head(e, e->frames, f);
+        break;
+    case REPL_CLOCK:
+        e->refbits[f / 64] |= (uint64_t)1 << (f % 64);
+        break;
+    case REPL_LFU:
+    case REPL_OPT:
+        e->k1[f] = e->policy == REPL_LFU ? 1 : ~next;
+        e->k2[f] = e->tick;
+        if (fresh) {
+            repl_heap_set(e, e->heap_n++, f);
+            repl_sift_up(e, e->heap_pos[f]);
+        } else {
+            repl_sift_down(e, 0);
+        }
+        break;
+    }
+    return 0;
+}
+
+/* faults of one policy over a whole trace, (size_t)-1 on error */
+size_t repl_run(int policy, uint32_t frames, const uint64_t *trace, size_t n) {
+    ReplEngine e;
+    if (repl_init(&e, frames, policy) != 0) return (size_t)-1;
+    if (policy == REPL_OPT && repl_set_future(&e, trace, n) != 0) {
+        repl_destroy(&e);
+        return (size_t)-1;
+    }
+    for (size_t i = 0; i < n; ++i) repl_access(&e, trace[i]);
+    size_t faults = e.faults;
+    repl_destroy(&e);
+    return faults;
+}
+
+/* ---------- Stack distances (Mattson) ---------- */
+/* One pass over a trace gives the miss count of a fully associative LRU
+   memory or TLB of every size at once: a reference hits in an LRU cache
+   of C pages exactly when its stack distance (distinct pages touched
+   since the previous reference to the same page, plus one) is <= C.
+   Distances come from a Fenwick tree over time slots holding one marker
+   per page, at its last reference: the distance is the number of markers
+   after that slot, O(log window). When the window fills, the markers are
+   renumbered in order into its front (doubling it if more than half are
+   live), so unbounded streams need memory proportional only to their
+   distinct pages. */
+#define SD_COLD  0                 /* distance of a first reference */
+#define SD_ERROR UINT64_MAX
+
+typedef struct stack_dist {
+    uint64_t *hist;                /* hist[d]: references at distance d, 1 <= d <= max_dist */
+    uint32_t max_dist;
+    uint64_t refs, cold, beyond;   /* beyond: distance > max_dist */
+    uint64_t last_page;
+
+    uint64_t *hkeys, *htime;       /* page + 1 -> slot of its last reference */
+    uint64_t hmask;
+    int hbits;
+    uint64_t pages;                /* distinct pages = live markers */
+
+    uint32_t *fen;                 /* Fenwick tree over slots, 1-based */
+    uint64_t *owner;               /* page + 1 whose marker is in a slot, 0 = none */
+    uint64_t window, now;
+
+    size_t hist_len, hash_len, win_len;
+} StackDist;
+
+static void* sd_map(size_t len) {
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    return p;
+}
+
+static inline uint64_t sd_hash(const StackDist *s, uint64_t page) {
+    return (page * 0x9E3779B97F4A7C15ull) >> (64 - s->hbits);
+}
+
+/* slot of page's hash entry: its own, or the empty one it would take */
+static inline uint64_t sd_find(const StackDist *s, uint64_t page) {
+    uint64_t i = sd_hash(s, page);
+    while (s->hkeys[i] && s->hkeys[i] != page + 1) i = (i + 1) & s->hmask;
+    return i;
+}
+
+static int sd_map_hash(StackDist *s, int bits) {
+    size_t n = (size_t)1 << bits;
+    uint64_t *keys = (uint64_t*)sd_map(n * 16);
+    if (!keys) return -1;
+    uint64_t *old_keys = s->hkeys, *old_time = s->htime;
+    size_t old_n = s->hkeys ? (size_t)s->hmask + 1 : 0, old_len = s->hash_len;
+    s->hkeys = keys;
+    s->htime = keys + n;
+    s->hmask = n - 1;
+    s->hbits = bits;
+    s->hash_len = n * 16;
+    for (size_t i = 0; i < old_n; ++i) {
+        if (!old_keys[i]) continue;
+        uint64_t j = sd_find(s, old_keys[i] - 1);
+        s->hkeys[j] = old_keys[i];
+        s->htime[j] = old_time[i];
+    }
+    if (old_keys) munmap(old_keys, old_len);
+    return 0;
+}
+
+static inline void sd_fen_add(StackDist *s, uint64_t slot, uint32_t delta) {
+    for (uint64_t i = slot + 1; i <= s->window; i += i & (0 - i)) s->fen[i] += delta;
+}
+
+static inline uint64_t sd_fen_prefix(const StackDist *s, uint64_t slot) {   /* markers in [0, slot] */
+    uint64_t sum = 0;
+    for (uint64_t i = slot + 1; i; i &= i - 1) sum += s->fen[i];
+    return sum;
+}
+
+/* move the live markers to slots 0 .. pages-1, keeping their order */
+static int sd_compact(StackDist *s) {
+    uint64_t *owner = s->owner;
+    uint32_t *fen = s->fen;
+    uint64_t window = s->window;
+    size_t win_len = s->win_len;
+    if (s->pages * 2 > s->window) {
+        window = s->window * 2;
+        win_len = (size_t)window * 8 + ((size_t)window + 1) * 4;
+        owner = (uint64_t*)sd_map(win_len);
+        if (!owner) return -1;
+        fen = (uint32_t*)(owner + window);
+    }
+    uint64_t k = 0;
+    for (uint64_t t = 0; t < s->now; ++t) {
+        if (!s->owner[t]) continue;
+        uint64_t page = s->owner[t] - 1;
+        s->htime[sd_find(s, page)] = k;
+        owner[k++] = page + 1;
+    }
+    if (owner != s->owner) {
+        munmap(s->owner, s->win_len);
+    } else {
+        memset(owner + k, 0, (size_t)(window - k) * 8);
+    }
+    /* Fenwick node i covers slots (i - lowbit(i), i]; the first k are set */
+    for (uint64_t i = 1; i <= window; ++i) {
+        uint64_t lo = i - (i & (0 - i));
+        fen[i] = (uint32_t)(i <= k ? i - lo : lo < k ? k - lo : 0);
+    }
+    s->owner = owner;
+    s->fen = fen;
+    s->window = window;
+    s->win_len = win_len;
+    s->now = k;
+    return 0;
+}
+
+/* Track distances up to max_dist exactly; longer ones are only counted.
+   Returns 0, or -1 if the tables cannot be mapped. */
+int sd_init(StackDist *s, uint32_t max_dist) {
+    memset(s, 0, sizeof(*s));
+    s->max_dist = max_dist;
+    s->last_page = UINT64_MAX;
+    s->hist_len = ((size_t)max_dist + 1) * 8;
+    s->hist = (uint64_t*)sd_map(s->hist_len);
+    s->window = 1 << 16;
+    s->win_len = (size_t)s->window * 8 + ((size_t)s->window + 1) * 4;
+    s->owner = (uint64_t*)sd_map(s->win_len);
+    if (!s->hist || !s->owner || sd_map_hash(s, 16) != 0) {
+        if (s->hist) munmap(s->hist, s->hist_len);
+        if (s->owner) munmap(s->owner, s->win_len);
+        memset(s, 0, sizeof(*s));
+        return -1;
+    }
+    s->fen = (uint32_t*)(s->owner + s->window);
+    return 0;
+}
+
+void sd_destroy(StackDist *s) {
+    if (s->hist) munmap(s->hist, s->hist_len);
+    if (s->hkeys) munmap(s->hkeys, s->hash_len);
+    if (s->owner) munmap(s->owner, s->win_len);
+    memset(s, 0, sizeof(*s));
+}
+
+/* Reference `page` (below UINT64_MAX). Returns its stack distance, SD_COLD
+   for a first reference, or SD_ERROR if the tables could not grow. */
+uint64_t sd_access(StackDist *s, uint64_t page) {
+    if (page == s->last_page) {   /* the top of the stack stays put */
+        s->refs++;
+        if (s->max_dist) s->hist[1]++;
+        else s->beyond++;
+        return 1;
+    }
+    if (s->now == s->window && sd_compact(s) != 0) return SD_ERROR;
+    if (s->pages * 2 >= s->hmask && sd_map_hash(s, s->hbits + 1) != 0) return SD_ERROR;
+    s->refs++;
+    s->last_page = page;
+
+    uint64_t h = sd_find(s, page), d;
+    if (s->hkeys[h]) {
+        uint64_t t = s->htime[h];
+        d = s->pages - sd_fen_prefix(s, t) + 1;
+        sd_fen_add(s, t, (uint32_t)-1);
+        s->owner[t] = 0;
+        if (d <= s->max_dist) s->hist[d]++;
+        else s->beyond++;
+    } else {
+        s->hkeys[h] = page + 1;
+        s->pages++;
+        s->cold++;
+        d = SD_COLD;
+    }
+    s->htime[h] = s->now;
+    s->owner[s->now] = page + 1;
+    sd_fen_add(s, s->now, 1);
+    s->now++;
+    return d;
+}
+
+/* misses of a fully associative LRU cache of `size` pages; exact for
+   size <= max_dist, larger sizes still count every distance > max_dist */
+uint64_t sd_misses(const StackDist *s, uint64_t size) {
+    uint64_t m = s->cold + s->beyond;
+    for (uint64_t d = size + 1; d <= s->max_dist; ++d) m += s->hist[d];
+    return m;
+}
+
+/* ---------- C++: position-independent pointers ---------- */
+/* offset_ptr<T> stores the pointee's offset from pool_base (POOL_NIL for
+   null), the same encoding as the free-list links, so pool-resident data
+   built with it stays valid wherever a file-backed, shared or snapshot pool
+   is mapped. It may live anywhere (stack, pool, globals); dereferencing is one
+   add. pool_allocator<T> allocates from the pool with offset_ptr as its
+   pointer type, so a container that honours allocator pointer types (e.g.
+   std::vector) is position independent when it lives in the pool too. */
+#ifdef __cplusplus
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <type_traits>
+
+template <class T>
+class offset_ptr {
+public:
+    typedef T element_type;
+    typedef T value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef T* pointer;
+    typedef typename std::add_lvalue_reference<T>::type reference;
+    typedef std::random_access_iterator_tag iterator_category;
+    template <class U> struct rebind { typedef offset_ptr<U> other; };
+
+    offset_ptr() : off_(POOL_NIL) {}
+    offset_ptr(std::nullptr_t) : off_(POOL_NIL) {}
+    offset_ptr(T *p) : off_(p ? (size_t)((char*)p - (char*)pool_base) : POOL_NIL) {}
+    template <class U, typename std::enable_if<std::is_convertible<U*, T*>::value, int>::type = 0>
+    offset_ptr(const offset_ptr<U> &o) : offset_ptr(static_cast<T*>(o.get())) {}
+    template <class U, typename std::enable_if<!std::is_convertible<U*, T*>::value, int>::type = 0>
+    explicit offset_ptr(const offset_ptr<U> &o) : offset_ptr(static_cast<T*>(o.get())) {}
+
+    static offset_ptr from_offset(size_t off) { offset_ptr p; p.off_ = off; return p; }
+    template <class R> static offset_ptr pointer_to(R &r) { return offset_ptr(&r); }
+
+    T* get() const { return off_ == POOL_NIL ? nullptr : (T*)((char*)pool_base + off_); }
+    size_t offset() const { return off_; }
+    /* dereferencing null is undefined anyway, so these skip the null test */
+    reference operator*() const { return *addr(); }
+    T* operator->() const { return addr(); }
+    reference operator[](difference_type i) const { return addr()[i]; }
+    explicit operator bool() const { return off_ != POOL_NIL; }
+
+    offset_ptr& operator+=(difference_type n) { off_ += n * (difference_type)sizeof(T); return *this; }
+    offset_ptr& operator-=(difference_type n) { off_ -= n * (difference_type)sizeof(T); return *this; }
+    offset_ptr& operator++() { return *this += 1; }
+    offset_ptr& operator--() { return *this -= 1; }
+    offset_ptr operator++(int) { offset_ptr t = *this; ++*this; return t; }
+    offset_ptr operator--(int) { offset_ptr t = *this; --*this; return t; }
+    offset_ptr operator+(difference_type n) const { offset_ptr t = *this; return t += n; }
+    offset_ptr operator-(difference_type n) const { offset_ptr t = *this; return t -= n; }
+    difference_type operator-(const offset_ptr &o) const {
+        return ((difference_type)off_ - (difference_type)o.off_) / (difference_type)sizeof(T);
+    }
+
+    bool operator==(const offset_ptr &o) const { return off_ == o.off_; }
+    bool operator!=(const offset_ptr &o) const { return off_ != o.off_; }
+    bool operator<(const offset_ptr &o) const { return off_ < o.off_; }
+    bool operator>(const offset_ptr &o) const { return off_ > o.off_; }
+    bool operator<=(const offset_ptr &o) const { return off_ <= o.off_; }
+    bool operator>=(const offset_ptr &o) const { return off_ >= o.off_; }
+    bool operator==(std::nullptr_t) const { return off_ == POOL_NIL; }
+    bool operator!=(std::nullptr_t) const { return off_ != POOL_NIL; }
+
+private:
+    T* addr() const { return (T*)((char*)pool_base + off_); }
+    size_t off_;
+};
+
+template <class T>
+offset_ptr<T> operator+(std::ptrdiff_t n, const offset_ptr<T> &p) { return p + n; }
+
+/* first-fit pool allocator; throws std::bad_alloc when the pool is full */
+template <class T>
+class pool_allocator {
+public:
+    typedef T value_type;
+    typedef offset_ptr<T> pointer;
+    typedef offset_ptr<const T> const_pointer;
+    typedef offset_ptr<void> void_pointer;
+    typedef offset_ptr<const void> const_void_pointer;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+    template <class U> struct rebind { typedef pool_allocator<U> other; };
+
+    pool_allocator() {}
+    template <class U> pool_allocator(const pool_allocator<U> &) {}
+
+    pointer allocate(size_type n) {
+        void *p = malloc_first_fit(n * sizeof(T));
+        if (!p) throw std::bad_alloc();
+        return pointer(static_cast<T*>(p));
+    }
+    void deallocate(pointer p, size_type) { my_free(p.get()); }
+};
+
+template <class T, class U>
+bool operator==(const pool_allocator<T> &, const pool_allocator<U> &) { return true; }
+template <class T, class U>
+bool operator!=(const pool_allocator<T> &, const pool_allocator<U> &) { return false; }
+#endif /* __cplusplus */
+
 #endif 
 
 
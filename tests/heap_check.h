@@ -0,0 +1,53 @@
+/* Structural checks shared by the tests: include after mmu.h. */
+#include <assert.h>
+
+/* Blocks tile the pool, every header is intact, and the free list and the
+   buddy lists together hold exactly the free blocks: the free list in
+   address order and correctly back-linked, buddy blocks at their size and
+   alignment. Only the whole pool, when free, is on both. */
+static inline void heap_check(void) {
+    size_t off = 0, nfree = 0;
+    while (off < POOL_SIZE) {
+        Header *h = header_from_offset(off);
+        assert(h->magic == MAGIC_ALLOC || h->magic == MAGIC_FREE);
+        assert(h->is_free == (h->magic == MAGIC_FREE));
+        if (h->is_free) nfree++;
+        off += sizeof(Header) + h->size;
+    }
+    assert(off == POOL_SIZE);
+    size_t n = 0;
+    FreeMeta *prev = NULL;
+    for (FreeMeta *m = free_list_head(); m; m = meta_next(m)) {
+        assert(header_from_meta(m)->is_free);
+        assert(meta_prev(m) == prev && (!prev || prev < m));
+        prev = m;
+        n++;
+    }
+    for (int k = 0; k <= BUDDY_MAX_ORDER; ++k) {
+        for (size_t off = pool_root->buddy_heads[k]; off != POOL_NIL; off = meta_at(off)->buddy_next) {
+            Header *h = header_from_offset(off);
+            assert(h->is_free && off % ((size_t)1 << k) == 0);
+            assert(h->size == ((size_t)1 << k) - sizeof(Header) && meta_at(off)->order == k);
+            if (k < BUDDY_MAX_ORDER) n++;
+        }
+    }
+    assert(n == nfree);
+}
+
+/* the pool is back to a single free block */
+static inline void heap_check_empty(void) {
+    heap_check();
+    FreeMeta *m = free_list_head();
+    assert(m && !meta_next(m));
+    assert(header_from_meta(m)->size == POOL_SIZE - sizeof(Header));
+    assert(pool_root->buddy_heads[BUDDY_MAX_ORDER] == 0);
+}
+
+/* deterministic xorshift, so failures reproduce */
+static inline uint32_t test_rand(void) {
+    static uint32_t x = 2463534242u;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
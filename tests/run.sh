@@ -0,0 +1,31 @@
+#!/bin/sh
+# Build and run the tests. Each test is one self-contained program that
+# includes ../mmu.h with its own pool configuration and exits non-zero on
+# failure. Usage: tests/run.sh [test_foo.c ...]
+cd "$(dirname "$0")" || exit 1
+out=$(mktemp -d "${TMPDIR:-/tmp}/mmu-tests.XXXXXX") || exit 1
+trap 'rm -rf "$out"' EXIT
+[ $# -gt 0 ] || set -- test_*.c test_*.cpp
+
+pass=0 fail=0
+for src in "$@"; do
+    [ -e "$src" ] || continue
+    name=${src%.*}
+    case $src in
+        *.cpp) build="${CXX:-c++} -std=c++11" ;;
+        *)     build="${CC:-cc}" ;;
+    esac
+    if ! $build -O2 -Wall -Wextra -pthread "$src" -o "$out/$name" -lrt; then
+        echo "FAIL $name (build)"
+        fail=$((fail + 1))
+    elif (cd "$out" && TMPDIR="$out" "./$name" >"$name.log" 2>&1); then
+        echo "ok   $name"
+        pass=$((pass + 1))
+    else
+        echo "FAIL $name"
+        sed 's/^/    /' "$out/$name.log"
+        fail=$((fail + 1))
+    fi
+done
+echo "$pass passed, $fail failed"
+[ "$fail" -eq 0 ]
@@ -0,0 +1,87 @@
+/* Copy-on-write checkpoints: images taken while another thread keeps
+   allocating and freeing are always consistent heaps, a failed writer is
+   reported, and shared pools are refused.
+   Build: cc -O2 -pthread tests/test_checkpoint.c -o test_checkpoint */
+#define POOL_SIZE       (1 << 20)
+#define BUDDY_MAX_ORDER 20
+#include "../mmu.h"
+#include "heap_check.h"
+#include <sys/wait.h>
+
+#define SLOTS 256
+
+static volatile int stop;
+
+/* allocation churn on the live heap; every block starts with its own size */
+static void* churn(void *arg) {
+    size_t *slot[SLOTS] = { 0 };
+    (void)arg;
+    while (!stop) {
+        int k = (int)(test_rand() % SLOTS);
+        if (slot[k]) {
+            assert(slot[k][0] == header_from_user(slot[k])->size);
+            my_free(slot[k]);
+            slot[k] = NULL;
+        } else if ((slot[k] = (size_t*)malloc_best_fit(16 + test_rand() % 2000)) != NULL) {
+            slot[k][0] = header_from_user(slot[k])->size;
+        }
+    }
+    for (int k = 0; k < SLOTS; ++k) my_free(slot[k]);
+    return NULL;
+}
+
+/* load an image in a child process (this one keeps its pool) and check it */
+static void check_image(const char *path) {
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        pool_root = NULL;
+        pool_base = NULL;
+        pool_initialized = 0;
+        assert(pool_snapshot_load(path) == 0);
+        heap_check();
+        size_t live = 0;
+        for (size_t off = 0; off < POOL_SIZE; ) {
+            Header *h = header_from_offset(off);
+            size_t *p = (size_t*)user_from_header(h);
+            if (!h->is_free && p[0] == h->size) live++;
+            off += sizeof(Header) + h->size;
+        }
+        _exit(live > 0 ? 0 : 1);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main(void) {
+    pthread_t th;
+    my_free(malloc_first_fit(1));   /* map the pool */
+    pthread_create(&th, NULL, churn, NULL);
+    while (__atomic_load_n(&pool_root->free_head, __ATOMIC_RELAXED) == 0) sched_yield();   /* let it allocate */
+
+    for (int round = 0; round < 10; ++round) {
+        pid_t pid = pool_checkpoint("live.img");
+        assert(pid > 0);
+        int rc;
+        while ((rc = pool_checkpoint_wait(pid, 1)) == 1) sched_yield();
+        assert(rc == 0);
+        assert(access("live.img.tmp", F_OK) != 0);
+        check_image("live.img");
+    }
+    stop = 1;
+    pthread_join(th, NULL);
+    heap_check_empty();
+
+    /* a writer that cannot create its file fails, leaving the old image */
+    pid_t pid = pool_checkpoint("no-such-dir/live.img");
+    assert(pid > 0 && pool_checkpoint_wait(pid, 0) == -1);
+    check_image("live.img");
+
+    /* a shared mapping is not copied on fork */
+    pool_close();
+    assert(init_pool_file("shared.pool") == 0);
+    assert(pool_checkpoint("shared.img") == -1);
+    assert(pool_snapshot_save("shared.img") == 0);
+    pool_close();
+    return 0;
+}
@@ -0,0 +1,156 @@
+/* Compressed cold-page store: LZ round trips, pages restored on touch with
+   their contents intact, no write lost when other threads write to pages
+   while sweeps compress them, no thread ever reads a page that is
+   dropped or only partly restored, and the pool cannot be locked while
+   pages may be compressed.
+   Build: cc -O2 -pthread tests/test_cold_store.c -o test_cold_store */
+#define POOL_SIZE       (1 << 20)
+#define BUDDY_MAX_ORDER 20
+#include "../mmu.h"
+#include "heap_check.h"
+#include <pthread.h>
+
+#define WRITERS      3
+#define WRITER_PAGES 16
+#define WRITES       200000
+#define FILL         0x1111111111111111ull
+#define READERS      3
+#define SHARED_PAGES 4
+#define READS        300000
+
+static uint8_t src[POOL_PAGE_SIZE], comp[POOL_PAGE_SIZE], out[POOL_PAGE_SIZE];
+static volatile int threads_done = 0;
+
+static void lz_round_trips(void) {
+    for (int t = 0; t < 2000; ++t) {
+        int mode = t % 4;
+        for (int i = 0; i < POOL_PAGE_SIZE; ++i)
+            src[i] = (uint8_t)(mode == 0 ? 0 : mode == 1 ? test_rand() % 4 : mode == 2 ? (i / 50) & 0xFF : test_rand());
+        size_t n = lz_compress(src, POOL_PAGE_SIZE, comp, COLD_MAX_LEN);
+        if (mode == 0) assert(n > 0);
+        if (n) {
+            assert(lz_decompress(comp, n, out, POOL_PAGE_SIZE) == 0);
+            assert(memcmp(src, out, POOL_PAGE_SIZE) == 0);
+        }
+    }
+}
+
+/* each page holds a counter that only this thread increments */
+static void* writer(void *arg) {
+    uint64_t *pages = (uint64_t*)arg;
+    uint64_t expect[WRITER_PAGES];
+    for (int p = 0; p < WRITER_PAGES; ++p) expect[p] = FILL;
+    uint32_t x = (uint32_t)(uintptr_t)arg | 1;
+    for (int n = 0; n < WRITES; ++n) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        int p = (int)(x % WRITER_PAGES);
+        uint64_t *c = pages + (size_t)p * (POOL_PAGE_SIZE / sizeof(uint64_t));
+        assert(*c == expect[p]);
+        *c = ++expect[p];
+        if (n % 64 == 0) sched_yield();
+    }
+    __atomic_fetch_add(&threads_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* all readers share the same pages; every word holds its own index */
+static void* reader(void *arg) {
+    const uint64_t *words = (const uint64_t*)arg;
+    const size_t n = SHARED_PAGES * POOL_PAGE_SIZE / sizeof(uint64_t);
+    for (int r = 0; r < READS; ++r) {
+        size_t k = test_rand() % n;
+        assert(words[k] == k + 1);
+        if (r % 64 == 0) sched_yield();
+    }
+    __atomic_fetch_add(&threads_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+int main(void) {
+    lz_round_trips();
+
+    /* compress, then restore on touch */
+    unsigned char *ps[100];
+    for (int i = 0; i < 100; ++i) {
+        assert((ps[i] = (unsigned char*)malloc_first_fit(3000)) != NULL);
+        memset(ps[i], i + 1, 3000);
+    }
+    assert(cold_store_enable() == 0);
+    size_t swept = 0, pages, bytes;
+    for (int i = 0; i < 3; ++i) swept += cold_store_sweep();
+    cold_store_stats(&pages, &bytes);
+    assert(swept > 0 && pages == swept && bytes > 0);
+    for (int i = 0; i < 100; i += 2)
+        for (int k = 0; k < 3000; ++k) assert(ps[i][k] == i + 1);
+    cold_store_stats(&pages, NULL);
+    assert(pages < swept);
+    for (int i = 0; i < 100; ++i) my_free(ps[i]);
+    heap_check_empty();
+    cold_store_disable();
+    cold_store_stats(&pages, &bytes);
+    assert(pages == 0 && bytes == 0);
+
+    /* sweeps racing writers */
+    char *region[WRITERS];
+    pthread_t th[WRITERS];
+    for (int t = 0; t < WRITERS; ++t) {
+        assert((region[t] = (char*)malloc_first_fit((WRITER_PAGES + 1) * POOL_PAGE_SIZE)) != NULL);
+        memset(region[t], FILL & 0xFF, (WRITER_PAGES + 1) * POOL_PAGE_SIZE);
+    }
+    assert(cold_store_enable() == 0);
+    for (int t = 0; t < WRITERS; ++t) {
+        uintptr_t aligned = ((uintptr_t)region[t] + POOL_PAGE_SIZE - 1) & ~(uintptr_t)(POOL_PAGE_SIZE - 1);
+        pthread_create(&th[t], NULL, writer, (void*)aligned);
+    }
+    size_t total = 0;
+    while (__atomic_load_n(&threads_done, __ATOMIC_ACQUIRE) < WRITERS) total += cold_store_sweep();
+    for (int t = 0; t < WRITERS; ++t) pthread_join(th[t], NULL);
+    assert(total > 0);
+    cold_store_disable();
+    for (int t = 0; t < WRITERS; ++t) my_free(region[t]);
+    heap_check_empty();
+
+    /* sweeps racing readers that fault on the same pages */
+    uint64_t *shared = (uint64_t*)malloc_first_fit((SHARED_PAGES + 1) * POOL_PAGE_SIZE);
+    assert(shared);
+    uint64_t *words = (uint64_t*)(((uintptr_t)shared + POOL_PAGE_SIZE - 1) & ~(uintptr_t)(POOL_PAGE_SIZE - 1));
+    for (size_t k = 0; k < SHARED_PAGES * POOL_PAGE_SIZE / sizeof(uint64_t); ++k) words[k] = k + 1;
+    threads_done = 0;
+    assert(cold_store_enable() == 0);
+    for (int t = 0; t < READERS; ++t) pthread_create(&th[t], NULL, reader, words);
+    total = 0;
+    while (__atomic_load_n(&threads_done, __ATOMIC_ACQUIRE) < READERS) total += cold_store_sweep();
+    for (int t = 0; t < READERS; ++t) pthread_join(th[t], NULL);
+    assert(total > 0);
+    page_tracker_stop();
+    my_free(shared);
+    heap_check_empty();
+
+    /* locking is refused while the store runs, and the store while locked */
+    ps[0] = (unsigned char*)malloc_first_fit(3 * POOL_PAGE_SIZE);
+    assert(ps[0] && cold_store_enable() == 0);
+    memset(ps[0], 7, 3 * POOL_PAGE_SIZE);
+    for (int i = 0; i < 3; ++i) cold_store_sweep();
+    cold_store_stats(&pages, NULL);
+    assert(pages > 0);
+    assert(pool_set_options(POOL_OPT_MLOCK) == -1 && pool_options == 0 && pool_locked_bytes() == 0);
+    cold_store_disable();
+    assert(pool_set_options(POOL_OPT_MLOCK) == -1);   /* the tracker still arms pages */
+    page_tracker_stop();
+    if (pool_set_options(POOL_OPT_MLOCK) == 0) {
+        assert(cold_store_enable() == -1 && cold_store_sweep() == 0);
+        for (int i = 0; i < 3 * POOL_PAGE_SIZE; ++i) assert(ps[0][i] == 7);
+        assert(pool_set_options(0) == 0 && pool_locked_bytes() == 0);
+    }
+    my_free(ps[0]);
+    heap_check_empty();
+
+    /* file-backed pages are not the cold store's to drop */
+    pool_close();
+    assert(init_pool_file("cold.pool") == 0);
+    assert(cold_store_enable() == -1);
+    pool_close();
+    return 0;
+}
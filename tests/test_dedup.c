@@ -0,0 +1,88 @@
+/* Page deduplication: zero and duplicate pages are shared and keep their
+   contents, shared pages copy on write, armed pages are scanned without
+   counting as touched, and no write is lost when another thread writes to
+   pages while scans compare and remap them.
+   Build: cc -O2 -pthread tests/test_dedup.c -o test_dedup */
+#define POOL_SIZE       (1 << 20)
+#define BUDDY_MAX_ORDER 20
+#include "../mmu.h"
+#include "heap_check.h"
+#include <pthread.h>
+
+#define PAGES         (POOL_SIZE / POOL_PAGE_SIZE)
+#define WRITER_PAGES  32
+#define WRITER_ROUNDS 3000
+
+static char expected(int i) {
+    return (char)(i % 8 == 0 ? 0 : i % 3 + 1);
+}
+
+static void check_pages(const char *b, int from) {
+    for (int i = from; i < PAGES; ++i)
+        for (int k = 0; k < POOL_PAGE_SIZE; k += 256) assert(b[i * POOL_PAGE_SIZE + k] == expected(i));
+}
+
+static volatile int writer_done = 0;
+
+/* every round writes the same value to every page, so the pages keep
+   becoming duplicates of each other in between */
+static void* writer(void *arg) {
+    uint64_t *pages = (uint64_t*)arg;
+    for (uint64_t r = 1; r <= WRITER_ROUNDS; ++r) {
+        for (int p = 0; p < WRITER_PAGES; ++p) {
+            uint64_t *w = pages + (size_t)p * (POOL_PAGE_SIZE / sizeof(uint64_t));
+            assert(*w == r - 1);
+            *w = r;
+        }
+        if (r % 16 == 0) sched_yield();
+    }
+    writer_done = 1;
+    return NULL;
+}
+
+int main(void) {
+    init_pool();
+    char *b = (char*)pool_base;
+    for (int i = 0; i < PAGES; ++i) memset(b + i * POOL_PAGE_SIZE, expected(i), POOL_PAGE_SIZE);
+
+    /* every page is a zero page or one of three duplicate sets */
+    assert(pool_dedup_scan(DEDUP_MEMFD) == PAGES);
+    check_pages(b, 0);
+    memset(b + POOL_PAGE_SIZE, 9, POOL_PAGE_SIZE);   /* copy on write */
+    assert(b[POOL_PAGE_SIZE] == 9 && b[4 * POOL_PAGE_SIZE] == expected(4));
+    assert(pool_dedup_scan(DEDUP_MEMFD) == PAGES - 1);
+    assert(b[POOL_PAGE_SIZE] == 9);
+    check_pages(b, 2);
+    assert(pool_dedup_scan(DEDUP_KSM) == PAGES - 1);
+    check_pages(b, 2);
+
+    /* armed pages stay armed (cold) through a scan */
+    assert(page_tracker_start(TRACK_MPROTECT) == 0);
+    for (int r = 0; r < 3; ++r) {
+        b[5 * POOL_PAGE_SIZE] = expected(5);
+        page_tracker_sample();
+    }
+    assert(pool_page_class(5) == PAGE_HOT && pool_page_class(6) == PAGE_COLD);
+    assert(pool_dedup_scan(DEDUP_MEMFD) > 0);
+    page_tracker_sample();
+    assert(pool_page_class(6) == PAGE_COLD);
+    check_pages(b, 2);
+    page_tracker_stop();
+
+    /* scans racing a writer */
+    for (int i = 0; i < PAGES; ++i) memset(b + i * POOL_PAGE_SIZE, 0x5A, POOL_PAGE_SIZE);
+    uint64_t *region = (uint64_t*)(b + 8 * POOL_PAGE_SIZE);
+    for (int p = 0; p < WRITER_PAGES; ++p) region[(size_t)p * (POOL_PAGE_SIZE / sizeof(uint64_t))] = 0;
+    pthread_t th;
+    pthread_create(&th, NULL, writer, region);
+    size_t scans = 0;
+    while (!writer_done) {
+        pool_dedup_scan(scans % 2 ? DEDUP_KSM : DEDUP_MEMFD);
+        scans++;
+    }
+    pthread_join(th, NULL);
+    assert(scans > 0);
+    for (int p = 0; p < WRITER_PAGES; ++p)
+        assert(region[(size_t)p * (POOL_PAGE_SIZE / sizeof(uint64_t))] == WRITER_ROUNDS);
+    return 0;
+}
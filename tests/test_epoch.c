@@ -0,0 +1,101 @@
+/* Epoch-based reclamation: a retired block outlives every thread that has
+   not passed a quiescent point, an unregistered thread's blocks are freed
+   by the others, and blocks still in limbo when the pool is closed are
+   freed with it instead of into the next pool.
+   Build: cc -O2 -pthread tests/test_epoch.c -o test_epoch */
+#define POOL_SIZE       (1 << 20)
+#define BUDDY_MAX_ORDER 20
+#include "../mmu.h"
+#include "heap_check.h"
+
+static volatile int step, done;
+
+/* a registered reader that only announces a quiescent point when told to */
+static void* reader(void *arg) {
+    (void)arg;
+    assert(epoch_register() == 0);
+    __atomic_store_n(&step, 1, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&step, __ATOMIC_ACQUIRE) != 2) sched_yield();
+    epoch_quiescent();
+    __atomic_store_n(&step, 3, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&step, __ATOMIC_ACQUIRE) != 4) sched_yield();
+    epoch_unregister();
+    return NULL;
+}
+
+/* retires blocks and unregisters with them still in limbo */
+static void* orphaner(void *arg) {
+    (void)arg;
+    assert(epoch_register() == 0);
+    for (int i = 0; i < 10; ++i) retire(malloc_first_fit(64));
+    assert(epoch_pending() == 10);
+    epoch_unregister();
+    assert(epoch_pending() == 0);
+    return NULL;
+}
+
+static void quiesce(int times) {
+    for (int i = 0; i < times; ++i) epoch_quiescent();
+}
+
+int main(void) {
+    pthread_t th;
+    retire(NULL);
+    assert(epoch_pending() == 0);
+
+    /* alone, a block is freed two epochs after it was retired */
+    assert(epoch_register() == 0 && epoch_register() == 0);
+    for (int i = 0; i < 100; ++i) retire(malloc_best_fit(16 + (size_t)i * 8));
+    assert(epoch_pending() == 100);
+    quiesce(3);
+    assert(epoch_pending() == 0);
+    heap_check_empty();
+
+    /* a reader that has not announced the epoch holds the blocks back */
+    pthread_create(&th, NULL, reader, NULL);
+    while (__atomic_load_n(&step, __ATOMIC_ACQUIRE) != 1) sched_yield();
+    void *p = malloc_first_fit(128);
+    retire(p);
+    quiesce(10);
+    assert(epoch_pending() == 1 && !header_from_user(p)->is_free);
+    __atomic_store_n(&step, 2, __ATOMIC_RELEASE);
+    while (__atomic_load_n(&step, __ATOMIC_ACQUIRE) != 3) sched_yield();
+    quiesce(1);
+    assert(epoch_pending() == 0);
+    heap_check_empty();
+    __atomic_store_n(&step, 4, __ATOMIC_RELEASE);
+    pthread_join(th, NULL);
+
+    /* an unregistered thread's blocks are freed by whoever moves the epoch */
+    pthread_create(&th, NULL, orphaner, NULL);
+    pthread_join(th, NULL);
+    heap_check();
+    quiesce(3);
+    heap_check_empty();
+
+    /* closing the pool frees the limbo lists; the next pool starts clean */
+    for (int i = 0; i < 50; ++i) retire(malloc_first_fit(100));
+    pthread_create(&th, NULL, orphaner, NULL);
+    pthread_join(th, NULL);
+    pool_close();
+    assert(epoch_pending() == 0);
+    my_free(malloc_first_fit(1));   /* map a fresh pool */
+    quiesce(5);   /* nothing stale to free into it */
+    heap_check_empty();
+
+    /* in a file pool the closed-over blocks are freed, not leaked */
+    pool_close();
+    assert(init_pool_file("epoch.pool") == 0);
+    for (int i = 0; i < 50; ++i) retire(malloc_first_fit(100));
+    pthread_create(&th, NULL, orphaner, NULL);
+    pthread_join(th, NULL);
+    pool_close();
+    assert(init_pool_file("epoch.pool") == 0);
+    heap_check_empty();
+    for (int i = 0; i < 5; ++i) retire(malloc_first_fit(100));
+    quiesce(3);
+    heap_check_empty();
+    epoch_unregister();
+    pool_close();
+    return 0;
+}
@@ -0,0 +1,63 @@
+/* Generation-tagged allocation: objects are tagged and aligned, large
+   objects get their own chunk, impossible sizes fail, gen_free_all() returns every chunk, ids are
+   reused, and ids kept across pool_close() are dead in the next pool.
+   Build: cc -O2 -pthread tests/test_gen.c -o test_gen */
+#define POOL_SIZE       (1 << 20)
+#define BUDDY_MAX_ORDER 20
+#include "../mmu.h"
+#include "heap_check.h"
+
+int main(void) {
+    assert(gen_alloc(0, 16) == NULL && gen_alloc(GEN_MAX + 1, 16) == NULL);
+    assert(gen_free_all(0) == 0 && gen_of(NULL) == 0);
+
+    gen_t a = gen_create(), b = gen_create();
+    assert(a && b && a != b);
+    char *pa[1000], *pb[1000];
+    for (int i = 0; i < 1000; ++i) {
+        size_t len = 1 + (size_t)i % 200;
+        pa[i] = (char*)gen_alloc(a, len);
+        pb[i] = (char*)gen_alloc(b, len);
+        assert(pa[i] && pb[i] && (uintptr_t)pa[i] % POOL_ALIGN == 0);
+        memset(pa[i], 'a', len);
+        memset(pb[i], 'b', len);
+    }
+    assert(gen_alloc(a, SIZE_MAX) == NULL && gen_alloc(a, SIZE_MAX - POOL_ALIGN) == NULL);
+    assert(gen_alloc(a, POOL_SIZE + 1) == NULL);   /* sizes that cannot fit, not wrapped ones */
+    char *big = (char*)gen_alloc(a, 3 * GEN_CHUNK_SIZE);
+    assert(big && gen_of(big) == a);
+    memset(big, 'A', 3 * GEN_CHUNK_SIZE);
+    for (int i = 0; i < 1000; ++i) {
+        assert(gen_of(pa[i]) == a && gen_of(pb[i]) == b);
+        assert(pa[i][0] == 'a' && pb[i][0] == 'b');
+    }
+    my_free(pa[0]);   /* rejected: not a pool block */
+    assert(gen_of(pa[0]) == a);
+    heap_check();
+
+    assert(gen_free_all(a) == 1001 && gen_free_all(a) == 0);
+    assert(gen_alloc(a, 16) == NULL);
+    assert(gen_free_all(b) == 1000);
+    heap_check_empty();
+
+    /* every id can be live at once, and freed ids are handed out again */
+    gen_t all[GEN_MAX];
+    for (int i = 0; i < GEN_MAX; ++i) assert((all[i] = gen_create()) != 0);
+    assert(gen_create() == 0);
+    assert(gen_free_all(all[3]) == 0 && gen_create() == all[3]);
+    for (int i = 0; i < GEN_MAX; ++i) gen_free_all(all[i]);
+    heap_check_empty();
+
+    /* a generation left open across pool_close() is dead in the next pool */
+    a = gen_create();
+    for (int i = 0; i < 100; ++i) assert(gen_alloc(a, 500));
+    pool_close();
+    assert(gen_alloc(a, 16) == NULL && gen_free_all(a) == 0);
+    my_free(malloc_first_fit(1));   /* map a fresh pool */
+    heap_check_empty();
+    b = gen_create();
+    assert(gen_alloc(b, 16) && gen_free_all(b) == 1);
+    heap_check_empty();
+    pool_close();
+    return 0;
+}
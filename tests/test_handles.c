@@ -0,0 +1,120 @@
+/* Handle allocations and compaction: contents survive moves, pinned and
+   raw blocks stay put, an unpinned heap compacts to one free block, and
+   threads can use their handles while another thread compacts.
+   Build: cc -O2 -pthread tests/test_handles.c -o test_handles */
+#define POOL_SIZE       (1 << 16)
+#define BUDDY_MAX_ORDER 16
+#include "../mmu.h"
+#include "heap_check.h"
+
+#define SLOTS 64
+#define THREADS 3
+#define THREAD_SLOTS 8
+
+static mem_handle_t hs[SLOTS];
+static unsigned char tag[SLOTS];
+static volatile int stop;
+
+static void check_contents(void) {
+    for (int i = 0; i < SLOTS; ++i) {
+        if (!hs[i]) continue;
+        unsigned char *p = (unsigned char*)handle_lock(hs[i]);
+        size_t n = handle_size(hs[i]);
+        for (size_t k = 0; k < n; ++k) assert(p[k] == tag[i]);
+        handle_unlock(hs[i]);
+    }
+}
+
+/* each thread keeps a few handles of its own and re-checks them under
+   lock/size/unlock while the main thread compacts */
+static void* handle_worker(void *arg) {
+    unsigned char t = (unsigned char)(uintptr_t)arg;
+    mem_handle_t mine[THREAD_SLOTS];
+    for (int i = 0; i < THREAD_SLOTS; ++i) {
+        assert((mine[i] = handle_alloc(64 + 32 * i)) != 0);
+        memset(handle_lock(mine[i]), t, handle_size(mine[i]));
+        handle_unlock(mine[i]);
+    }
+    for (unsigned n = 0; !stop || n < 1000; ++n) {
+        mem_handle_t h = mine[n % THREAD_SLOTS];
+        unsigned char *p = (unsigned char*)handle_lock(h);
+        size_t size = handle_size(h);
+        assert(size >= 64 && p[0] == t && p[size - 1] == t);
+        handle_unlock(h);
+        if (n % 64 == 0) {
+            handle_free(h);
+            assert((h = mine[n % THREAD_SLOTS] = handle_alloc(size)) != 0);
+            memset(handle_lock(h), t, handle_size(h));
+            handle_unlock(h);
+        }
+    }
+    for (int i = 0; i < THREAD_SLOTS; ++i) handle_free(mine[i]);
+    return NULL;
+}
+
+int main(void) {
+    assert(handle_alloc(POOL_SIZE) == 0);
+    assert(handle_lock(0) == NULL && handle_size(12345) == 0);
+
+    /* random churn with a raw block in the way and periodic compaction */
+    void *raw = malloc_best_fit(40);
+    for (int it = 0; it < 50000; ++it) {
+        int i = (int)(test_rand() % SLOTS);
+        if (hs[i]) {
+            handle_free(hs[i]);
+            hs[i] = 0;
+        } else if ((hs[i] = handle_alloc(1 + test_rand() % 400)) != 0) {
+            tag[i] = (unsigned char)test_rand();
+            memset(handle_lock(hs[i]), tag[i], handle_size(hs[i]));
+            handle_unlock(hs[i]);
+        }
+        if (it % 97 == 0) compact_pool();
+        if (it % 1000 == 0) {
+            heap_check();
+            check_contents();
+        }
+    }
+    check_contents();
+
+    /* a pinned block keeps its address through compaction */
+    mem_handle_t pinned = 0;
+    for (int i = 0; i < SLOTS && !pinned; ++i) pinned = hs[i];
+    assert(pinned);
+    void *at = handle_lock(pinned);
+    compact_pool();
+    assert(handle_lock(pinned) == at);
+    handle_unlock(pinned);
+    handle_unlock(pinned);
+    check_contents();
+    heap_check();
+
+    /* a fragmented pool is compacted by handle_alloc() itself */
+    for (int i = 0; i < SLOTS; ++i) if (hs[i]) handle_free(hs[i]);
+    my_free(raw);
+    heap_check_empty();
+    mem_handle_t small[32];
+    for (int i = 0; i < 32; ++i) assert((small[i] = handle_alloc(POOL_SIZE / 32 - 64)) != 0);
+    for (int i = 0; i < 32; i += 2) handle_free(small[i]);
+    mem_handle_t big = handle_alloc(POOL_SIZE / 4);
+    assert(big);
+    handle_free(big);
+    for (int i = 1; i < 32; i += 2) handle_free(small[i]);
+    heap_check_empty();
+
+    /* concurrent handle use from several threads while compacting */
+    pthread_t th[THREADS];
+    void *hole = malloc_first_fit(100);
+    for (int i = 0; i < THREADS; ++i) pthread_create(&th[i], NULL, handle_worker, (void*)(uintptr_t)(i + 1));
+    for (int i = 0; i < 2000; ++i) {
+        compact_pool();
+        if (i % 100 == 0) {
+            my_free(hole);
+            hole = malloc_first_fit(100);
+        }
+    }
+    stop = 1;
+    for (int i = 0; i < THREADS; ++i) pthread_join(th[i], NULL);
+    my_free(hole);
+    heap_check_empty();
+    return 0;
+}
@@ -0,0 +1,130 @@
+/* Intent log: a process that dies in the middle of a call (or of a larger
+   transaction) leaves a log behind, and reopening the file rolls the heap
+   back to its state before that call.
+   Build: cc -O2 -pthread tests/test_intent_log.c -o test_intent_log */
+#define POOL_SIZE       (1 << 18)
+#define BUDDY_MAX_ORDER 18
+#include "../mmu.h"
+#include "heap_check.h"
+#include <sys/wait.h>
+
+#define PATH "log.pool"
+
+/* block layout, so two heaps can be compared */
+static uint64_t layout_hash(void) {
+    uint64_t x = 1469598103934665603ull;
+    for (size_t off = 0; off < POOL_SIZE; ) {
+        Header *h = header_from_offset(off);
+        x = (x ^ off ^ (uint64_t)h->size << 20 ^ h->is_free) * 1099511628211ull;
+        off += sizeof(Header) + h->size;
+    }
+    return x;
+}
+
+/* Slot table in the first block, holding payload offsets, so the blocks
+   are shared by every process that opens the file. A slot is cleared before
+   its block is freed and set after it is allocated: a kill in between can
+   leak one block but never leave a slot pointing at a free one. */
+#define SLOTS 64
+
+static size_t* slots(void) {
+    return (size_t*)user_from_header(header_from_offset(0));
+}
+
+static void churn_slots(size_t *slot, int steps) {
+    for (int i = 0; i < steps; ++i) {
+        int k = (int)(test_rand() % SLOTS);
+        if (slot[k]) {
+            void *p = (char*)pool_base + slot[k];
+            slot[k] = 0;
+            my_free(p);
+        } else {
+            char *p = (char*)(test_rand() % 2 ? malloc_first_fit(16 + test_rand() % 3000)
+                                              : malloc_best_fit(16 + test_rand() % 300));
+            if (p) slot[k] = (size_t)(p - (char*)pool_base);
+        }
+    }
+}
+
+static void churn(int steps) {
+    churn_slots(slots(), steps);
+}
+
+static pid_t spawn(void (*fn)(void)) {
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        pool_close();   /* the child maps the file itself */
+        assert(init_pool_file(PATH) == 0);
+        fn();
+        _exit(0);
+    }
+    return pid;
+}
+
+/* Dies holding an open transaction with several calls in it. It works on
+   a copy of the slot table: the rollback brings back the blocks it frees
+   and drops the ones it allocates, so the shared table stays right. */
+static void die_mid_transaction(void) {
+    size_t copy[SLOTS];
+    memcpy(copy, slots(), sizeof(copy));
+    pool_txn_begin();
+    churn_slots(copy, 40);
+    assert(pool_root->log_used > 0);
+    _exit(0);
+}
+
+static void churn_forever(void) {
+    for (;;) churn(1000);
+}
+
+static void reopen_and_check(uint64_t expect) {
+    assert(init_pool_file(PATH) == 0);
+    assert(pool_root->log_used == 0);
+    heap_check();
+    if (expect) assert(layout_hash() == expect);
+    pool_close();
+}
+
+int main(void) {
+    assert(init_pool_file(PATH) == 0);
+    size_t *table = (size_t*)malloc_first_fit(SLOTS * sizeof(size_t));
+    assert(table == slots());
+    memset(table, 0, SLOTS * sizeof(size_t));
+    churn(500);
+    heap_check();
+    pool_close();
+
+    /* an interrupted transaction is undone as a whole */
+    for (int opts = 0; opts <= (int)POOL_OPT_DURABLE; opts += POOL_OPT_DURABLE) {
+        pool_set_options((unsigned)opts);
+        assert(init_pool_file(PATH) == 0);
+        uint64_t before = layout_hash();
+        pool_close();
+        int status;
+        assert(waitpid(spawn(die_mid_transaction), &status, 0) > 0 && WIFEXITED(status));
+        reopen_and_check(before);
+    }
+    pool_set_options(0);
+
+    /* killed at random points: every reopen finds a consistent heap */
+    for (int round = 0; round < 40; ++round) {
+        pid_t pid = spawn(churn_forever);
+        usleep(200 + test_rand() % 3000);
+        kill(pid, SIGKILL);
+        int status;
+        assert(waitpid(pid, &status, 0) == pid && WIFSIGNALED(status));
+        reopen_and_check(0);
+    }
+
+    /* a completed transaction needs no recovery and is kept */
+    assert(init_pool_file(PATH) == 0);
+    pool_txn_begin();
+    churn(40);
+    pool_txn_end();
+    assert(pool_root->log_used == 0);
+    uint64_t after = layout_hash();
+    pool_close();
+    reopen_and_check(after);
+    return 0;
+}
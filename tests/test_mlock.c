@@ -0,0 +1,88 @@
+/* Locked pool mode: the pool and slab arena are mlock()ed when mapped or
+   when the option is set, unlocked when it is cleared or the pool closes,
+   setting it fails cleanly while the mprotect tracker runs, and
+   pool_locked_bytes() matches what the kernel reports (VmLck).
+   Build: cc -O2 -pthread tests/test_mlock.c -o test_mlock */
+#define POOL_SIZE       (1 << 16)
+#define BUDDY_MAX_ORDER 16
+#include "../mmu.h"
+#include "heap_check.h"
+
+#define SLAB_BYTES ((size_t)SLAB_ARENA_PAGES * SLAB_PAGE_SIZE)
+
+/* VmLck from /proc/self/status, in bytes */
+static size_t vm_locked(void) {
+    FILE *f = fopen("/proc/self/status", "r");
+    char line[256];
+    size_t kb = 0;
+    assert(f);
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "VmLck: %zu kB", &kb) == 1) break;
+    fclose(f);
+    return kb * 1024;
+}
+
+static void check_locked(size_t expect) {
+    assert(pool_locked_bytes() == expect);
+    assert(vm_locked() == expect);
+}
+
+int main(void) {
+    check_locked(0);
+
+    /* armed pages cannot be locked: refused, and nothing stays locked */
+    void *p = malloc_first_fit(100);
+    assert(p && malloc_slab(32));
+    assert(page_tracker_start(TRACK_MPROTECT) == 0);
+    page_tracker_sample();
+    assert(pool_set_options(POOL_OPT_MLOCK | POOL_OPT_DURABLE) == -1 && pool_options == 0);
+    check_locked(0);
+    pool_set_options(0);
+    check_locked(0);
+    page_tracker_stop();
+    my_free(p);
+    pool_close();
+
+    if (pool_set_options(POOL_OPT_MLOCK) != 0) {
+        printf("mlock not permitted, skipped\n");
+        return 0;
+    }
+
+    check_locked(SLAB_BYTES);   /* the slab arena outlives pools */
+
+    /* regions are locked as they are mapped */
+    p = malloc_first_fit(100);
+    assert(p);
+    check_locked(POOL_MAP_SIZE + SLAB_BYTES);
+
+    /* features that drop or remap pages stay off */
+    assert(cold_store_enable() == -1);
+    assert(pool_dedup_scan(DEDUP_MEMFD) == 0);
+    assert(mesh_slab_pages() == 0);
+
+    /* clearing and setting the option again, twice over */
+    for (int i = 0; i < 2; ++i) {
+        pool_set_options(0);
+        check_locked(0);
+        pool_set_options(0);
+        check_locked(0);
+        assert(pool_set_options(POOL_OPT_MLOCK) == 0);
+        check_locked(POOL_MAP_SIZE + SLAB_BYTES);
+        assert(pool_set_options(POOL_OPT_MLOCK) == 0);
+        check_locked(POOL_MAP_SIZE + SLAB_BYTES);
+    }
+
+    /* closing unlocks the pool; the next pool is locked again */
+    pool_close();
+    check_locked(SLAB_BYTES);
+    p = malloc_first_fit(100);
+    check_locked(POOL_MAP_SIZE + SLAB_BYTES);
+    my_free(p);
+    heap_check_empty();
+
+    /* a pool closed after the option was cleared has nothing to subtract */
+    pool_set_options(0);
+    pool_close();
+    check_locked(0);
+    return 0;
+}
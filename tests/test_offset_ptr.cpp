@@ -0,0 +1,119 @@
+/* offset_ptr and pool_allocator: pointer arithmetic and conversions, and
+   a pool-resident std::vector and linked list that are still valid after
+   the file pool is reopened at a different address.
+   Build: c++ -std=c++11 -O2 -pthread tests/test_offset_ptr.cpp -o test_offset_ptr */
+#define POOL_SIZE       (1 << 20)
+#define BUDDY_MAX_ORDER 20
+#include "../mmu.h"
+#include "heap_check.h"
+#include <vector>
+
+struct Base { long id; };
+struct Node : Base { offset_ptr<Node> next; offset_ptr<char> name; };
+
+typedef std::vector<long, pool_allocator<long> > PoolVec;
+
+/* everything the test keeps, reachable from the first block of the pool */
+struct Root {
+    offset_ptr<Node> list;
+    offset_ptr<PoolVec> vec;
+};
+
+static Root* root() {
+    return (Root*)user_from_header(header_from_offset(0));
+}
+
+static void check_heap_data(long nodes, long values) {
+    long n = 0;
+    for (offset_ptr<Node> x = root()->list; x; x = x->next, ++n) {
+        char want[32];
+        snprintf(want, sizeof(want), "node-%ld", x->id);
+        assert(x->id == nodes - 1 - n && strcmp(x->name.get(), want) == 0);
+    }
+    assert(n == nodes);
+    PoolVec &v = *root()->vec;
+    assert((long)v.size() == values);
+    for (long i = 0; i < values; ++i) assert(v[i] == i * i);
+}
+
+int main() {
+    /* null, arithmetic and comparisons on a plain array in the pool */
+    offset_ptr<int> null;
+    assert(!null && null == nullptr && null.get() == nullptr && null.offset() == POOL_NIL);
+    int *raw = (int*)malloc_first_fit(10 * sizeof(int));
+    offset_ptr<int> a(raw), b = a + 7;
+    for (int i = 0; i < 10; ++i) a[i] = i;
+    assert(*b == 7 && b - a == 7 && a < b && b[-7] == 0 && (2 + a).get() == raw + 2);
+    assert(*--b == 6 && *b++ == 6 && *b == 7 && (b -= 3, *b == 4));
+    assert(offset_ptr<int>::pointer_to(raw[5]) == a + 5);
+    assert(offset_ptr<int>::from_offset(a.offset()) == a);
+    offset_ptr<const int> ca = a;   /* implicit to const */
+    assert(*ca == 0);
+    my_free(raw);
+    heap_check_empty();
+
+    /* derived to base is implicit, the reverse is explicit */
+    Node *n0 = (Node*)malloc_first_fit(sizeof(Node));
+    n0->id = 42;
+    offset_ptr<Node> pn(n0);
+    offset_ptr<Base> pb = pn;
+    assert(pb->id == 42 && offset_ptr<Node>(pb) == pn);
+    my_free(n0);
+
+    /* build pool-resident data in a file pool */
+    pool_close();
+    assert(init_pool_file("offptr.pool") == 0);
+    Root *r = (Root*)malloc_first_fit(sizeof(Root));
+    assert(r == root());
+    new (r) Root();
+    const long nodes = 1000, values = 5000;
+    for (long i = 0; i < nodes; ++i) {
+        Node *x = (Node*)malloc_first_fit(sizeof(Node));
+        new (x) Node();
+        x->id = i;
+        x->name = (char*)malloc_first_fit(32);
+        snprintf(x->name.get(), 32, "node-%ld", i);
+        x->next = r->list;
+        r->list = x;
+    }
+    r->vec = new (malloc_first_fit(sizeof(PoolVec))) PoolVec();
+    for (long i = 0; i < values; ++i) r->vec->push_back(i * i);   /* grows through pool_allocator */
+    check_heap_data(nodes, values);
+    heap_check();
+    void *old_root = pool_root;
+    pool_close();
+
+    /* reopen elsewhere: every link and the vector's storage still resolve */
+    void *hold = mmap(old_root, POOL_MAP_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANON | MAP_FIXED_NOREPLACE, -1, 0);
+    assert(hold == old_root);
+    assert(init_pool_file("offptr.pool") == 0 && (void*)pool_root != old_root);
+    check_heap_data(nodes, values);
+    PoolVec &v = *root()->vec;
+    v.resize(values / 2);
+    v.shrink_to_fit();
+    check_heap_data(nodes, values / 2);
+
+    /* a full pool surfaces as std::bad_alloc */
+    bool threw = false;
+    try {
+        v.reserve(POOL_SIZE);
+    } catch (const std::bad_alloc &) {
+        threw = true;
+    }
+    assert(threw && (long)v.size() == values / 2);
+
+    /* tear it all down */
+    root()->vec->~PoolVec();
+    my_free(root()->vec.get());
+    for (offset_ptr<Node> x = root()->list; x; ) {
+        offset_ptr<Node> next = x->next;
+        my_free(x->name.get());
+        my_free(x.get());
+        x = next;
+    }
+    my_free(root());
+    heap_check_empty();
+    pool_close();
+    munmap(hold, POOL_MAP_SIZE);
+    return 0;
+}
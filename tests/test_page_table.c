@@ -0,0 +1,79 @@
+/* Four-level page table: 4 KB / 2 MB / 1 GB mappings translate, protect
+   and unmap correctly, empty tables are recycled, and repeated
+   init/map/destroy cycles return every chunk to the buddy allocator.
+   Build: cc -O2 -pthread tests/test_page_table.c -o test_page_table */
+#define POOL_SIZE       (1 << 20)
+#define BUDDY_MAX_ORDER 20
+#include "../mmu.h"
+#include "heap_check.h"
+
+#define N 60
+
+static uint64_t rnd64(void) {
+    return (uint64_t)test_rand() << 32 | test_rand();
+}
+
+int main(void) {
+    PageTable pt;
+    uint64_t vas[N], pas[N];
+    int shifts[N];
+
+    assert(pt_init(&pt) == 0);
+    for (int i = 0; i < N; ++i) {
+        int r = (int)(test_rand() % 10);
+        int sh = r < 7 ? PT_SHIFT_4K : r < 9 ? PT_SHIFT_2M : PT_SHIFT_1G;
+        uint64_t mask = ~(((uint64_t)1 << sh) - 1);
+        /* one 1 GB slot per mapping keeps them disjoint */
+        uint64_t va = ((uint64_t)(i + 1) << PT_SHIFT_1G | (rnd64() & ((1ull << PT_SHIFT_1G) - 1))) & mask;
+        if (i % 4 == 0) va |= 0xFFFF800000000000ull;   /* kernel half */
+        vas[i] = va;
+        pas[i] = rnd64() & PT_ADDR_MASK & mask;
+        shifts[i] = sh;
+        assert(pt_map(&pt, va, pas[i], sh, PT_WRITE) == 0);
+        assert(pt_map(&pt, va, pas[i], sh, 0) == -1);
+    }
+    for (int i = 0; i < N; ++i) {
+        uint64_t off = rnd64() & (((uint64_t)1 << shifts[i]) - 1), pa;
+        pte_t e = 0;
+        assert(pt_translate(&pt, vas[i] + off, &pa, &e) == shifts[i]);
+        assert(pa == pas[i] + off && (e & PT_WRITE) && !(e & PT_NX));
+    }
+
+    /* bad sizes, misalignment and non-canonical addresses are refused */
+    assert(pt_map(&pt, 0x1000, 0, 13, 0) == -1);
+    assert(pt_map(&pt, 0x1001, 0, PT_SHIFT_4K, 0) == -1);
+    assert(pt_map(&pt, 0x0000800000000000ull, 0, PT_SHIFT_4K, 0) == -1);
+
+    for (int i = 1; i < N; i += 2) assert(pt_protect(&pt, vas[i], PT_NX) == 0);
+    for (int i = 0; i < N; i += 2) assert(pt_unmap(&pt, vas[i]) == shifts[i]);
+    for (int i = 0; i < N; ++i) {
+        uint64_t pa;
+        pte_t e = 0;
+        int s = pt_translate(&pt, vas[i], &pa, &e);
+        if (i % 2) assert(s == shifts[i] && (e & PT_NX) && !(e & PT_WRITE));
+        else assert(s == 0);
+    }
+    assert(pt_unmap(&pt, vas[0]) == 0 && pt_protect(&pt, vas[0], 0) == -1);
+    for (int i = 1; i < N; i += 2) pt_unmap(&pt, vas[i]);
+    assert(pt.tables_used == 1);
+
+    /* a dense range fills one leaf table */
+    for (uint64_t v = 0; v < PT_ENTRIES; ++v) assert(pt_map(&pt, 0x40000000 + (v << 12), v << 12, PT_SHIFT_4K, 0) == 0);
+    assert(pt.tables_used == 4);
+    pt_destroy(&pt);
+    heap_check_empty();
+
+    /* tables are zeroed on reuse, and every chunk goes back to the pool */
+    for (int cycle = 0; cycle < 100; ++cycle) {
+        assert(pt_init(&pt) == 0);
+        for (int i = 0; i < 20; ++i) {
+            uint64_t va = (uint64_t)(i + 1) << PT_SHIFT_1G;
+            uint64_t pa;
+            assert(pt_translate(&pt, va, &pa, NULL) == 0);
+            assert(pt_map(&pt, va, (uint64_t)i << PT_SHIFT_4K, PT_SHIFT_4K, PT_WRITE) == 0);
+        }
+        pt_destroy(&pt);
+        heap_check_empty();
+    }
+    return 0;
+}
@@ -0,0 +1,108 @@
+/* File-backed pool: a heap built from offsets survives pool_close() and a
+   reopen at a different address, and files that are not pools of this
+   layout are refused.
+   Build: cc -O2 -pthread tests/test_persist.c -o test_persist */
+#define POOL_SIZE       (1 << 18)
+#define BUDDY_MAX_ORDER 18
+#include "../mmu.h"
+#include "heap_check.h"
+
+#define NODES 500
+
+/* a singly linked list whose links are pool offsets */
+typedef struct node {
+    size_t next;   /* offset of the next node's payload, 0 = end */
+    uint32_t value;
+    char text[40];
+} Node;
+
+static Node* node_at(size_t off) {
+    return off ? (Node*)((char*)pool_base + off) : NULL;
+}
+
+/* the list head is kept in the first allocation of the pool */
+static size_t* list_head(void) {
+    return (size_t*)user_from_header(header_from_offset(0));
+}
+
+static void check_list(void) {
+    uint32_t n = 0;
+    for (Node *x = node_at(*list_head()); x; x = node_at(x->next), ++n) {
+        char want[40];
+        snprintf(want, sizeof(want), "node %u", x->value);
+        assert(x->value == NODES - 1 - n && strcmp(x->text, want) == 0);
+    }
+    assert(n == NODES);
+}
+
+int main(void) {
+    assert(init_pool_file("heap.pool") == 0);
+    assert(init_pool_file("heap.pool") == -1);   /* already open */
+    size_t *head = (size_t*)malloc_first_fit(sizeof(size_t));
+    assert(head == list_head());
+    *head = 0;
+    for (uint32_t i = 0; i < NODES; ++i) {
+        Node *x = (Node*)malloc_best_fit(sizeof(Node));
+        assert(x);
+        x->next = *head;
+        x->value = i;
+        snprintf(x->text, sizeof(x->text), "node %u", i);
+        *head = (size_t)((char*)x - (char*)pool_base);
+        if (i % 3 == 0) my_free(malloc_first_fit(100 + i));   /* leave some holes */
+    }
+    heap_check();
+    void *old_base = pool_base, *old_root = pool_root;
+    pool_close();
+
+    /* block the old address so the file is mapped somewhere else */
+    void *hold = mmap(old_root, POOL_MAP_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANON | MAP_FIXED_NOREPLACE, -1, 0);
+    assert(hold == old_root);
+    assert(init_pool_file("heap.pool") == 0);
+    assert(pool_base != old_base);
+    check_list();
+    heap_check();
+
+    /* it is a working heap: free half of the nodes, allocate new ones */
+    for (int round = 0; round < 3; ++round) {
+        Node *x = node_at(*list_head());
+        while (x && x->next) {
+            Node *gone = node_at(x->next);
+            x->next = gone->next;
+            my_free(gone);
+            x = node_at(x->next);
+        }
+        void *p = malloc_worst_fit(1000);
+        assert(p);
+        my_free(p);
+        heap_check();
+    }
+    pool_close();
+    munmap(hold, POOL_MAP_SIZE);
+
+    /* reopened at whatever address: the changes stuck */
+    assert(init_pool_file("heap.pool") == 0);
+    size_t n = 0;
+    for (Node *x = node_at(*list_head()); x; x = node_at(x->next)) n++;
+    assert(n == (NODES + 7) / 8);
+    heap_check();
+    pool_close();
+
+    /* wrong size, foreign content */
+    int fd = open("short.pool", O_RDWR | O_CREAT | O_TRUNC, 0600);
+    assert(fd >= 0 && ftruncate(fd, POOL_MAP_SIZE / 2) == 0);
+    close(fd);
+    assert(init_pool_file("short.pool") == -1);
+    fd = open("junk.pool", O_RDWR | O_CREAT | O_TRUNC, 0600);
+    assert(fd >= 0 && ftruncate(fd, POOL_MAP_SIZE) == 0 && write(fd, "not a pool", 10) == 10);
+    close(fd);
+    assert(init_pool_file("junk.pool") == -1);
+    assert(!pool_initialized);
+
+    /* an empty file is formatted */
+    fd = open("empty.pool", O_RDWR | O_CREAT | O_TRUNC, 0600);
+    close(fd);
+    assert(init_pool_file("empty.pool") == 0);
+    heap_check_empty();
+    pool_close();
+    return 0;
+}
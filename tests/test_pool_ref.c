@@ -0,0 +1,100 @@
+/* 32-bit pool references: every allocator returns 16-byte aligned
+   payloads, refs round-trip to pointers, 0 is null, and a tree linked by
+   refs survives a reopen of a file pool at another address.
+   Build: cc -O2 -pthread tests/test_pool_ref.c -o test_pool_ref */
+#define POOL_SIZE       (1 << 20)
+#define BUDDY_MAX_ORDER 20
+#include "../mmu.h"
+#include "heap_check.h"
+
+/* a binary search tree with 32-bit links */
+typedef struct tnode {
+    pool_ref_t left, right;
+    uint32_t key;
+} TNode;
+
+static TNode* tn(pool_ref_t r) {
+    return (TNode*)pool_ref_ptr(r);
+}
+
+static pool_ref_t insert(pool_ref_t root, uint32_t key) {
+    pool_ref_t r = pool_ref_alloc(sizeof(TNode));
+    assert(r);
+    tn(r)->left = tn(r)->right = 0;
+    tn(r)->key = key;
+    if (!root) return r;
+    for (pool_ref_t cur = root;;) {
+        pool_ref_t *link = key < tn(cur)->key ? &tn(cur)->left : &tn(cur)->right;
+        if (!*link) {
+            *link = r;
+            return root;
+        }
+        cur = *link;
+    }
+}
+
+/* in-order walk: checks ordering, returns the node count */
+static size_t walk(pool_ref_t r, uint32_t *last) {
+    if (!r) return 0;
+    size_t n = walk(tn(r)->left, last);
+    assert(tn(r)->key >= *last);
+    *last = tn(r)->key;
+    return n + 1 + walk(tn(r)->right, last);
+}
+
+static void free_tree(pool_ref_t r) {
+    if (!r) return;
+    free_tree(tn(r)->left);
+    free_tree(tn(r)->right);
+    pool_ref_free(r);
+}
+
+int main(void) {
+    assert(pool_ref_of(NULL) == 0 && pool_ref_ptr(0) == NULL);
+    pool_ref_free(0);
+
+    /* payloads of every allocator are aligned, so every one has a ref */
+    void *ps[5];
+    for (size_t size = 1; size < 3000; size = size * 3 + 1) {
+        ps[0] = malloc_first_fit(size);
+        ps[1] = malloc_next_fit(size);
+        ps[2] = malloc_best_fit(size);
+        ps[3] = malloc_worst_fit(size);
+        ps[4] = my_calloc(1, size);
+        for (int i = 0; i < 5; ++i) {
+            assert(ps[i] && (uintptr_t)ps[i] % POOL_ALIGN == 0);
+            assert(pool_ref_of(ps[i]) != 0 && pool_ref_ptr(pool_ref_of(ps[i])) == ps[i]);
+        }
+        for (int i = 0; i < 5; ++i) my_free(ps[i]);
+    }
+    heap_check_empty();
+    void *b = malloc_buddy_alloc(100);
+    assert((uintptr_t)b % POOL_ALIGN == 0 && pool_ref_ptr(pool_ref_of(b)) == b);
+    my_free(b);
+    heap_check_empty();
+
+    /* a tree linked by refs, in a file pool reopened elsewhere */
+    pool_close();
+    assert(init_pool_file("refs.pool") == 0);
+    pool_ref_t *root = (pool_ref_t*)malloc_first_fit(sizeof(pool_ref_t));
+    *root = 0;
+    for (int i = 0; i < 5000; ++i) *root = insert(*root, test_rand());
+    uint32_t last = 0;
+    assert(walk(*root, &last) == 5000);
+    size_t root_off = (size_t)((char*)root - (char*)pool_base);
+    void *old_root = pool_root;
+    pool_close();
+
+    void *hold = mmap(old_root, POOL_MAP_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANON | MAP_FIXED_NOREPLACE, -1, 0);
+    assert(hold == old_root);
+    assert(init_pool_file("refs.pool") == 0 && (void*)pool_root != old_root);
+    root = (pool_ref_t*)((char*)pool_base + root_off);
+    last = 0;
+    assert(walk(*root, &last) == 5000);
+    free_tree(*root);
+    my_free(root);
+    heap_check_empty();
+    pool_close();
+    munmap(hold, POOL_MAP_SIZE);
+    return 0;
+}
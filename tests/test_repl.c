@@ -0,0 +1,224 @@
+/* Page replacement engine: every policy faults exactly as a naive model of
+   it on mixed traces, OPT is a lower bound, the reported frame and victim
+   describe a consistent page -> frame mapping, and the textbook Belady
+   trace gives the textbook counts.
+   Build: cc -O2 -pthread tests/test_repl.c -o test_repl */
+#define POOL_SIZE       (1 << 20)
+#define BUDDY_MAX_ORDER 20
+#include "../mmu.h"
+#include "heap_check.h"
+
+#define MAXF   256
+#define TRACE  6000
+
+/* ---- naive models: arrays and linear scans ---- */
+static uint64_t frame_page[MAXF], frame_key[MAXF], frame_key2[MAXF];
+
+static int naive_find(int used, uint64_t page) {
+    for (int f = 0; f < used; ++f)
+        if (frame_page[f] == page) return f;
+    return -1;
+}
+
+static size_t naive(int policy, int frames, const uint64_t *t, size_t n) {
+    int used = 0, hand = 0;
+    size_t faults = 0;
+    for (size_t i = 0; i < n; ++i) {
+        int f = naive_find(used, t[i]);
+        if (f >= 0) {
+            if (policy == REPL_LRU) frame_key[f] = i;
+            if (policy == REPL_CLOCK) frame_key[f] = 1;
+            if (policy == REPL_LFU) {
+                frame_key[f]++;
+                frame_key2[f] = i;
+            }
+            continue;
+        }
+        faults++;
+        if (used < frames) {
+            f = used++;
+        } else if (policy == REPL_FIFO) {
+            f = hand;
+            hand = (hand + 1) % frames;
+        } else if (policy == REPL_CLOCK) {
+            while (frame_key[hand]) {
+                frame_key[hand] = 0;
+                hand = (hand + 1) % frames;
+            }
+            f = hand;
+            hand = (hand + 1) % frames;
+        } else if (policy == REPL_OPT) {
+            size_t best = 0;
+            for (int j = 0; j < frames; ++j) {
+                size_t k = i + 1;
+                while (k < n && t[k] != frame_page[j]) k++;
+                if (k > best) {
+                    best = k;
+                    f = j;
+                }
+            }
+        } else {   /* LRU, LFU: smallest (key, key2) */
+            f = 0;
+            for (int j = 1; j < frames; ++j)
+                if (frame_key[j] < frame_key[f] || (frame_key[j] == frame_key[f] && frame_key2[j] < frame_key2[f])) f = j;
+        }
+        frame_page[f] = t[i];
+        frame_key[f] = policy == REPL_LRU ? i : 1;
+        frame_key2[f] = i;
+    }
+    return faults;
+}
+
+/* ARC as in the paper, with arrays kept most recent first */
+typedef struct { uint64_t a[2 * MAXF]; int n; } List;
+static List T1, T2, B1, B2;
+static int arc_p;
+
+static int list_find(List *l, uint64_t page) {
+    for (int i = 0; i < l->n; ++i)
+        if (l->a[i] == page) return i;
+    return -1;
+}
+static void list_del(List *l, int i) {
+    memmove(l->a + i, l->a + i + 1, (size_t)(l->n - i - 1) * sizeof(uint64_t));
+    l->n--;
+}
+static void list_push(List *l, uint64_t page) {
+    memmove(l->a + 1, l->a, (size_t)l->n * sizeof(uint64_t));
+    l->a[0] = page;
+    l->n++;
+}
+static uint64_t list_pop_lru(List *l) {
+    return l->a[--l->n];
+}
+static void model_arc_replace(int in_b2) {
+    if (T1.n > 0 && ((in_b2 && T1.n == arc_p) || T1.n > arc_p)) list_push(&B1, list_pop_lru(&T1));
+    else list_push(&B2, list_pop_lru(&T2));
+}
+
+static size_t model_arc(int c, const uint64_t *t, size_t n) {
+    T1.n = T2.n = B1.n = B2.n = 0;
+    arc_p = 0;
+    size_t faults = 0;
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t x = t[i];
+        int k;
+        if ((k = list_find(&T1, x)) >= 0) {
+            list_del(&T1, k);
+            list_push(&T2, x);
+            continue;
+        }
+        if ((k = list_find(&T2, x)) >= 0) {
+            list_del(&T2, k);
+            list_push(&T2, x);
+            continue;
+        }
+        faults++;
+        if ((k = list_find(&B1, x)) >= 0) {
+            int d = B2.n / B1.n > 1 ? B2.n / B1.n : 1;
+            arc_p = arc_p + d < c ? arc_p + d : c;
+            list_del(&B1, k);
+            model_arc_replace(0);
+            list_push(&T2, x);
+            continue;
+        }
+        if ((k = list_find(&B2, x)) >= 0) {
+            int d = B1.n / B2.n > 1 ? B1.n / B2.n : 1;
+            arc_p = arc_p > d ? arc_p - d : 0;
+            list_del(&B2, k);
+            model_arc_replace(1);
+            list_push(&T2, x);
+            continue;
+        }
+        if (T1.n + B1.n == c) {
+            if (T1.n < c) {
+                list_pop_lru(&B1);
+                model_arc_replace(0);
+            } else {
+                list_pop_lru(&T1);
+            }
+        } else if (T1.n + T2.n + B1.n + B2.n >= c) {
+            if (T1.n + T2.n + B1.n + B2.n == 2 * c) list_pop_lru(&B2);
+            model_arc_replace(0);
+        }
+        list_push(&T1, x);
+    }
+    return faults;
+}
+
+/* ---- engine runs ---- */
+
+/* run with the engine, checking frame/victim against a page -> frame map */
+static size_t checked_run(int policy, uint32_t frames, const uint64_t *t, size_t n, uint64_t pages) {
+    static uint32_t where[TRACE];   /* page -> frame + 1 */
+    ReplEngine e;
+    assert(repl_init(&e, frames, policy) == 0);
+    if (policy == REPL_OPT) assert(repl_set_future(&e, t, n) == 0);
+    memset(where, 0, pages * sizeof(uint32_t));
+    uint32_t resident = 0;
+    for (size_t i = 0; i < n; ++i) {
+        int hit = repl_access(&e, t[i]);
+        assert(hit >= 0 && e.frame < frames);
+        if (hit) {
+            assert(where[t[i]] == e.frame + 1 && e.victim == REPL_NO_PAGE);
+            continue;
+        }
+        assert(!where[t[i]]);
+        if (e.victim != REPL_NO_PAGE) {
+            assert(e.victim != t[i] && where[e.victim] == e.frame + 1);
+            where[e.victim] = 0;
+        } else {
+            resident++;
+        }
+        where[t[i]] = e.frame + 1;
+    }
+    assert(resident == e.used && resident <= frames);
+    assert(e.accesses == n && e.faults == e.used + e.evictions);
+    size_t faults = e.faults;
+    if (policy == REPL_OPT) assert(repl_access(&e, t[0]) == -1);   /* past its trace */
+    repl_destroy(&e);
+    return faults;
+}
+
+int main(void) {
+    ReplEngine e;
+    assert(repl_init(&e, 0, REPL_LRU) == -1);
+    assert(repl_init(&e, 4, REPL_POLICIES) == -1 && repl_init(&e, 4, -1) == -1);
+    assert(strcmp(repl_name(REPL_ARC), "ARC") == 0 && strcmp(repl_name(99), "?") == 0);
+
+    /* Belady's anomaly: FIFO faults more with four frames than with three */
+    static const uint64_t belady[12] = { 1, 2, 3, 4, 1, 2, 5, 1, 2, 3, 4, 5 };
+    assert(repl_run(REPL_FIFO, 3, belady, 12) == 9 && repl_run(REPL_FIFO, 4, belady, 12) == 10);
+    assert(repl_run(REPL_LRU, 3, belady, 12) == 10 && repl_run(REPL_LRU, 4, belady, 12) == 8);
+    assert(repl_run(REPL_OPT, 3, belady, 12) == 7 && repl_run(REPL_OPT, 4, belady, 12) == 6);
+
+    /* loops, a small hot set and uniform noise, phase by phase */
+    static uint64_t t[TRACE];
+    static const uint32_t sizes[] = { 1, 3, 7, 16, 63, 64, 65, 130, 200 };
+    for (int trial = 0; trial < 12; ++trial) {
+        uint64_t pages = 10 + (uint64_t)trial * 30;
+        for (size_t i = 0; i < TRACE; ++i) {
+            uint32_t r = test_rand();
+            int phase = (int)(i / 300 % 3);
+            t[i] = phase == 0 ? i % (pages / 2 + 1) : phase == 1 ? r % 8 : r % pages;
+        }
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+            uint32_t c = sizes[s];
+            size_t opt = checked_run(REPL_OPT, c, t, TRACE, pages);
+            for (int policy = 0; policy < REPL_POLICIES; ++policy) {
+                size_t got = checked_run(policy, c, t, TRACE, pages);
+                size_t want = policy == REPL_ARC ? model_arc((int)c, t, TRACE) : naive(policy, (int)c, t, TRACE);
+                if (got != want) {
+                    fprintf(stderr, "%s with %u frames: %zu faults, model says %zu\n", repl_name(policy), c, got, want);
+                    return 1;
+                }
+                assert(got >= opt && got == repl_run(policy, c, t, TRACE));
+            }
+        }
+    }
+
+    /* the engine lives outside the pool */
+    my_free(malloc_first_fit(1));
+    heap_check_empty();
+    return 0;
+}
@@ -0,0 +1,182 @@
+/* Multi-process shared heap: forked workers allocate messages in a memfd
+   pool and free each other's, unrelated mappings attach through the
+   descriptor or a shm name (also while its creator is still formatting
+   it), and a worker dying with the lock held is rolled back by the next
+   caller.
+   Build: cc -O2 -pthread tests/test_shared.c -o test_shared -lrt */
+#define POOL_SIZE       (1 << 18)
+#define BUDDY_MAX_ORDER 18
+#include "../mmu.h"
+#include "heap_check.h"
+#include <sys/wait.h>
+
+#define WORKERS 4
+#define MSGS    80
+
+/* outside the pool: message offsets published by each worker */
+typedef struct board {
+    size_t off[WORKERS][MSGS];
+    size_t len[WORKERS][MSGS];
+    size_t shm_off;
+    int go;
+} Board;
+
+static Board *board;
+
+static void wait_all(int n) {
+    for (int i = 0; i < n; ++i) {
+        int status;
+        assert(wait(&status) > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+}
+
+static unsigned char msg_byte(int w, int m, size_t k) {
+    return (unsigned char)(w * 31 + m * 7 + k);
+}
+
+static void produce(int w) {
+    for (int m = 0; m < MSGS; ++m) {
+        size_t len = 100 + (size_t)(m * 37 + w * 11) % 900;
+        unsigned char *p = (unsigned char*)(m % 2 ? malloc_first_fit(len) : malloc_best_fit(len));
+        assert(p);
+        for (size_t k = 0; k < len; ++k) p[k] = msg_byte(w, m, k);
+        board->len[w][m] = len;
+        board->off[w][m] = (size_t)(p - (unsigned char*)pool_base);
+    }
+}
+
+/* check and free the messages of worker `w`, while allocating a bit */
+static void consume(int w) {
+    for (int m = 0; m < MSGS; ++m) {
+        unsigned char *p = (unsigned char*)pool_base + board->off[w][m];
+        for (size_t k = 0; k < board->len[w][m]; ++k) assert(p[k] == msg_byte(w, m, k));
+        my_free(p);
+        my_free(malloc_first_fit(50 + (size_t)m));
+    }
+}
+
+static uint64_t layout_hash(void) {
+    uint64_t x = 1469598103934665603ull;
+    for (size_t off = 0; off < POOL_SIZE; ) {
+        Header *h = header_from_offset(off);
+        x = (x ^ off ^ (uint64_t)h->size << 20 ^ h->is_free) * 1099511628211ull;
+        off += sizeof(Header) + h->size;
+    }
+    return x;
+}
+
+int main(void) {
+    board = (Board*)mmap(NULL, sizeof(Board), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+    assert(board != MAP_FAILED);
+    assert(pool_shared_fd() == -1);
+    assert(init_pool_shared(NULL) == 0);
+    assert(init_pool_shared(NULL) == -1);
+    int fd = pool_shared_fd();
+    assert(fd >= 0);
+
+    /* workers allocate concurrently, then free the next worker's messages */
+    for (int w = 0; w < WORKERS; ++w) {
+        if (fork() == 0) {
+            produce(w);
+            _exit(0);
+        }
+    }
+    wait_all(WORKERS);
+    heap_check();
+    for (int w = 0; w < WORKERS; ++w) {
+        if (fork() == 0) {
+            consume((w + 1) % WORKERS);
+            _exit(0);
+        }
+    }
+    wait_all(WORKERS);
+    heap_check_empty();
+
+    /* a mapping made from the descriptor sees the same heap elsewhere */
+    unsigned char *p = (unsigned char*)malloc_first_fit(5000);
+    memset(p, 0x77, 5000);
+    size_t off = (size_t)(p - (unsigned char*)pool_base);
+    if (fork() == 0) {
+        void *old = pool_root;
+        pool_root = NULL;
+        pool_base = NULL;
+        pool_initialized = 0;
+        int dup_fd = dup(fd);
+        assert(pool_attach_fd(dup_fd) == 0 && (void*)pool_root != old);
+        unsigned char *q = (unsigned char*)pool_base + off;
+        for (int k = 0; k < 5000; ++k) assert(q[k] == 0x77);
+        my_free(q);
+        _exit(0);
+    }
+    wait_all(1);
+    heap_check_empty();
+
+    /* a worker dies holding the lock in the middle of its calls */
+    uint64_t before = layout_hash();
+    if (fork() == 0) {
+        pool_txn_begin();
+        for (int m = 0; m < 20; ++m) malloc_first_fit(100 + (size_t)m * 10);
+        _exit(0);
+    }
+    wait_all(1);
+    my_free(malloc_first_fit(10));   /* EOWNERDEAD: the dead worker's calls are undone first */
+    assert(layout_hash() == before);
+    heap_check_empty();
+    pool_close();
+
+    /* named pools: the first process creates it, later ones attach */
+    char name[64];
+    snprintf(name, sizeof(name), "/mmu-test-%d", (int)getpid());
+    if (fork() == 0) {
+        assert(init_pool_shared(name) == 0);
+        char *s = (char*)malloc_first_fit(32);
+        strcpy(s, "hello from the creator");
+        board->shm_off = (size_t)(s - (char*)pool_base);
+        _exit(0);
+    }
+    wait_all(1);
+    assert(init_pool_shared(name) == 0);
+    assert(strcmp((char*)pool_base + board->shm_off, "hello from the creator") == 0);
+    my_free((char*)pool_base + board->shm_off);
+    heap_check_empty();
+    pool_close();
+    shm_unlink(name);
+
+    /* attaching while the creator has not sized, or not formatted, the object yet */
+    for (int sized = 0; sized < 2; ++sized) {
+        int shm = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        assert(shm >= 0 && (!sized || ftruncate(shm, (off_t)POOL_MAP_SIZE) == 0));
+        if (fork() == 0) {
+            assert(init_pool_shared(name) == 0);
+            my_free(malloc_first_fit(100));
+            heap_check_empty();
+            _exit(0);
+        }
+        struct timespec slow = { 0, 50 * 1000 * 1000 };
+        nanosleep(&slow, NULL);
+        assert(map_pool_fd(shm, 1, 0) == 0);
+        pool_fd = shm;
+        wait_all(1);
+        heap_check_empty();
+        pool_close();
+        shm_unlink(name);
+    }
+
+    /* every process starts at once; exactly one of them creates the pool */
+    for (int w = 0; w < WORKERS; ++w) {
+        if (fork() == 0) {
+            while (!__atomic_load_n(&board->go, __ATOMIC_ACQUIRE)) sched_yield();
+            assert(init_pool_shared(name) == 0);
+            produce(w);
+            _exit(0);
+        }
+    }
+    __atomic_store_n(&board->go, 1, __ATOMIC_RELEASE);
+    wait_all(WORKERS);
+    assert(init_pool_shared(name) == 0);
+    for (int w = 0; w < WORKERS; ++w) consume(w);
+    heap_check_empty();
+    pool_close();
+    shm_unlink(name);
+    return 0;
+}
@@ -0,0 +1,119 @@
+/* Slab arena and meshing: objects keep their contents and addresses when
+   sparse pages are meshed, every page is released once its objects are
+   freed, concurrent threads can allocate, free and mesh, and a write
+   through a raw pointer while its page is meshed is not lost.
+   Build: cc -O2 -pthread tests/test_slab.c -o test_slab */
+#include "../mmu.h"
+#include "heap_check.h"
+#include <pthread.h>
+
+#define N 2000
+#define THREADS 4
+
+static void *ps[N];
+static unsigned char tag[N];
+
+static void check_contents(size_t size) {
+    for (int i = 0; i < N; ++i)
+        if (ps[i])
+            for (size_t k = 0; k < size; ++k) assert(((unsigned char*)ps[i])[k] == tag[i]);
+}
+
+/* writes an increasing count into every live object until told to stop */
+#define WOBJS 48
+static void *wobj[WOBJS];
+static uint64_t wlast[WOBJS];
+static volatile int wstop, wstarted;
+
+static void* writer(void *arg) {
+    (void)arg;
+    for (uint64_t c = 1; !__atomic_load_n(&wstop, __ATOMIC_ACQUIRE); ++c) {
+        for (int k = 0; k < WOBJS; ++k) {
+            if (!wobj[k]) continue;
+            *(volatile uint64_t*)wobj[k] = c;
+            wlast[k] = c;
+        }
+        __atomic_store_n(&wstarted, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void* churn(void *arg) {
+    void *mine[200];
+    size_t size = (size_t)(uintptr_t)arg;
+    for (int round = 0; round < 200; ++round) {
+        for (int i = 0; i < 200; ++i) assert((mine[i] = malloc_slab(size)) != NULL);
+        for (int i = 0; i < 200; ++i) my_free(mine[i]);
+    }
+    return NULL;
+}
+
+int main(void) {
+    assert(malloc_slab(0) == NULL && malloc_slab(SLAB_MAX_OBJ + 1) == NULL);
+
+    for (int i = 0; i < N; ++i) {
+        assert((ps[i] = malloc_slab(48)) != NULL);
+        tag[i] = (unsigned char)test_rand();
+        memset(ps[i], tag[i], 48);
+    }
+    size_t full = slab_resident_pages();
+    for (int i = 0; i < N; ++i) {
+        if (test_rand() % 10) {
+            my_free(ps[i]);
+            ps[i] = NULL;
+        }
+    }
+    size_t meshed = mesh_slab_pages();
+    assert(meshed > 0 && slab_resident_pages() == full - meshed);
+    check_contents(48);
+
+    /* meshed pages still take new objects and mesh again */
+    for (int i = 0; i < N; ++i) {
+        if (!ps[i] && test_rand() % 3 == 0 && (ps[i] = malloc_slab(48)) != NULL) {
+            tag[i] = (unsigned char)test_rand();
+            memset(ps[i], tag[i], 48);
+        }
+    }
+    check_contents(48);
+    mesh_slab_pages();
+    check_contents(48);
+    for (int i = 0; i < N; ++i) my_free(ps[i]);
+    assert(slab_resident_pages() == 0);
+
+    /* allocation, free and meshing from several threads */
+    pthread_t th[THREADS];
+    for (int t = 0; t < THREADS; ++t)
+        pthread_create(&th[t], NULL, churn, (void*)(uintptr_t)(16 << (t % 3)));
+    for (int i = 0; i < 1000; ++i) mesh_slab_pages();
+    for (int t = 0; t < THREADS; ++t) pthread_join(th[t], NULL);
+    assert(slab_resident_pages() == 0);
+
+    /* 1 KB objects written from another thread while their pages are meshed */
+    size_t meshes = 0;
+    for (int round = 0; round < 100; ++round) {
+        for (int k = 0; k < WOBJS; ++k) {
+            assert((wobj[k] = malloc_slab(1024)) != NULL);
+            *(uint64_t*)wobj[k] = wlast[k] = 0;
+        }
+        for (int k = 0; k < WOBJS; ++k) {
+            if (test_rand() % 3) {
+                my_free(wobj[k]);
+                wobj[k] = NULL;
+            }
+        }
+        pthread_t w;
+        wstop = wstarted = 0;
+        pthread_create(&w, NULL, writer, NULL);
+        while (!__atomic_load_n(&wstarted, __ATOMIC_ACQUIRE)) sched_yield();
+        meshes += mesh_slab_pages();
+        __atomic_store_n(&wstop, 1, __ATOMIC_RELEASE);
+        pthread_join(w, NULL);
+        for (int k = 0; k < WOBJS; ++k) {
+            if (!wobj[k]) continue;
+            assert(*(uint64_t*)wobj[k] == wlast[k]);
+            my_free(wobj[k]);
+        }
+    }
+    assert(meshes > 0 && slab_resident_pages() == 0);
+    return 0;
+}
@@ -0,0 +1,119 @@
+/* Heap snapshots: an image of a buddy heap and of a fit heap restores to
+   the same blocks and contents, is sparse where the heap is free, and a
+   checkpoint taken while the parent keeps writing shows the heap as it was
+   at the fork.
+   Build: cc -O2 -pthread tests/test_snapshot.c -o test_snapshot */
+#define POOL_SIZE       (1 << 20)
+#define BUDDY_MAX_ORDER 20
+#include "../mmu.h"
+#include "heap_check.h"
+
+#define N 64
+
+static size_t offs[N], lens[N];
+
+static unsigned char byte_at(int i, size_t k) {
+    return (unsigned char)(i * 13 + k * 5 + 1);
+}
+
+static void fill(int i, void *p, size_t len) {
+    offs[i] = (size_t)((char*)p - (char*)pool_base);
+    lens[i] = len;
+    for (size_t k = 0; k < len; ++k) ((unsigned char*)p)[k] = byte_at(i, k);
+}
+
+static void check_contents(void) {
+    for (int i = 0; i < N; ++i) {
+        if (!lens[i]) continue;
+        unsigned char *p = (unsigned char*)pool_base + offs[i];
+        assert(!header_from_user(p)->is_free);
+        for (size_t k = 0; k < lens[i]; ++k) assert(p[k] == byte_at(i, k));
+    }
+}
+
+static size_t disk_bytes(const char *path) {
+    struct stat st;
+    assert(stat(path, &st) == 0 && (size_t)st.st_size == POOL_MAP_SIZE);
+    return (size_t)st.st_blocks * 512;
+}
+
+int main(void) {
+    /* buddy heap: blocks of mixed orders with free buddies between them */
+    void *spare[N];
+    for (int i = 0; i < N; ++i) {
+        size_t len = (size_t)64 << (i % 8);
+        void *p = malloc_buddy_alloc(len);
+        assert(p);
+        if (i % 3 == 0) {
+            spare[i] = p;   /* freed before the save */
+        } else {
+            spare[i] = NULL;
+            fill(i, p, len);
+        }
+    }
+    for (int i = 0; i < N; ++i) if (spare[i]) my_free(spare[i]);
+    heap_check();
+    assert(pool_snapshot_save("buddy.img") == 0);
+    pool_close();
+
+    assert(pool_snapshot_load("buddy.img") == 0);
+    assert(pool_snapshot_load("buddy.img") == -1);
+    heap_check();
+    check_contents();
+    /* the freed blocks are buddy blocks again */
+    for (int i = 0; i < N; i += 3) assert(malloc_buddy_alloc((size_t)64 << (i % 8)));
+    heap_check();
+    pool_close();
+    memset(lens, 0, sizeof(lens));
+
+    /* fit heap: small live blocks spread over a mostly free pool */
+    void *gap[N];
+    for (int i = 0; i < N; ++i) {
+        size_t len = 200 + (size_t)i * 30;
+        fill(i, malloc_first_fit(len), len);
+        gap[i] = malloc_first_fit(12000);
+        assert(gap[i]);
+    }
+    for (int i = 0; i < N; ++i) my_free(gap[i]);
+    heap_check();
+    assert(pool_snapshot_save("fit.img") == 0);
+    assert(disk_bytes("fit.img") < POOL_MAP_SIZE / 2);
+    pool_close();
+
+    assert(pool_snapshot_load("fit.img") == 0);
+    heap_check();
+    check_contents();
+
+    /* a checkpoint sees the heap frozen at the fork */
+    pid_t pid = pool_checkpoint("ckpt.img");
+    assert(pid > 0);
+    for (int i = 0; i < N; ++i) memset((char*)pool_base + offs[i], 0xee, lens[i]);
+    void *extra = malloc_best_fit(5000);
+    assert(extra);
+    assert(pool_checkpoint_wait(pid, 0) == 0);
+    assert(access("ckpt.img.tmp", F_OK) != 0);
+    pool_close();
+
+    assert(pool_snapshot_load("ckpt.img") == 0);
+    heap_check();
+    check_contents();
+    for (int i = 0; i < N; ++i) my_free((char*)pool_base + offs[i]);
+    heap_check_empty();
+
+    /* an empty fit heap is one buddy block of the maximum order again */
+    void *all = malloc_buddy_alloc(POOL_SIZE - sizeof(Header));
+    assert(all == user_from_header(header_from_offset(0)) && !free_list_head());
+    assert(malloc_first_fit(16) == NULL);
+    my_free(all);
+    heap_check_empty();
+    pool_close();
+
+    /* images of another layout or size are refused */
+    int fd = open("bad.img", O_RDWR | O_CREAT | O_TRUNC, 0600);
+    assert(fd >= 0 && ftruncate(fd, POOL_MAP_SIZE) == 0);
+    close(fd);
+    assert(pool_snapshot_load("bad.img") == -1);
+    assert(truncate("fit.img", POOL_MAP_SIZE / 2) == 0);
+    assert(pool_snapshot_load("fit.img") == -1);
+    return 0;
+}
@@ -0,0 +1,81 @@
+/* Stack distances: every distance matches a move-to-front stack, also
+   across window compactions and growth, and one pass predicts the misses
+   of an LRU memory of every size exactly as the replacement engine counts
+   them.
+   Build: cc -O2 -pthread tests/test_stack_dist.c -o test_stack_dist */
+#define POOL_SIZE       (1 << 20)
+#define BUDDY_MAX_ORDER 20
+#include "../mmu.h"
+#include "heap_check.h"
+
+#define PAGES 64
+#define REFS  300000   /* several windows of 64K slots */
+
+/* distance by brute force: position in a most-recent-first stack, plus one */
+static uint64_t mtf[PAGES];
+static int mtf_n;
+
+static uint64_t mtf_access(uint64_t page) {
+    int i = 0;
+    while (i < mtf_n && mtf[i] != page) i++;
+    uint64_t d = i < mtf_n ? (uint64_t)i + 1 : SD_COLD;
+    if (i == mtf_n) mtf_n++;
+    memmove(mtf + 1, mtf, (size_t)i * sizeof(uint64_t));
+    mtf[0] = page;
+    return d;
+}
+
+int main(void) {
+    StackDist s;
+
+    /* a b c a b b d a: 0 0 0 3 3 1 0 3 */
+    static const uint64_t small[8] = { 10, 11, 12, 10, 11, 11, 13, 10 };
+    static const uint64_t dist[8] = { 0, 0, 0, 3, 3, 1, 0, 3 };
+    assert(sd_init(&s, 2) == 0);
+    for (int i = 0; i < 8; ++i) assert(sd_access(&s, small[i]) == dist[i]);
+    assert(s.refs == 8 && s.cold == 4 && s.hist[1] == 1 && s.hist[2] == 0 && s.beyond == 3);
+    assert(sd_misses(&s, 1) == 7 && sd_misses(&s, 2) == 7 && sd_misses(&s, 3) == 7);
+    sd_destroy(&s);
+
+    /* exact distances over many compactions of the window */
+    static uint64_t t[REFS];
+    assert(sd_init(&s, PAGES) == 0);
+    for (size_t i = 0; i < REFS; ++i) {
+        uint32_t r = test_rand();
+        t[i] = (i / 5000) % 2 ? r % PAGES : i % (PAGES / 3) + (r % 7 == 0 ? r % (PAGES - PAGES / 3) : 0);
+        assert(sd_access(&s, t[i]) == mtf_access(t[i]));
+    }
+    assert(s.pages == (uint64_t)mtf_n && s.beyond == 0 && s.window == 1 << 16);
+
+    /* one pass gives the LRU miss count of every size */
+    for (uint32_t size = 1; size <= PAGES + 1; ++size)
+        assert(sd_misses(&s, size) == repl_run(REPL_LRU, size, t, REFS));
+    sd_destroy(&s);
+
+    /* sizes above max_dist: distances past it still count as misses */
+    assert(sd_init(&s, 8) == 0);
+    for (size_t i = 0; i < REFS; ++i) sd_access(&s, t[i]);
+    assert(sd_misses(&s, 8) == repl_run(REPL_LRU, 8, t, REFS));
+    assert(sd_misses(&s, 32) == sd_misses(&s, 8) && sd_misses(&s, 32) >= repl_run(REPL_LRU, 32, t, REFS));
+    sd_destroy(&s);
+
+    /* a cycle over more pages than half the window makes it (and the hash) grow */
+    const uint64_t cycle = 50000;
+    assert(sd_init(&s, (uint32_t)cycle) == 0);
+    for (uint64_t i = 0; i < 4 * cycle; ++i) assert(sd_access(&s, i % cycle * 4096) == (i < cycle ? SD_COLD : cycle));
+    assert(s.window > 1 << 16 && s.pages == cycle && s.hist[cycle] == 3 * cycle);
+    assert(sd_misses(&s, cycle - 1) == 4 * cycle && sd_misses(&s, cycle) == cycle);
+    sd_destroy(&s);
+
+    /* max_dist 0 only counts */
+    assert(sd_init(&s, 0) == 0);
+    for (int i = 0; i < 100; ++i) sd_access(&s, (uint64_t)i % 3);
+    sd_access(&s, 2);
+    assert(s.refs == 101 && s.cold == 3 && s.beyond == 98 && sd_misses(&s, 1000) == 101);
+    sd_destroy(&s);
+
+    /* the simulator lives outside the pool */
+    my_free(malloc_first_fit(1));
+    heap_check_empty();
+    return 0;
+}
@@ -0,0 +1,95 @@
+/* Two-tier pool: handle allocations beyond the pool spill into the slow
+   tier instead of failing, contents survive demotion, promotion and
+   slow-log compaction, and rebalancing follows access counts.
+   Build: cc -O2 -pthread tests/test_tier.c -o test_tier */
+#define POOL_SIZE       (1 << 16)
+#define BUDDY_MAX_ORDER 16
+#include "../mmu.h"
+#include "heap_check.h"
+
+#define SLOTS 48
+#define BLOCK 4000
+
+static mem_handle_t hs[SLOTS];
+static unsigned char tag[SLOTS];
+
+static void fill(int i) {
+    assert((hs[i] = handle_alloc(BLOCK)) != 0);
+    tag[i] = (unsigned char)(test_rand() | 1);
+    memset(handle_lock(hs[i]), tag[i], handle_size(hs[i]));
+    handle_unlock(hs[i]);
+}
+
+static void check(int i) {
+    unsigned char *p = (unsigned char*)handle_lock(hs[i]);
+    assert(handle_size(hs[i]) >= BLOCK);
+    for (size_t k = 0; k < handle_size(hs[i]); ++k) assert(p[k] == tag[i]);
+    handle_unlock(hs[i]);
+}
+
+static int count_tier(int tier) {
+    int n = 0;
+    for (int i = 0; i < SLOTS; ++i) n += hs[i] && handle_tier(hs[i]) == tier;
+    return n;
+}
+
+int main(void) {
+    assert(handle_tier(0) == TIER_NONE);
+
+    /* without a slow tier the pool simply runs out */
+    int n = 0;
+    while (n < SLOTS && (hs[n] = handle_alloc(BLOCK)) != 0) n++;
+    assert(n > 0 && n < SLOTS);
+    for (int i = 0; i < n; ++i) handle_free(hs[i]);
+    memset(hs, 0, sizeof(hs));
+    heap_check_empty();
+
+    assert(tier_attach("tier.slow", 1 << 20) == 0);
+    assert(tier_attach("tier.slow", 1 << 20) == -1);
+
+    /* three pools' worth of handles: the coldest ones are demoted */
+    for (int i = 0; i < SLOTS; ++i) fill(i);
+    int slow = count_tier(TIER_SLOW);
+    assert(slow > 0 && count_tier(TIER_FAST) + slow == SLOTS);
+    heap_check();
+
+    /* a pinned slow handle is used in place */
+    int pinned = -1;
+    for (int i = 0; i < SLOTS && pinned < 0; ++i) if (handle_tier(hs[i]) == TIER_SLOW) pinned = i;
+    unsigned char *in_file = (unsigned char*)handle_lock(hs[pinned]);
+    assert(handle_tier(hs[pinned]) == TIER_SLOW && in_file[0] == tag[pinned]);
+
+    /* churn: frees leave dead records, new allocations demote more and
+       compact the slow log around the pinned record */
+    for (int round = 0; round < 20; ++round) {
+        for (int i = 0; i < SLOTS; ++i) {
+            if (i == pinned || test_rand() % 3) continue;
+            handle_free(hs[i]);
+            fill(i);
+        }
+        assert(handle_lock(hs[pinned]) == in_file);
+        handle_unlock(hs[pinned]);
+        heap_check();
+    }
+    handle_unlock(hs[pinned]);
+    for (int i = 0; i < SLOTS; ++i) check(i);
+
+    /* rebalance: once access counts decay, untouched fast handles are
+       demoted until the pool has its reserve back */
+    assert(pool_free_bytes() < TIER_FAST_RESERVE);
+    for (int r = 0; r < 8; ++r) tier_rebalance();
+    assert(pool_free_bytes() >= TIER_FAST_RESERVE);
+    heap_check();
+
+    /* and a slow handle in use comes back: locking promotes it once it fits */
+    int hot = -1;
+    for (int i = 0; i < SLOTS && hot < 0; ++i) if (handle_tier(hs[i]) == TIER_SLOW) hot = i;
+    for (int a = 0; a < TIER_HOT_ACCESSES; ++a) check(hot);
+    tier_rebalance();
+    assert(handle_tier(hs[hot]) == TIER_FAST);
+    heap_check();
+
+    for (int i = 0; i < SLOTS; ++i) if (hs[i]) { check(i); handle_free(hs[i]); }
+    heap_check_empty();
+    return 0;
+}
@@ -0,0 +1,112 @@
+/* TLB model: translations through the TLB match the page table, a set
+   evicts by its policy, ways that do not fill a SIMD vector match only
+   real entries, large pages use their own array or are splintered, and
+   ASIDs, invalidation and flushes drop exactly the right entries.
+   Build: cc -O2 -pthread tests/test_tlb.c -o test_tlb (add -mavx2 or
+   -msse4.1 to check the vector tag match) */
+#define POOL_SIZE       (1 << 20)
+#define BUDDY_MAX_ORDER 20
+#include "../mmu.h"
+#include "heap_check.h"
+
+#define BASE 0x7f0000000000ull
+#define PHYS 0x100000000ull
+
+static uint64_t walks_for(Tlb *t, const PageTable *pt, uint64_t va, uint16_t asid) {
+    uint64_t pa, w = t->walks;
+    assert(tlb_translate(t, pt, va, asid, &pa));
+    return t->walks - w;
+}
+
+/* one set of four ways: which page does the fifth one push out? */
+static void check_policy(const PageTable *pt, int policy) {
+    Tlb t;
+    TlbConfig cfg[TLB_SIZES] = { { 4, 4 }, { 0, 0 }, { 0, 0 } };
+    assert(tlb_init(&t, cfg, policy) == 0);
+    for (int p = 0; p < 4; ++p) assert(walks_for(&t, pt, BASE + (uint64_t)p * 4096, 1) == 1);
+    assert(walks_for(&t, pt, BASE, 1) == 0);                /* page 0 is used again */
+    assert(walks_for(&t, pt, BASE + 4 * 4096, 1) == 1);     /* page 4 evicts one */
+    if (policy == TLB_LRU) {
+        assert(walks_for(&t, pt, BASE, 1) == 0);
+        assert(walks_for(&t, pt, BASE + 4096, 1) == 1);     /* least recently used */
+    } else {
+        assert(walks_for(&t, pt, BASE + 4096, 1) == 0);
+        assert(walks_for(&t, pt, BASE, 1) == 1);            /* first in */
+    }
+    tlb_destroy(&t);
+}
+
+int main(void) {
+    PageTable pt;
+    Tlb t;
+    uint64_t pa;
+    assert(pt_init(&pt) == 0);
+    for (uint64_t v = 0; v < (4u << 20); v += 4096) assert(pt_map(&pt, BASE + v, PHYS + v, PT_SHIFT_4K, PT_WRITE) == 0);
+    uint64_t huge = BASE + (64ull << 20), giant = 0x7e0000000000ull;
+    for (uint64_t v = 0; v < (8u << 20); v += 2u << 20)
+        assert(pt_map(&pt, huge + v, 2 * PHYS + v, PT_SHIFT_2M, PT_WRITE) == 0);
+    assert(pt_map(&pt, giant, 4 * PHYS, PT_SHIFT_1G, PT_WRITE) == 0);
+
+    /* geometry: power-of-two sets, at least one array */
+    TlbConfig bad_sets[TLB_SIZES] = { { 48, 4 }, { 0, 0 }, { 0, 0 } };
+    TlbConfig no_ways[TLB_SIZES] = { { 64, 0 }, { 0, 0 }, { 0, 0 } };
+    TlbConfig empty[TLB_SIZES] = { { 0, 0 }, { 0, 0 }, { 0, 0 } };
+    assert(tlb_init(&t, bad_sets, TLB_LRU) == -1);
+    assert(tlb_init(&t, no_ways, TLB_LRU) == -1);
+    assert(tlb_init(&t, empty, TLB_LRU) == -1);
+
+    check_policy(&pt, TLB_LRU);
+    check_policy(&pt, TLB_FIFO);
+
+    /* random references with odd associativity agree with the page table */
+    int policies[3] = { TLB_LRU, TLB_FIFO, TLB_RANDOM };
+    for (int k = 0; k < 3; ++k) {
+        TlbConfig odd[TLB_SIZES] = { { 24, 3 }, { 10, 5 }, { 1, 1 } };
+        assert(tlb_init(&t, odd, policies[k]) == 0);
+        for (int i = 0; i < 200000; ++i) {
+            uint32_t r = test_rand();
+            uint64_t va = r % 3 == 0 ? huge + r % (8u << 20) : r % 3 == 1 ? giant + r % (1u << 30) : BASE + r % (4u << 20);
+            uint64_t ref;
+            int sh = tlb_translate(&t, &pt, va, 1, &pa);
+            assert(sh && sh == pt_translate(&pt, va, &ref, NULL) && pa == ref);
+        }
+        assert(t.lookups == 200000 && t.hits + t.walks == t.lookups && t.faults == 0);
+        assert(t.arr[0].hits + t.arr[1].hits + t.arr[2].hits == t.hits && t.arr[2].hits > 0);
+        tlb_destroy(&t);
+    }
+
+    /* 2 MB pages: one entry covers the page, or one per 4 KB when splintered */
+    TlbConfig with_2m[TLB_SIZES] = { { 64, 4 }, { 32, 4 }, { 0, 0 } };
+    TlbConfig only_4k[TLB_SIZES] = { { 64, 4 }, { 0, 0 }, { 0, 0 } };
+    assert(tlb_init(&t, with_2m, TLB_LRU) == 0);
+    for (uint64_t v = 0; v < (2u << 20); v += 4096) tlb_translate(&t, &pt, huge + v, 1, &pa);
+    assert(t.walks == 1 && t.arr[1].hits == 511);
+    tlb_destroy(&t);
+    assert(tlb_init(&t, only_4k, TLB_LRU) == 0);
+    assert(tlb_translate(&t, &pt, huge + 5000, 1, &pa) == PT_SHIFT_2M && pa == 2 * PHYS + 5000);
+    assert(walks_for(&t, &pt, huge + 4096 + 8, 1) == 0);   /* same 4 KB piece */
+    assert(walks_for(&t, &pt, huge + 8192, 1) == 1);       /* next piece */
+
+    /* ASIDs, invlpg and flushes */
+    assert(walks_for(&t, &pt, BASE, 1) == 1 && walks_for(&t, &pt, BASE, 1) == 0);
+    assert(walks_for(&t, &pt, BASE, 2) == 1 && walks_for(&t, &pt, BASE, 2) == 0);
+    assert(walks_for(&t, &pt, BASE + 4096, 1) == 1);
+    tlb_invalidate(&t, BASE + 100, 1);
+    assert(walks_for(&t, &pt, BASE, 2) == 0 && walks_for(&t, &pt, BASE + 4096, 1) == 0);
+    assert(walks_for(&t, &pt, BASE, 1) == 1);
+    tlb_flush_asid(&t, 1);
+    assert(walks_for(&t, &pt, BASE, 2) == 0);
+    assert(walks_for(&t, &pt, BASE, 1) == 1 && walks_for(&t, &pt, BASE + 4096, 1) == 1);
+    tlb_flush(&t);
+    assert(walks_for(&t, &pt, BASE, 2) == 1);
+
+    /* unmapped addresses fault and fill nothing */
+    uint64_t w = t.walks;
+    assert(tlb_translate(&t, &pt, 0x1000, 1, &pa) == 0 && tlb_translate(&t, &pt, 0x1000, 1, &pa) == 0);
+    assert(t.faults == 2 && t.walks == w + 2);
+    tlb_destroy(&t);
+
+    pt_destroy(&pt);
+    heap_check_empty();
+    return 0;
+}
@@ -0,0 +1,82 @@
+/* Page access tracking: untouched pages turn cold after PAGE_COLD_AGE
+   samples in both modes, a touch makes a page hot again, and
+   malloc_warm_fit() steers around free blocks on cold pages.
+   Build: cc -O2 -pthread tests/test_tracker.c -o test_tracker */
+#define POOL_SIZE       (1 << 18)
+#define BUDDY_MAX_ORDER 18
+#include "../mmu.h"
+#include "heap_check.h"
+
+#define COLD_BYTES (8 * POOL_PAGE_SIZE)
+
+static size_t page_of(const void *p) {
+    return (size_t)((const char*)p - (const char*)pool_base) / POOL_PAGE_SIZE;
+}
+
+/* A free block of COLD_BYTES at the front of the pool, followed by a small
+   block `hot` and the free rest of the pool. Sampling while only writing
+   to `hot` leaves the front block cold and the page right after `hot`
+   (where the free tail starts) hot. */
+static void run(int mode, char *front, char *hot) {
+    for (int s = 0; s <= PAGE_COLD_AGE; ++s) {
+        page_tracker_sample();
+        ((volatile char*)hot)[0]++;
+    }
+    assert(pool_ptr_class(hot) == PAGE_HOT);
+    for (size_t i = page_of(front) + 1; i < page_of(front + COLD_BYTES); ++i)
+        assert(pool_page_class(i) == PAGE_COLD);
+
+    /* a warm fit lands in the free tail next to `hot`, a plain first fit
+       would take the cold front block */
+    char *w = (char*)malloc_warm_fit(64);
+    assert(w && w > hot && page_of(w) == page_of(hot));
+    memset(w, 0x5a, 64);
+
+    /* touching a cold page makes it hot at the next sample */
+    char *c = front + 3 * POOL_PAGE_SIZE;
+    if (mode == TRACK_MPROTECT) {
+        volatile char sink = *c;   /* reads are seen too */
+        (void)sink;
+    } else {
+        *(volatile char*)c = 1;
+    }
+    page_tracker_sample();
+    assert(pool_ptr_class(c) == PAGE_HOT);
+    assert(pool_ptr_class(c + POOL_PAGE_SIZE) == PAGE_COLD);
+
+    /* too large for the warm tail page: falls back to first fit */
+    char *f = (char*)malloc_warm_fit(2 * POOL_PAGE_SIZE);
+    assert(f && f < hot);
+    my_free(f);
+    my_free(w);
+
+    page_tracker_stop();
+    assert(pool_ptr_class(front + POOL_PAGE_SIZE) == PAGE_HOT);
+    heap_check();
+}
+
+int main(void) {
+    char *front = (char*)malloc_first_fit(COLD_BYTES);
+    char *hot = (char*)malloc_first_fit(16);
+    assert(front && hot);
+    memset(hot, 0x11, 16);
+    my_free(front);
+
+    /* every page is hot while tracking is off */
+    for (size_t i = 0; i < POOL_PAGES; ++i) assert(pool_page_class(i) == PAGE_HOT);
+    assert(page_tracker_start(42) == -1);
+
+    assert(page_tracker_start(TRACK_MPROTECT) == 0);
+    assert(page_tracker_start(TRACK_MPROTECT) == 0);
+    assert(page_tracker_start(TRACK_SOFT_DIRTY) == -1);
+    run(TRACK_MPROTECT, front, hot);
+
+    /* soft-dirty tracking needs CONFIG_MEM_SOFT_DIRTY */
+    if (page_tracker_start(TRACK_SOFT_DIRTY) == 0) run(TRACK_SOFT_DIRTY, front, hot);
+    else printf("soft-dirty tracking unavailable, skipped\n");
+
+    page_tracker_stop();   /* no-op when off */
+    my_free(hot);
+    heap_check_empty();
+    return 0;
+}
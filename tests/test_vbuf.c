@@ -0,0 +1,99 @@
+/* Growable reservations and locked mode: a vbuf grows in place and shrinks
+   back, and pool_locked_bytes() follows what is really mlock()ed (VmLck)
+   through option toggles, vbuf growth, shrinking, release and pool_close().
+   Build: cc -O2 -pthread tests/test_vbuf.c -o test_vbuf */
+#define POOL_SIZE       (1 << 16)
+#define BUDDY_MAX_ORDER 16
+#include "../mmu.h"
+#include "heap_check.h"
+
+/* VmLck from /proc/self/status, in bytes */
+static size_t vm_locked(void) {
+    FILE *f = fopen("/proc/self/status", "r");
+    char line[256];
+    size_t kb = 0;
+    assert(f);
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "VmLck: %zu kB", &kb) == 1) break;
+    fclose(f);
+    return kb * 1024;
+}
+
+static void check_locked(size_t expect) {
+    assert(pool_locked_bytes() == expect);
+    assert(vm_locked() == expect);
+}
+
+int main(void) {
+    VBuf a, b;
+    assert(vbuf_reserve(&a, (size_t)64 << 20) == 0);
+
+    /* growth never moves the buffer and stops at the reservation */
+    char *first = (char*)vbuf_append(&a, "hello", 5);
+    assert(first == a.base && a.committed == VBUF_COMMIT_CHUNK);
+    for (int i = 0; i < 100; ++i) {
+        char *p = (char*)vbuf_grow(&a, 1000);
+        assert(p == a.base + 5 + (size_t)i * 1000);
+        memset(p, i, 1000);
+    }
+    assert(a.committed == 2 * VBUF_COMMIT_CHUNK);
+    assert(vbuf_grow(&a, a.reserved) == NULL && a.used == 100005);
+    assert(vbuf_commit(&a, a.reserved + 1) == -1);
+
+    /* shrinking drops whole pages past the new end; the prefix survives */
+    vbuf_shrink(&a, 5000);
+    assert(a.used == 5000 && a.committed == 2 * POOL_PAGE_SIZE);
+    assert(memcmp(a.base, "hello", 5) == 0 && a.base[4999] == 4);
+    assert(vbuf_grow(&a, 70000) == a.base + 5000 && a.base[4999] == 4);
+    check_locked(0);
+
+    if (pool_set_options(POOL_OPT_MLOCK) != 0) {
+        printf("mlock not permitted, locked mode skipped\n");
+        vbuf_release(&a);
+        return 0;
+    }
+    /* existing commits are locked when the option is set, new ones as they grow */
+    check_locked(a.committed);
+    assert(vbuf_reserve(&b, 1 << 20) == 0);
+    assert(vbuf_grow(&b, 10));
+    assert(vbuf_grow(&a, 3 * VBUF_COMMIT_CHUNK));
+    check_locked(a.committed + b.committed);
+
+    /* clearing the option unlocks every buffer, so a later shrink or
+       release has nothing left to subtract */
+    pool_set_options(0);
+    check_locked(0);
+    vbuf_shrink(&a, 1);
+    vbuf_release(&b);
+    check_locked(0);
+
+    /* shrink and release subtract exactly what each buffer had locked */
+    assert(vbuf_grow(&a, 2 * VBUF_COMMIT_CHUNK));
+    size_t unlocked_prefix = a.committed;
+    pool_set_options(POOL_OPT_MLOCK);
+    assert(vbuf_grow(&a, 4 * VBUF_COMMIT_CHUNK));
+    check_locked(a.committed);
+    assert(vbuf_reserve(&b, 1 << 20) == 0);
+    assert(vbuf_grow(&b, 1));
+    vbuf_shrink(&a, unlocked_prefix / 2);
+    check_locked(a.committed + b.committed);
+    vbuf_release(&a);
+    check_locked(b.committed);
+
+    /* the pool itself is locked when it is mapped and unlocked when closed */
+    void *p = malloc_first_fit(100);
+    assert(p);
+    check_locked(b.committed + POOL_MAP_SIZE);
+    pool_close();
+    check_locked(b.committed);
+    vbuf_release(&b);
+    check_locked(0);
+    pool_set_options(0);
+    check_locked(0);
+
+    /* a fresh pool after close is not locked */
+    my_free(malloc_first_fit(100));
+    heap_check_empty();
+    check_locked(0);
+    return 0;
+}
@@ -0,0 +1,178 @@
+/* vmsim: lackey text converts to the expected records, a simulated run
+   counts the faults and writebacks of a plain replacement engine for every
+   policy (repeat runs included), a pipe gives the same results as a file,
+   and mrc agrees with the engine's LRU.
+   Build: cc -O2 -pthread tests/test_vmsim.c -o test_vmsim */
+#define main vmsim_main
+#include "../tools/vmsim.c"
+#undef main
+#include "heap_check.h"
+
+#define REFS   200000
+#define FRAMES 64
+
+typedef struct result {
+    unsigned long long refs, hits, walks, faults, evictions, writebacks;
+} Result;
+
+static char out_text[8192];
+
+/* run vmsim with stdout captured; returns its exit code */
+static int vmsim(int argc, char **argv) {
+    fflush(stdout);
+    assert(freopen("out.txt", "w", stdout));
+    int rc = vmsim_main(argc, argv);
+    fflush(stdout);
+    FILE *f = fopen("out.txt", "r");
+    size_t n = fread(out_text, 1, sizeof(out_text) - 1, f);
+    out_text[n] = 0;
+    fclose(f);
+    return rc;
+}
+
+static Result parse_run(void) {
+    Result r;
+    const char *p = strstr(out_text, "references");
+    assert(p && sscanf(p, "references %llu", &r.refs) == 1);
+    assert((p = strstr(out_text, "tlb")) && sscanf(p, "tlb %llu hits, %llu walks", &r.hits, &r.walks) == 2);
+    assert((p = strstr(out_text, "frames of")) &&
+           sscanf(p, "frames of %*u KB: %llu faults, %llu evictions, %llu writebacks", &r.faults, &r.evictions,
+                  &r.writebacks) == 3);
+    return r;
+}
+
+/* what vmsim should count, straight from the replacement engine */
+static Result model(int policy, const uint64_t *t, size_t n) {
+    static uint64_t pages[REFS];
+    uint8_t dirty[FRAMES] = { 0 };
+    Result r;
+    memset(&r, 0, sizeof(r));
+    ReplEngine e;
+    for (size_t i = 0; i < n; ++i) pages[i] = (t[i] & VMSIM_VA_MASK) >> PT_SHIFT_4K;
+    assert(repl_init(&e, FRAMES, policy) == 0);
+    if (policy == REPL_OPT) assert(repl_set_future(&e, pages, n) == 0);
+    for (size_t i = 0; i < n; ++i) {
+        if (repl_access(&e, pages[i]) == 0) {
+            if (e.victim != REPL_NO_PAGE) r.writebacks += dirty[e.frame];
+            dirty[e.frame] = 0;
+        }
+        dirty[e.frame] |= VMSIM_STORE(t[i]);
+    }
+    r.refs = n;
+    r.faults = e.faults;
+    r.evictions = e.evictions;
+    repl_destroy(&e);
+    return r;
+}
+
+static void write_trace(const char *path, const uint64_t *t, size_t n) {
+    FILE *f = fopen(path, "wb");
+    assert(f && fwrite(VMSIM_MAGIC, 1, 8, f) == 8 && fwrite(t, sizeof(uint64_t), n, f) == n);
+    fclose(f);
+}
+
+int main(void) {
+    /* lackey text: banner lines skipped, a straddling store split per page,
+       a load past the top of the address space cut there */
+    FILE *f = fopen("lackey.txt", "w");
+    fputs("==42== Lackey, an example Valgrind tool\n"
+          "I  0400d7d4,8\n"
+          " L 7ff000398,8\n"
+          " S 04001ffc,16\n"
+          " M 0601000,4\n"
+          " L fffffffffffe,16\n"
+          "==42== \n", f);
+    fclose(f);
+    char *conv[] = { (char*)"vmsim", (char*)"convert", (char*)"lackey.txt", (char*)"lackey.bin" };
+    assert(vmsim(4, conv) == 0);
+    static const uint64_t want[6] = {
+        0x0400d7d4ull | (uint64_t)VMSIM_I << 62, 0x7ff000398ull | (uint64_t)VMSIM_L << 62,
+        0x04001ffcull | (uint64_t)VMSIM_S << 62, 0x04002000ull | (uint64_t)VMSIM_S << 62,
+        0x0601000ull | (uint64_t)VMSIM_M << 62, 0xfffffffffffeull | (uint64_t)VMSIM_L << 62,
+    };
+    uint64_t got[7];
+    char magic[8];
+    assert((f = fopen("lackey.bin", "rb")) && fread(magic, 1, 8, f) == 8 && memcmp(magic, VMSIM_MAGIC, 8) == 0);
+    assert(fread(got, sizeof(uint64_t), 7, f) == 6 && memcmp(got, want, sizeof(want)) == 0);
+    fclose(f);
+
+    /* runs of repeats, a hot set and cold pages, half of them stores */
+    static uint64_t t[REFS];
+    uint64_t page = 0;
+    for (size_t i = 0; i < REFS; ++i) {
+        uint32_t r = test_rand();
+        if (r % 4 == 0) page = r % 3 ? (r >> 8) % 48 : (r >> 8) % 400;
+        t[i] = (0x400000ull + (page << 12) + (r >> 20)) | (uint64_t)(r >> 30) << 62;
+    }
+    write_trace("trace.bin", t, REFS);
+
+    char frames[16];
+    snprintf(frames, sizeof(frames), "%d", FRAMES);
+    for (int policy = 0; policy < REPL_POLICIES; ++policy) {
+        char *run_args[] = { (char*)"vmsim", (char*)"run", (char*)"-p", (char*)repl_name(policy), (char*)"-f", frames, (char*)"trace.bin" };
+        assert(vmsim(7, run_args) == 0);
+        Result r = parse_run(), m = model(policy, t, REFS);
+        assert(r.refs == REFS && r.hits + r.walks == REFS && r.walks > 0);
+        assert(r.faults == m.faults && r.evictions == m.evictions && r.writebacks == m.writebacks);
+    }
+
+    /* the same trace from a pipe, in writes that split records */
+    char *pipe_args[] = { (char*)"vmsim", (char*)"run", (char*)"-f", frames, (char*)"-" };
+    int fds[2], saved = dup(STDIN_FILENO);
+    assert(pipe(fds) == 0);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        assert(write(fds[1], VMSIM_MAGIC, 8) == 8);
+        const char *bytes = (const char*)t;
+        for (size_t off = 0; off < sizeof(t); ) {
+            size_t len = sizeof(t) - off < 1001 ? sizeof(t) - off : 1001;
+            ssize_t w = write(fds[1], bytes + off, len);
+            assert(w > 0);
+            off += (size_t)w;
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    dup2(fds[0], STDIN_FILENO);
+    close(fds[0]);
+    assert(vmsim(5, pipe_args) == 0);
+    Result piped = parse_run();
+    waitpid(pid, NULL, 0);
+    Result lru = model(REPL_LRU, t, REFS);
+    assert(piped.refs == REFS && piped.faults == lru.faults && piped.writebacks == lru.writebacks);
+
+    /* mrc: LRU misses at every power of two in one pass */
+    char *mrc_args[] = { (char*)"vmsim", (char*)"mrc", (char*)"trace.bin" };
+    assert(vmsim(3, mrc_args) == 0);
+    static uint64_t pages[REFS];
+    for (size_t i = 0; i < REFS; ++i) pages[i] = (t[i] & VMSIM_VA_MASK) >> PT_SHIFT_4K;
+    for (uint32_t size = 1; size <= 256; size *= 2) {
+        char key[32];
+        snprintf(key, sizeof(key), "\n%12u ", size);
+        const char *row = strstr(out_text, key);
+        unsigned long long misses;
+        assert(row && sscanf(row + strlen(key), "%*s %*s %llu", &misses) == 1);
+        assert(misses == repl_run(REPL_LRU, size, pages, REFS));
+    }
+
+    /* bad arguments and inputs */
+    char *bad_policy[] = { (char*)"vmsim", (char*)"run", (char*)"-p", (char*)"mru", (char*)"trace.bin" };
+    char *not_trace[] = { (char*)"vmsim", (char*)"run", (char*)"lackey.txt" };
+    assert(vmsim(5, bad_policy) == 2);
+    assert(vmsim(3, not_trace) == 1);
+
+    /* OPT needs the whole trace up front */
+    char *opt_pipe[] = { (char*)"vmsim", (char*)"run", (char*)"-p", (char*)"opt", (char*)"-" };
+    assert(pipe(fds) == 0 && write(fds[1], VMSIM_MAGIC, 8) == 8);
+    close(fds[1]);
+    dup2(fds[0], STDIN_FILENO);
+    close(fds[0]);
+    assert(vmsim(5, opt_pipe) == 1);
+    dup2(saved, STDIN_FILENO);
+    close(saved);
+
+    /* the tables live in the simulator's own pool, which is empty again */
+    heap_check_empty();
+    return 0;
+}
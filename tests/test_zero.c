@@ -0,0 +1,78 @@
+/* Pre-zeroed free blocks: my_calloc() memory is all zero whether or not
+   its block was pre-zeroed, the worker thread cleans freed blocks in the
+   background, and a block merged away mid-zeroing is never zeroed after
+   its bytes have been handed out again.
+   Build: cc -O2 -pthread tests/test_zero.c -o test_zero */
+#define POOL_SIZE       (1 << 20)
+#define BUDDY_MAX_ORDER 20
+#include "../mmu.h"
+#include "heap_check.h"
+
+static void check_zero(const void *p, size_t len) {
+    for (size_t k = 0; k < len; ++k) assert(((const unsigned char*)p)[k] == 0);
+}
+
+static void* dirty(size_t len) {
+    void *p = malloc_first_fit(len);
+    assert(p);
+    memset(p, 0xa5, len);
+    return p;
+}
+
+int main(void) {
+    /* a fresh pool is zero already */
+    size_t len = 300000;
+    void *p = my_calloc(1, len);
+    assert(p && header_from_user(p)->flags == 0);
+    check_zero(p, len);
+    memset(p, 0xa5, len);
+    my_free(p);
+    assert(pool_zero_step(1 << 30) > 0 && pool_zero_step(1 << 30) == 0);
+    assert(pool_zeroed_bytes() >= len);
+    check_zero(p = my_calloc(len, 1), len);
+    my_free(p);
+    assert(my_calloc((size_t)1 << 40, (size_t)1 << 40) == NULL);
+    heap_check_empty();
+
+    /* a partly zeroed block is merged away, then allocated over */
+    void *a = dirty(100), *x = dirty(100), *b = dirty(200000), *c = dirty(1000);
+    my_free(a);   /* too small to be zeroed */
+    my_free(b);
+    assert(pool_zero_step(ZERO_SLICE) == ZERO_SLICE);
+    my_free(x);   /* a + x + b merge; b's header stays behind intact */
+    p = malloc_first_fit(190000);
+    assert(p == a);
+    size_t live = 1000;   /* b's old header lies before this */
+    assert((char*)b + sizeof(FreeMeta) < (char*)p + live);
+    memset((char*)p + live, 0x3c, 190000 - live);
+    pool_zero_step(1 << 30);
+    for (size_t k = live; k < 190000; ++k) assert(((unsigned char*)p)[k] == 0x3c);
+    my_free(p);
+    my_free(c);
+    pool_zero_step(1 << 30);
+    heap_check_empty();
+
+    /* the worker cleans up behind the allocator; close stops it */
+    assert(pool_zero_start() == 0 && pool_zero_start() == 0);
+    void *blocks[32];
+    for (int round = 0; round < 20; ++round) {
+        for (int i = 0; i < 32; ++i) blocks[i] = dirty(5000 + (size_t)i * 997);
+        for (int i = 0; i < 32; i += 2) my_free(blocks[i]);
+        for (int i = 0; i < 16; ++i) {
+            size_t n = 3000 + (size_t)i * 1500;
+            check_zero(p = my_calloc(1, n), n);
+            my_free(p);
+        }
+        for (int i = 1; i < 32; i += 2) my_free(blocks[i]);
+        heap_check();
+    }
+    while (pool_zeroed_bytes() < POOL_SIZE - sizeof(Header) - sizeof(FreeMeta)) sched_yield();
+    heap_check_empty();
+    pool_close();
+    my_free(dirty(100000));
+    assert(pool_zero_step(1 << 30) > 0);
+    pool_zero_stop();
+    heap_check_empty();
+    pool_close();
+    return 0;
+}
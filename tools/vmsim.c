@@ -0,0 +1,449 @@
+/* Trace-driven virtual memory simulator: page table, TLB and page
+   replacement fed from a compact binary trace.
+   Build: gcc -O2 -march=native tools/vmsim.c -o vmsim
+
+   vmsim convert <lackey.txt|-> <trace.bin|->   Valgrind lackey text to binary
+   vmsim run [options] <trace.bin|->            simulate a binary trace
+   vmsim mrc [options] <trace.bin|->            LRU miss ratio of every size
+
+   A binary trace is the 8-byte magic "VMTRACE1" followed by one uint64 per
+   reference: the 48-bit virtual address in bits 0-47 and the access type
+   (VMSIM_I/L/S/M) in bits 62-63. Files are mmap'd; "-" streams from a pipe.
+   Either way references are simulated in batches of VMSIM_BATCH. */
+#define POOL_SIZE       (1 << 28)   /* page tables; mapped lazily */
+#define BUDDY_MAX_ORDER 28
+#include "../mmu.h"
+#include <time.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#define VMSIM_MAGIC   "VMTRACE1"
+#define VMSIM_BATCH   (1 << 16)
+#define VMSIM_PREFETCH 16        /* references the hash lookups run ahead */
+#define VMSIM_VA_MASK 0x0000FFFFFFFFFFFFull
+#define VMSIM_STORE(r) ((uint8_t)((r) >> 63))   /* 1 for VMSIM_S and VMSIM_M */
+
+enum { VMSIM_I = 0, VMSIM_L = 1, VMSIM_S = 2, VMSIM_M = 3 };
+
+typedef struct sim {
+    PageTable pt;
+    Tlb tlb;
+    ReplEngine repl;
+    int shift;                /* simulated page size */
+    int repeat_exact;         /* policy ignores immediate re-references */
+    uint8_t *dirty;           /* per frame */
+    uint64_t last_vpn;        /* page of the previous reference */
+    uint32_t last_frame;
+    uint64_t refs, repeats, writebacks;
+} Sim;
+
+/* ---------- convert ---------- */
+
+static FILE* open_out(const char *path) {
+    if (strcmp(path, "-") == 0) return stdout;
+    FILE *f = fopen(path, "wb");
+    if (!f) perror(path);
+    return f;
+}
+
+static const char* parse_hex(const char *s, uint64_t *v) {
+    uint64_t x = 0;
+    for (;; ++s) {
+        unsigned c = (unsigned char)*s;
+        if (c - '0' < 10) x = x << 4 | (c - '0');
+        else if ((c | 0x20) - 'a' < 6) x = x << 4 | ((c | 0x20) - 'a' + 10);
+        else break;
+    }
+    *v = x;
+    return s;
+}
+
+/* Lackey lines look like "I  0400d7d4,8" or " S 7ff000398,8"; anything
+   else (the ==pid== banner) is skipped. A reference that straddles a
+   4 KB boundary becomes one record per page, up to the end of the 48-bit
+   address space. */
+static int convert(const char *in_path, const char *out_path) {
+    FILE *in = strcmp(in_path, "-") == 0 ? stdin : fopen(in_path, "r");
+    if (!in) {
+        perror(in_path);
+        return 1;
+    }
+    FILE *out = open_out(out_path);
+    if (!out) return 1;
+    static uint64_t buf[VMSIM_BATCH];
+    size_t n = 0, total = 0;
+    char line[256];
+    fwrite(VMSIM_MAGIC, 1, 8, out);
+    while (fgets(line, sizeof(line), in)) {
+        const char *s = line;
+        while (*s == ' ') s++;
+        unsigned type;
+        switch (*s) {
+        case 'I': type = VMSIM_I; break;
+        case 'L': type = VMSIM_L; break;
+        case 'S': type = VMSIM_S; break;
+        case 'M': type = VMSIM_M; break;
+        default: continue;
+        }
+        if (s[1] != ' ') continue;
+        s += 2;
+        while (*s == ' ') s++;
+        uint64_t addr, size = 1;
+        s = parse_hex(s, &addr);
+        if (*s == ',') size = strtoull(s + 1, NULL, 10);
+        if (size == 0) size = 1;
+        addr &= VMSIM_VA_MASK;
+        /* a reference running past the address space is cut at its end
+           rather than wrapped, which would never reach `end` */
+        uint64_t end = size - 1 > VMSIM_VA_MASK - addr ? VMSIM_VA_MASK : addr + size - 1;
+        for (uint64_t a = addr;; a = (a | (POOL_PAGE_SIZE - 1)) + 1) {
+            buf[n++] = a | (uint64_t)type << 62;
+            if (n == VMSIM_BATCH) {
+                fwrite(buf, sizeof(uint64_t), n, out);
+                total += n;
+                n = 0;
+            }
+            if ((a >> 12) == (end >> 12)) break;
+        }
+    }
+    fwrite(buf, sizeof(uint64_t), n, out);
+    total += n;
+    int err = ferror(in) || ferror(out) || fflush(out) != 0;
+    if (in != stdin) fclose(in);
+    if (out != stdout) fclose(out);
+    if (err) {
+        fprintf(stderr, "convert: I/O error\n");
+        return 1;
+    }
+    fprintf(stderr, "%zu references\n", total);
+    return 0;
+}
+
+/* ---------- trace input ---------- */
+
+typedef struct trace_in {
+    int fd;
+    const uint64_t *refs;   /* the whole file when mapped, NULL for a pipe */
+    size_t count, map_len;
+} TraceIn;
+
+typedef int (*batch_fn)(void *ctx, const uint64_t *refs, size_t n);
+
+/* check the magic, then map a regular file; a pipe is left to be read */
+static int trace_open(const char *path, TraceIn *in) {
+    memset(in, 0, sizeof(*in));
+    in->fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    if (in->fd < 0) {
+        perror(path);
+        return -1;
+    }
+    char magic[8];
+    size_t got = 0;
+    while (got < 8) {
+        ssize_t r = read(in->fd, magic + got, 8 - got);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        got += (size_t)r;
+    }
+    if (got != 8 || memcmp(magic, VMSIM_MAGIC, 8) != 0) {
+        fprintf(stderr, "%s: not a vmsim trace\n", path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(in->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        size_t len = (size_t)st.st_size;
+        in->count = (len - 8) / sizeof(uint64_t);
+        void *m = mmap(NULL, len, PROT_READ, MAP_PRIVATE, in->fd, 0);
+        if (m == MAP_FAILED) {
+            perror("mmap");
+            return -1;
+        }
+        madvise(m, len, MADV_SEQUENTIAL);
+        in->refs = (const uint64_t*)((const char*)m + 8);
+        in->map_len = len;
+    }
+    return 0;
+}
+
+/* hand the references to fn in batches of up to VMSIM_BATCH */
+static int trace_for_each(TraceIn *in, batch_fn fn, void *ctx) {
+    if (in->refs) {
+        for (size_t k = 0; k < in->count; k += VMSIM_BATCH)
+            if (fn(ctx, in->refs + k, in->count - k < VMSIM_BATCH ? in->count - k : VMSIM_BATCH) != 0) return -1;
+        return 0;
+    }
+    static uint64_t buf[VMSIM_BATCH];
+    size_t have = 0;   /* bytes in buf */
+    for (;;) {
+        ssize_t got = read(in->fd, (char*)buf + have, sizeof(buf) - have);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            perror("read");
+            return -1;
+        }
+        if (got == 0) return 0;
+        have += (size_t)got;
+        size_t whole = have / sizeof(uint64_t);
+        if (fn(ctx, buf, whole) != 0) return -1;
+        have -= whole * sizeof(uint64_t);
+        memmove(buf, buf + whole, have);   /* partial record */
+    }
+}
+
+static void trace_close(TraceIn *in) {
+    if (in->map_len) munmap((void*)((const char*)in->refs - 8), in->map_len);
+    if (in->fd > STDIN_FILENO) close(in->fd);
+}
+
+static double elapsed(const struct timespec *t0) {
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (double)(t1.tv_sec - t0->tv_sec) + (double)(t1.tv_nsec - t0->tv_nsec) * 1e-9;
+}
+
+static int parse_page_size(const char *v, int *shift) {
+    if (strcasecmp(v, "2m") == 0) *shift = PT_SHIFT_2M;
+    else if (strcasecmp(v, "4k") == 0) *shift = PT_SHIFT_4K;
+    else return -1;
+    return 0;
+}
+
+/* ---------- run ---------- */
+
+static int sim_fault(Sim *s, uint64_t vpn) {
+    ReplEngine *e = &s->repl;
+    if (e->victim != REPL_NO_PAGE) {
+        uint64_t va = e->victim << s->shift;
+        pt_unmap(&s->pt, va);
+        tlb_invalidate(&s->tlb, va, 0);
+        s->writebacks += s->dirty[e->frame];
+    }
+    s->dirty[e->frame] = 0;
+    if (pt_map(&s->pt, vpn << s->shift, (uint64_t)e->frame << s->shift, s->shift, PT_WRITE | PT_USER) != 0) {
+        fprintf(stderr, "run: out of page table memory\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* An immediate re-reference of the same page is a TLB hit on the entry
+   just used, which changes no TLB state an LRU, FIFO or random TLB keeps;
+   FIFO, LRU and CLOCK frames ignore it too. For those policies a run of
+   references to the previous page is only scanned: one compare per
+   reference, its stores folded into one dirty flag. The rest go through
+   replacement, the page table and the TLB. */
+static int sim_batch(void *ctx, const uint64_t *refs, size_t n) {
+    Sim *s = (Sim*)ctx;
+    const int shift = s->shift;
+    uint64_t last = s->last_vpn;
+    size_t i = 0;
+    for (;;) {
+        size_t run = i;
+        uint8_t stored = 0;
+        if (s->repeat_exact) {
+            for (; i < n && ((refs[i] & VMSIM_VA_MASK) >> shift) == last; ++i) stored |= VMSIM_STORE(refs[i]);
+        } else {
+            for (; i < n && ((refs[i] & VMSIM_VA_MASK) >> shift) == last; ++i) {
+                if (repl_access(&s->repl, last) < 0) return -1;
+                stored |= VMSIM_STORE(refs[i]);
+            }
+        }
+        s->dirty[s->last_frame] |= stored;
+        s->repeats += i - run;
+        if (i == n) break;
+
+        if (i + VMSIM_PREFETCH < n) repl_prefetch(&s->repl, (refs[i + VMSIM_PREFETCH] & VMSIM_VA_MASK) >> shift);
+        uint64_t va = refs[i] & VMSIM_VA_MASK;
+        uint64_t vpn = va >> shift;
+        int r = repl_access(&s->repl, vpn);
+        if (r < 0) return -1;
+        if (r == 0 && sim_fault(s, vpn) != 0) return -1;
+        uint64_t pa;
+        tlb_translate(&s->tlb, &s->pt, va, 0, &pa);
+        last = vpn;
+        s->last_frame = s->repl.frame;
+        s->dirty[s->last_frame] |= VMSIM_STORE(refs[i]);
+        i++;
+    }
+    s->last_vpn = last;
+    s->refs += n;
+    return 0;
+}
+
+static int parse_tlb(const char *arg, TlbConfig *c) {
+    unsigned entries, ways;
+    if (sscanf(arg, "%u:%u", &entries, &ways) != 2) return -1;
+    c->entries = entries;
+    c->ways = ways;
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: vmsim convert <lackey.txt|-> <trace.bin|->\n"
+            "       vmsim run [-f frames] [-p fifo|lru|clock|lfu|arc|opt] [-P 4k|2m]\n"
+            "                 [-t entries:ways] [-T entries:ways] <trace.bin|->\n"
+            "       vmsim mrc [-P 4k|2m] [-m max_pages] <trace.bin|->\n"
+            "  -f  physical frames (default 16384)\n"
+            "  -p  page replacement policy (default lru)\n"
+            "  -P  page size (default 4k)\n"
+            "  -t  4 KB TLB (default 64:4), -T 2 MB TLB (default 32:4)\n"
+            "  -m  largest size reported exactly, in pages (default 1048576)\n");
+}
+
+static int run(int argc, char **argv) {
+    uint32_t frames = 16384;
+    int policy = REPL_LRU, shift = PT_SHIFT_4K, bad = 0;
+    TlbConfig cfg[TLB_SIZES] = { { 64, 4 }, { 32, 4 }, { 0, 0 } };
+    int i = 0;
+    for (; i + 1 < argc && argv[i][0] == '-' && argv[i][1]; i += 2) {
+        const char *v = argv[i + 1];
+        switch (argv[i][1]) {
+        case 'f':
+            frames = (uint32_t)strtoul(v, NULL, 0);
+            break;
+        case 'p':
+            for (policy = 0; policy < REPL_POLICIES; ++policy)
+                if (strcasecmp(v, repl_name(policy)) == 0) break;
+            break;
+        case 'P':
+            bad |= parse_page_size(v, &shift) != 0;
+            break;
+        case 't':
+            bad |= parse_tlb(v, &cfg[0]) != 0;
+            break;
+        case 'T':
+            bad |= parse_tlb(v, &cfg[1]) != 0;
+            break;
+        default:
+            bad = 1;
+        }
+    }
+    if (i + 1 != argc || policy == REPL_POLICIES || bad || !cfg[shift == PT_SHIFT_4K ? 0 : 1].entries) {
+        usage();
+        return 2;
+    }
+    const char *path = argv[i];
+
+    TraceIn in;
+    if (trace_open(path, &in) != 0) return 1;
+    if (policy == REPL_OPT && !in.refs) {
+        fprintf(stderr, "OPT needs the whole trace; pass a file, not a pipe\n");
+        return 1;
+    }
+
+    Sim s;
+    memset(&s, 0, sizeof(s));
+    s.shift = shift;
+    s.repeat_exact = policy == REPL_FIFO || policy == REPL_LRU || policy == REPL_CLOCK;
+    s.last_vpn = REPL_NO_PAGE;
+    s.dirty = (uint8_t*)calloc(frames, 1);
+    if (!s.dirty || pt_init(&s.pt) != 0 || tlb_init(&s.tlb, cfg, TLB_LRU) != 0 ||
+        repl_init(&s.repl, frames, policy) != 0)
+        return 1;
+    if (policy == REPL_OPT) {
+        /* next-use indices over page numbers, computed before the clock starts */
+        uint64_t *pages = (uint64_t*)malloc((in.count ? in.count : 1) * sizeof(uint64_t));
+        if (!pages) {
+            perror("malloc");
+            return 1;
+        }
+        for (size_t k = 0; k < in.count; ++k) pages[k] = (in.refs[k] & VMSIM_VA_MASK) >> shift;
+        int rc = repl_set_future(&s.repl, pages, in.count);
+        free(pages);
+        if (rc != 0) return 1;
+    }
+
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (trace_for_each(&in, sim_batch, &s) != 0) return 1;
+    double secs = elapsed(&t0);
+
+    uint64_t lookups = s.tlb.lookups + s.repeats;
+    uint64_t tlb_hits = s.tlb.hits + s.repeats;
+    printf("references   %llu (%llu repeats of the previous page)\n",
+           (unsigned long long)s.refs, (unsigned long long)s.repeats);
+    printf("tlb          %llu hits, %llu walks, %.3f%% miss\n", (unsigned long long)tlb_hits,
+           (unsigned long long)s.tlb.walks, lookups ? 100.0 * (double)s.tlb.walks / (double)lookups : 0.0);
+    printf("paging       %s, %u frames of %u KB: %llu faults, %llu evictions, %llu writebacks\n",
+           repl_name(policy), frames, 1u << (shift - 10), (unsigned long long)s.repl.faults,
+           (unsigned long long)s.repl.evictions, (unsigned long long)s.writebacks);
+    printf("throughput   %.1f M refs/s (%.3f s)\n", secs > 0 ? (double)s.refs / secs * 1e-6 : 0.0, secs);
+
+    repl_destroy(&s.repl);
+    tlb_destroy(&s.tlb);
+    pt_destroy(&s.pt);
+    free(s.dirty);
+    trace_close(&in);
+    return 0;
+}
+
+/* ---------- mrc ---------- */
+
+typedef struct mrc {
+    StackDist sd;
+    int shift;
+} Mrc;
+
+static int mrc_batch(void *ctx, const uint64_t *refs, size_t n) {
+    Mrc *m = (Mrc*)ctx;
+    for (size_t i = 0; i < n; ++i)
+        if (sd_access(&m->sd, (refs[i] & VMSIM_VA_MASK) >> m->shift) == SD_ERROR) return -1;
+    return 0;
+}
+
+/* One pass of stack distances, then the miss ratio of a fully associative
+   LRU memory (or TLB) at every power-of-two size, up to the footprint. */
+static int mrc(int argc, char **argv) {
+    int shift = PT_SHIFT_4K, bad = 0;
+    uint32_t max_pages = 1u << 20;
+    int i = 0;
+    for (; i + 1 < argc && argv[i][0] == '-' && argv[i][1]; i += 2) {
+        if (argv[i][1] == 'P') bad |= parse_page_size(argv[i + 1], &shift) != 0;
+        else if (argv[i][1] == 'm') max_pages = (uint32_t)strtoul(argv[i + 1], NULL, 0);
+        else bad = 1;
+    }
+    if (i + 1 != argc || bad) {
+        usage();
+        return 2;
+    }
+    TraceIn in;
+    Mrc m;
+    m.shift = shift;
+    if (trace_open(argv[i], &in) != 0 || sd_init(&m.sd, max_pages) != 0) return 1;
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (trace_for_each(&in, mrc_batch, &m) != 0) return 1;
+    double secs = elapsed(&t0);
+
+    const StackDist *sd = &m.sd;
+    printf("references   %llu, %llu distinct %u KB pages\n", (unsigned long long)sd->refs,
+           (unsigned long long)sd->pages, 1u << (shift - 10));
+    printf("%12s %12s %14s %10s\n", "pages", "memory", "misses", "miss %");
+    for (uint64_t size = 1; size <= max_pages; size *= 2) {
+        uint64_t misses = sd_misses(sd, size);
+        uint64_t kb = size << (shift - 10);
+        char mem[32];
+        if (kb >= (1u << 20)) snprintf(mem, sizeof(mem), "%llu GB", (unsigned long long)(kb >> 20));
+        else if (kb >= 1024) snprintf(mem, sizeof(mem), "%llu MB", (unsigned long long)(kb >> 10));
+        else snprintf(mem, sizeof(mem), "%llu KB", (unsigned long long)kb);
+        printf("%12llu %12s %14llu %9.3f%%\n", (unsigned long long)size, mem, (unsigned long long)misses,
+               sd->refs ? 100.0 * (double)misses / (double)sd->refs : 0.0);
+        if (size >= sd->pages) break;   /* only cold misses from here on */
+    }
+    if (sd->beyond) printf("%llu references beyond %u pages are counted as misses\n",
+                           (unsigned long long)sd->beyond, max_pages);
+    printf("throughput   %.1f M refs/s (%.3f s)\n", secs > 0 ? (double)sd->refs / secs * 1e-6 : 0.0, secs);
+    sd_destroy(&m.sd);
+    trace_close(&in);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 2 && strcmp(argv[1], "convert") == 0 && argc == 4) return convert(argv[2], argv[3]);
+    if (argc >= 2 && strcmp(argv[1], "run") == 0) return run(argc - 2, argv + 2);
+    if (argc >= 2 && strcmp(argv[1], "mrc") == 0) return mrc(argc - 2, argv + 2);
+    usage();
+    return 2;
+}